@@ -2,12 +2,22 @@
     Space Invaders (SDL2) with a Restart Mechanic and Score Display
     ---------------------------------------------------------------
     - Move left/right with arrow keys, shoot with SPACE.
-    - Single row of aliens moves side-to-side; descending upon hitting a boundary.
+    - Waves of aliens move side-to-side; descending upon hitting a boundary.
     - If all aliens are destroyed, you see "Victory!".
     - If they reach your row (or you run out of lives), "Game Over!".
     - Press 'R' after game over or victory to restart.
     - SDL2_image loads PNG/JPG textures (ship/alien).
     - SDL2_ttf draws on-screen text for messages and score.
+    - Synthesized shot/explosion/march sounds through a lock-free mixer.
+    - Bottom-most alien of each column fires back at the player.
+    - Four destructible shields stored as one 64-bit bitmask per row.
+    - Pixel-perfect hits from 1-bit sprite masks built at startup.
+    - Explosion debris from a pooled SoA particle system (SIMD update).
+    - Per-wave alien scripts compiled to bytecode (see waves.txt).
+    - Tunables in a config file, reloaded while the game runs (Linux).
+    - Crash-safe high-score table (checksummed journal + compacted file).
+    - A 64-bit state hash is kept up to date incrementally every tick
+      (for replay verification and desync detection).
 
     Compile example (macOS/Linux):
       gcc space_invaders.c -o space_invaders \
@@ -16,143 +26,8163 @@
 
     Run:
       ./space_invaders
+      ./space_invaders --hash-log hashes.txt   (write "tick hash" per tick)
+      ./space_invaders --bench [ticks]         (headless autopilot run)
+      ./space_invaders --export out.y4m        (record the session as Y4M)
+      ./space_invaders --headless --frames 600 --export out.y4m
+      ./space_invaders --headless --export-pipe "ffmpeg -y -i - out.mp4"
+      ./space_invaders --waves waves.txt       (stream waves from a file)
+      ./space_invaders --endless [--wave-seed N]  (generated waves forever)
+      ./space_invaders --no-audio
+      ./space_invaders --threaded              (sim on its own thread)
+      ./space_invaders --headless --perf-log perf.bin  (Linux HW counters)
+      ./space_invaders --trace trace.json      (build with -DENABLE_TRACE;
+                                                F9 dumps, exit dumps too)
+      ./space_invaders --headless --time-scale 64   (fast-forward 64 ticks/update)
+      ./space_invaders --record run.rep        (save inputs + keyframes)
+      ./space_invaders --replay run.rep [--seek N]  (arrows scrub by 600)
+      ./space_invaders --scores my.scores      (high-score table; --no-scores)
+      ./space_invaders --leaderboard-daemon [socket]  (ranking service)
+      ./space_invaders --leaderboard [socket]  (report results to it)
+      ./space_invaders --broadcast [name]      (publish to shared memory)
+      ./space_invaders --spectate [name]       (watch a broadcasting game)
+      ./space_invaders --internal-res 224x256  (render small, upscale)
+      ./space_invaders --soft-blit             (no GPU: SIMD blits to the window)
+      ./space_invaders --config space_invaders.cfg  (tunables; saved edits apply live)
+      SDL_AUDIODRIVER=disk ./space_invaders --headless   (audio to a file)
 */
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(ENABLE_TRACE) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// ------------------ Config Settings ------------------
+// Speeds, shot limits, lives, the classic formation, the window size and
+// the particle pool can be changed at run time with --config (see
+// "Config"); their #defines below are the defaults. The MAX_* slot counts
+// stay compile-time: they size arrays inside GameState.
+#define CONFIG_MAX_BYTES  8192   // largest config file
+#define CONFIG_MAX_VALUE    32   // longest value text
 
 // ------------------ Window Settings ------------------
-#define WINDOW_WIDTH   640
+#define WINDOW_WIDTH   640    // the playfield; the window is scaled to fit
 #define WINDOW_HEIGHT  480
 
-// ------------------ Player Settings ------------------
-#define PLAYER_SPEED       5
-#define PLAYER_WIDTH      32    // ship.png width
-#define PLAYER_HEIGHT     32    // ship.png height
-#define PLAYER_LIVES       3
+// ------------------ Fixed Point Settings -------------
+#define FIX_SHIFT         16
+#define FIX_ONE           (1 << FIX_SHIFT)
+#define FIX(px)           ((px) * FIX_ONE)   // whole pixels to 16.16
+
+// ------------------ Player Settings ------------------
+#define PLAYER_SPEED      FIX(5)    // 16.16 px per tick
+#define PLAYER_WIDTH      32    // ship.png width
+#define PLAYER_HEIGHT     32    // ship.png height
+#define PLAYER_LIVES       3
+
+// ------------------ Bullet Settings ------------------
+#define BULLET_SPEED      FIX(7)
+#define BULLET_WIDTH       4
+#define BULLET_HEIGHT     10
+#define MAX_BULLETS        8    // slots; max_bullets picks how many may fly
+#define BULLETS_IN_FLIGHT  5    // default max_bullets
+
+// ------------------ Time Step Settings ---------------
+#define MAX_TIME_SCALE   256    // --time-scale: ticks of motion per update
+#define SIM_HZ            60    // tick rate of the --threaded sim thread
+
+// ------------------ Enemy Fire Settings --------------
+#define ENEMY_BULLET_SPEED     FIX(4)
+#define ENEMY_BULLET_WIDTH     4
+#define ENEMY_BULLET_HEIGHT   10
+#define MAX_ENEMY_BULLETS      8   // slots, <= MAX_BULLETS (<= 8, see snapPutBullets)
+#define ENEMY_BULLETS_IN_FLIGHT 6  // default max_enemy_bullets
+#define ENEMY_FIRE_TICKS      30   // base interval between enemy shots
+#define ENEMY_FIRE_JITTER     30   // plus 0..JITTER-1 random ticks
+
+// ------------------ Alien Settings -------------------
+#define ALIEN_COUNT        8    // per row
+#define ALIEN_ROWS         1
+#define ALIEN_WIDTH       32    // alien.jpg width
+#define ALIEN_HEIGHT      32    // alien.jpg height
+#define ALIEN_START_X     50
+#define ALIEN_START_Y     50
+#define ALIEN_SPACING     50
+#define ALIEN_SPEED       FIX(1)    // FIX(1) / 2: half a pixel per tick
+#define ALIEN_DESCENT     20
+#define MAX_ALIENS       128    // largest formation a wave may request
+
+// ------------------ Collision Mask Settings ----------
+#define MASK_MAX_SIZE     64    // sprites up to 64x64 get a 1-bit mask
+#define MASK_ALPHA_MIN   128    // opaque enough to count as solid ...
+#define MASK_RGB_MIN      96    // ... and brighter than the black backdrop
+
+// ------------------ Shield Settings ------------------
+#define SHIELD_COUNT       4
+#define SHIELD_WIDTH      44    // bits per row, at most 64
+#define SHIELD_HEIGHT     32
+#define SHIELD_GAP_ABOVE  32    // px between a shield's bottom and the ship
+
+// ------------------ Wave Settings --------------------
+#define WAVE_PREFETCH     16    // waves parsed ahead by the loader thread
+#define WAVE_ROW_SPACING  40
+
+// ------------------ Script Settings ------------------
+#define SCRIPT_MAX_OPS    48    // instructions per alien script
+#define SCRIPT_MAX_CONSTS 16
+#define SCRIPT_MAX_REGS   32    // inputs, variables and temporaries
+#define SCRIPT_BATCH      32    // aliens per interpreter pass
+#define SCRIPT_MAX_DEFS   16    // scripts per wave file
+#define SCRIPT_NAME_LEN   32
+
+// ------------------ Asset Settings -------------------
+#define FONT_PATH      "/System/Library/Fonts/Supplemental/Arial.ttf"
+#define FONT_SIZE         32
+
+// ------------------ Capture Settings -----------------
+#define CAPTURE_QUEUE_LEN  8    // frames buffered for the encoder thread
+#define CAPTURE_FPS       60
+
+// ------------------ Audio Settings -------------------
+#define AUDIO_FREQ        48000
+#define AUDIO_SAMPLES       512   // requested callback buffer (frames)
+#define AUDIO_QUEUE_LEN      64   // game -> mixer command ring, power of two
+#define AUDIO_VOICES         16
+#define MARCH_TICKS_MIN       6   // march beat interval with one alien left
+#define MARCH_TICKS_MAX      48   // ... and with the full formation
+#define MAX_EVENTS           64   // game events recorded per tick
+
+// ------------------ Entity Storage Settings ----------
+#define ECS_CHUNK_BYTES      16384   // largest chunk of SoA component columns
+#define ECS_MAX_COMPONENTS      16
+#define ECS_MAX_ARCHETYPES       8
+
+// ------------------ Particle Settings ----------------
+#define MAX_PARTICLES        131072   // default pool capacity (multiple of 4)
+#define EXPLOSION_PARTICLES      48
+#define PARTICLE_LIFE_TICKS      45
+#define PARTICLE_SPEED         3.0f   // max initial px per tick
+#define PARTICLE_GRAVITY      0.06f
+#define PARTICLE_DRAG         0.97f
+#define PARTICLE_SIZE          2.0f
+
+// ------------------ Observation Settings -------------
+#define OBS_SHIP_VALUE   200    // grayscale intensity per entity type
+#define OBS_ALIEN_VALUE  128
+#define OBS_BULLET_VALUE 255
+#define OBS_SHIELD_VALUE  80
+
+// ------------------ Replay Settings ------------------
+#define REPLAY_KEYFRAME_TICKS  300   // updates between full-state keyframes
+#define REPLAY_SEEK_STEP       600   // updates per seek key press (10 s)
+
+// ------------------ High Score Settings --------------
+#define HISCORE_PATH      "space_invaders.scores"
+#define HISCORE_TABLE_SIZE       10
+#define HISCORE_QUEUE_LEN        16   // games waiting for the writer thread
+#define HISCORE_COMPACT_RECORDS  64   // journal records before compacting
+#define HISCORE_RETRY_MS       1000   // wait before retrying a failed append
+
+// ------------------ Snapshot Settings ----------------
+#define SNAPSHOT_MAX_BYTES    9216   // worst-case encoded delta (every field changed)
+
+// ------------------ Leaderboard Settings -------------
+#define LEADERBOARD_SOCKET     "/tmp/space_invaders.sock"
+#define LEADERBOARD_BATCH          8   // results per submission message
+#define LEADERBOARD_FLUSH_MS    2000   // send a partial batch after this long
+#define LEADERBOARD_QUEUE_LEN     64   // results waiting for the sender thread
+#define LEADERBOARD_MAX_CLIENTS   64
+#define SKIPLIST_MAX_LEVEL        32
+
+// ------------------ Spectator Settings ---------------
+#define SPECTATE_NAME           "/space_invaders"   // shm_open name
+#define SPECTATE_SLOTS           256   // updates kept in the ring (~4 s)
+#define SPECTATE_KEYFRAME_TICKS   60   // full state every this many updates
+
+// ------------------ Trace Settings -------------------
+// Build with -DENABLE_TRACE to compile the trace markers in.
+#define TRACE_BUFFER_EVENTS 65536   // per thread, power of two (oldest dropped)
+#define TRACE_MAX_DEPTH        32   // nesting of open markers per thread
+
+// ------------------ Hash Settings --------------------
+#define HASH_SEED         0x5350414345494E56ull  // "SPACEINV"
+
+// ------------------ Bench Settings -------------------
+#define BENCH_DEFAULT_TICKS 1000000
+#define BENCH_ENVS            64    // batch size for the observation bench
+#define BENCH_OBS_STEPS     2000
+#define BENCH_OBS_SIZE        84
+#define BENCH_OBS_STACK        4
+#define BENCH_RESETS     1000000
+#define BENCH_COLLISIONS 4000000
+#define BENCH_PARTICLES   100000
+#define BENCH_PARTICLE_FRAMES 600
+#define BENCH_SNAPSHOT_TICKS 200000
+#define BENCH_RENDER_FRAMES    300
+#define BENCH_SCRIPT_TICKS  200000
+#define BENCH_CONFIG_PARSES 100000
+
+// ------------------ App Globals -----------------------
+static bool gRunning    = true;
+
+// ------------------ Tracing ---------------------------
+// Scoped markers around loop phases and subsystems, exported as Chrome
+// trace_event JSON (open in Perfetto or chrome://tracing). Each thread
+// records into its own ring buffer; only the owning thread writes, and
+// the event count is published with a release store so a dump can run
+// while the game keeps going. Without ENABLE_TRACE every macro expands
+// to nothing.
+//   TRACE_SCOPE("name");           until the end of the enclosing block
+//   TRACE_BEGIN("name"); ... TRACE_END();
+//   TRACE_THREAD_NAME("name");     label the calling thread
+#ifdef ENABLE_TRACE
+#if defined(__x86_64__) || defined(__i386__)
+#define traceNow() __rdtsc()        // a few ns; calibrated against SDL at dump
+#else
+#define traceNow() SDL_GetPerformanceCounter()
+#endif
+
+typedef struct {
+    const char* name;
+    Uint64      start, end;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    TraceEvent          events[TRACE_BUFFER_EVENTS];
+    atomic_ullong       count;
+    const char*         openName[TRACE_MAX_DEPTH];
+    Uint64              openStart[TRACE_MAX_DEPTH];
+    int                 depth;
+    int                 tid;
+    const char*         threadName;
+    struct TraceBuffer* next;
+} TraceBuffer;
+
+static _Atomic(TraceBuffer*)     gTraceThreads;
+static atomic_int                gTraceNextTid;
+static Uint64                    gTraceEpoch;       // traceNow() at init
+static Uint64                    gTraceEpochSDL;    // SDL counter at init
+static _Thread_local TraceBuffer* tTrace;
+
+static TraceBuffer* traceThread(void)
+{
+    if (!tTrace) {
+        TraceBuffer* t = calloc(1, sizeof(*t));
+        if (!t) return NULL;
+        t->tid  = atomic_fetch_add(&gTraceNextTid, 1) + 1;
+        t->next = atomic_load(&gTraceThreads);
+        while (!atomic_compare_exchange_weak(&gTraceThreads, &t->next, t)) {
+        }
+        tTrace = t;
+    }
+    return tTrace;
+}
+
+static inline int traceBegin(const char* name)
+{
+    TraceBuffer* t = tTrace ? tTrace : traceThread();
+    if (t && t->depth < TRACE_MAX_DEPTH) {
+        t->openName[t->depth]  = name;
+        t->openStart[t->depth] = traceNow();
+    }
+    if (t) t->depth++;
+    return 0;
+}
+
+static inline void traceEnd(void)
+{
+    Uint64       now = traceNow();
+    TraceBuffer* t   = tTrace;
+    if (!t || t->depth == 0) return;
+    if (--t->depth >= TRACE_MAX_DEPTH) return;
+    unsigned long long n = atomic_load_explicit(&t->count, memory_order_relaxed);
+    TraceEvent* e = &t->events[n & (TRACE_BUFFER_EVENTS - 1)];
+    e->name  = t->openName[t->depth];
+    e->start = t->openStart[t->depth];
+    e->end   = now;
+    atomic_store_explicit(&t->count, n + 1, memory_order_release);
+}
+
+static inline void traceScopeEnd(int* scope)
+{
+    (void)scope;
+    traceEnd();
+}
+
+static void traceThreadName(const char* name)
+{
+    TraceBuffer* t = traceThread();
+    if (t && !t->threadName) t->threadName = name;
+}
+
+void traceInit(void)
+{
+    gTraceEpoch    = traceNow();
+    gTraceEpochSDL = SDL_GetPerformanceCounter();
+    traceThreadName("main");
+}
+
+// Writes every thread's retained events. Safe to call while other
+// threads are still recording.
+bool traceDump(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        printf("Cannot open trace file %s\n", path);
+        return false;
+    }
+    double sdlUs     = (double)(SDL_GetPerformanceCounter() - gTraceEpochSDL) * 1e6 /
+                       (double)SDL_GetPerformanceFrequency();
+    Uint64 elapsed   = traceNow() - gTraceEpoch;
+    double usPerTick = elapsed ? sdlUs / (double)elapsed : 0.0;
+    size_t written   = 0;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+    for (TraceBuffer* t = atomic_load(&gTraceThreads); t; t = t->next) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", written++ ? ",\n" : "",
+                t->tid, t->threadName ? t->threadName : "thread");
+        unsigned long long n    = atomic_load_explicit(&t->count, memory_order_acquire);
+        unsigned long long from = n > TRACE_BUFFER_EVENTS ? n - TRACE_BUFFER_EVENTS : 0;
+        for (unsigned long long i = from; i < n; i++) {
+            const TraceEvent* e = &t->events[i & (TRACE_BUFFER_EVENTS - 1)];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f}", e->name, t->tid,
+                    (double)(e->start - gTraceEpoch) * usPerTick,
+                    (double)(e->end - e->start) * usPerTick);
+            written++;
+        }
+    }
+    fputs("\n]}\n", f);
+    fclose(f);
+    printf("trace: %zu events written to %s\n", written, path);
+    return true;
+}
+
+#define TRACE_SCOPE(name) \
+    __attribute__((cleanup(traceScopeEnd))) int traceScope_ = traceBegin(name)
+#define TRACE_BEGIN(name)       traceBegin(name)
+#define TRACE_END()             traceEnd()
+#define TRACE_THREAD_NAME(name) traceThreadName(name)
+#define TRACE_INIT()            traceInit()
+#define TRACE_DUMP(path)        do { if (path) traceDump(path); } while (0)
+#else
+#define TRACE_SCOPE(name)       ((void)0)
+#define TRACE_BEGIN(name)       ((void)0)
+#define TRACE_END()             ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#define TRACE_INIT()            ((void)0)
+#define TRACE_DUMP(path)        ((void)0)
+#endif
+
+// ------------------ Data Structures -------------------
+// 16.16 fixed point: positions and speeds in 1/65536 px.
+typedef int32_t fixed;
+
+// Entity storage (see "Entity Storage" below). A world addresses its
+// chunks by offset from itself and a chunk its columns by offset from
+// its header, so a world copied together with its pool is still valid.
+typedef uint32_t EcsMask;   // one bit per component id
+
+typedef struct {
+    int      count;
+    int      capacity;
+    uint32_t columns[ECS_MAX_COMPONENTS];   // offset from the header, 0: no column
+} EcsChunk;
+
+typedef struct {
+    EcsMask  mask;
+    int      chunkCapacity;   // entities per chunk, a multiple of 4
+    int      count;           // entities, packed into the first chunks
+    int      chunkCount;      // reserved when the archetype is added
+    uint32_t chunkBytes;
+    uint32_t firstChunk;      // offset of chunk 0 in the pool
+} EcsArchetype;
+
+typedef struct {
+    uint32_t     componentSize[ECS_MAX_COMPONENTS];   // 0: a tag, no column
+    int          componentCount;
+    EcsArchetype archetypes[ECS_MAX_ARCHETYPES];
+    int          archetypeCount;
+    int64_t      pool;        // offset of the chunk pool from the world
+    uint32_t     poolBytes;
+    uint32_t     poolUsed;
+} EcsWorld;
+
+#define ECS_BIT(component)          (1u << (component))
+#define ECS_COLUMN(chunk, c, type)  ((type*)((uint8_t*)(chunk) + (chunk)->columns[c]))
+#define ECS_CHUNK_HEADER            ((sizeof(EcsChunk) + 15) & ~(size_t)15)
+
+// Bytes of a single chunk holding `capacity` entities of `bytes` each,
+// spread over `columns` 16-byte aligned columns.
+#define ECS_CHUNK_FIT(capacity, bytes, columns) \
+    (ECS_CHUNK_HEADER + ((capacity) + 3) / 4 * 4 * (bytes) + 15 * (columns))
+
+// Components of the simulated entities. x/y are whole pixels, which
+// collision and drawing use; fx/fy hold the sub-pixel fraction (see
+// "Fixed Point" below) and vx, the player's only, is 16.16 px per tick.
+// The last four are tags: no column, they tell the archetypes apart.
+enum { EC_X, EC_Y, EC_W, EC_H, EC_FX, EC_FY, EC_ACTIVE, EC_VX,
+       EC_PLAYER, EC_SHOT, EC_ENEMY_SHOT, EC_ALIEN, EC_COUNT };
+
+// Archetypes of the simulated entities, in the order simEntitiesInit
+// adds them. Every one fits a single chunk.
+enum { SIM_PLAYER, SIM_SHOTS, SIM_ENEMY_SHOTS, SIM_ALIENS, SIM_ARCHETYPES };
+
+#define SIM_BODY_COLUMNS  7    // x, y, w, h, fx, fy, active
+#define SIM_BODY_BYTES    (4 * sizeof(int) + 2 * sizeof(uint16_t) + sizeof(bool))
+#define SIM_PLAYER_BYTES  ECS_CHUNK_FIT(1, SIM_BODY_BYTES + sizeof(fixed), SIM_BODY_COLUMNS + 1)
+#define SIM_ALIEN_BYTES   ECS_CHUNK_FIT(MAX_ALIENS, SIM_BODY_BYTES, SIM_BODY_COLUMNS)
+#define SIM_POOL_BYTES    (SIM_PLAYER_BYTES + SIM_ALIEN_BYTES +                           \
+                           ECS_CHUNK_FIT(MAX_BULLETS, SIM_BODY_BYTES, SIM_BODY_COLUMNS) + \
+                           ECS_CHUNK_FIT(MAX_ENEMY_BULLETS, SIM_BODY_BYTES, SIM_BODY_COLUMNS))
+
+_Static_assert(SIM_ALIEN_BYTES <= ECS_CHUNK_BYTES, "a formation must fit one chunk");
+
+// The player, shots and aliens: an entity world whose chunk pool is part
+// of GameState, so every copy of the state carries them. Slots are
+// stable because the hash, the shooter index and the snapshot codec are
+// keyed by slot; a dead entity clears its active flag instead of being
+// compacted out.
+typedef struct {
+    EcsWorld world;
+    _Alignas(16) uint8_t pool[SIM_POOL_BYTES];
+} SimEntities;
+
+// A bunker: one 64-bit word per pixel row, bit x set = solid pixel at
+// column x (LSB is the left edge).
+typedef struct {
+    int      x, y;
+    uint64_t rows[SHIELD_HEIGHT];
+} Shield;
+
+// Input for one tick, produced by the keyboard or the autopilot.
+typedef struct {
+    int  move;     // -1: left, 0: none, +1: right
+    bool fire;
+    bool restart;
+} GameInput;
+
+// Compiled alien movement script (see "Alien Scripts" below).
+typedef struct {
+    uint16_t opCount;                   // 0: the built-in march
+    uint16_t constCount;
+    uint8_t  ops[SCRIPT_MAX_OPS][4];    // opcode, dst, a, b
+    fixed    consts[SCRIPT_MAX_CONSTS];
+} AlienScript;
+
+// One alien formation: rows x cols aliens, row-major in SIM_ALIENS.
+typedef struct {
+    int rows, cols;
+    int startX, startY;
+    int spacingX, spacingY;
+    fixed speed;        // horizontal 16.16 px per tick
+    int descent;        // px dropped at each edge
+    AlienScript script;
+} WaveDef;
+
+typedef struct WaveSource WaveSource;
+
+// Things that happened during a tick, for audio and effects. The game
+// records them only when GameState.events is set.
+enum { EVENT_SHOT, EVENT_ALIEN_KILLED, EVENT_MARCH, EVENT_LIFE_LOST,
+       EVENT_ENEMY_SHOT };
+
+typedef struct {
+    int type;
+    int x, y;       // where it happened (window coordinates)
+    int param;      // EVENT_MARCH: note 0..3
+} GameEvent;
+
+typedef struct {
+    GameEvent list[MAX_EVENTS];
+    int       count;
+} GameEvents;
+
+// Incremental state hash (see "State Hashing" below).
+typedef struct {
+    uint64_t sum;        // sum of all per-entity terms
+    uint64_t alienSumX;  // sum of x multipliers of live aliens
+    uint64_t alienSumY;  // sum of y multipliers of live aliens
+} StateHash;
+
+// Run-time tunables the simulation reads (see "Config"). Each GameState
+// carries its own copy, so templates, replays, snapshots and the sim
+// thread always agree on them. Every field is a 32-bit int.
+typedef struct {
+    fixed playerSpeed;
+    int   lives;              // at the start of a game
+    fixed bulletSpeed;
+    int   bullets;            // player shots in flight, <= MAX_BULLETS
+    fixed enemyBulletSpeed;
+    int   enemyBullets;       // <= MAX_ENEMY_BULLETS
+    int   enemyFireTicks;
+    int   enemyFireJitter;
+    int   alienCols, alienRows;   // the classic wave
+    int   alienStartX, alienStartY;
+    int   alienSpacing;
+    fixed alienSpeed;
+    int   alienDescent;
+} SimConfig;
+
+#define SIM_CONFIG_INTS ((int)(sizeof(SimConfig) / sizeof(int)))
+
+static const SimConfig kSimConfigDefaults = {
+    PLAYER_SPEED, PLAYER_LIVES,
+    BULLET_SPEED, BULLETS_IN_FLIGHT,
+    ENEMY_BULLET_SPEED, ENEMY_BULLETS_IN_FLIGHT, ENEMY_FIRE_TICKS, ENEMY_FIRE_JITTER,
+    ALIEN_COUNT, ALIEN_ROWS, ALIEN_START_X, ALIEN_START_Y, ALIEN_SPACING,
+    ALIEN_SPEED, ALIEN_DESCENT,
+};
+
+// Everything the simulation reads or writes.
+typedef struct {
+    SimEntities entities;
+    int       aliveCount;
+    Shield    shields[SHIELD_COUNT];
+    int16_t   colBottom[MAX_ALIENS];   // bottom-most live alien per column, < 0: none
+    int16_t   shooterCols[MAX_ALIENS]; // columns with a live alien, unordered
+    int16_t   shooterSlot[MAX_ALIENS]; // position of a column in shooterCols
+    int       shooterCount;
+    int       enemyFireTimer;          // ticks until the next enemy shot
+    uint32_t  rng;                     // xorshift state for enemy fire
+    int       timeScale;    // ticks of motion per update (0 or 1: normal)
+    SimConfig config;       // kept across resets, like timeScale
+    WaveDef   wave;
+    int       waveIndex;
+    WaveSource* waves;      // NULL: the classic single wave
+    int       lives;
+    int       score;
+    int       alienMoveDir; // +1: right, -1: left
+    bool      gameOver;
+    int       marchTimer;   // ticks until the next march beat
+    int       marchNote;
+    uint64_t  tick;
+    StateHash hash;
+    GameEvents* events;     // NULL: don't record events
+} GameState;
+
+// Precomputed opening states. Every reset is one memcpy from one of
+// these instead of re-initializing entities field by field.
+typedef struct {
+    GameState        gameStart;  // wave 0, fresh score and lives
+    GameState        waveStart;  // opening of the current wave (> 0)
+    const GameState* current;    // the one a life loss restores
+} ResetTemplates;
+
+// ------------------ Fixed Point -----------------------
+// A position is a 16.16 value stored in two parts: the whole pixels in
+// x/y, read as before by collision, drawing and observations, and the
+// fraction in fx/fy. Motion adds a 16.16 delta to the joined value and
+// splits it again. Only integer adds, masks and exact divisions are
+// involved, so results are bit-identical across compilers and
+// optimization levels, which float positions would not be.
+static inline fixed fixJoin(int px, uint16_t frac)
+{
+    return (fixed)px * FIX_ONE + frac;
+}
+
+// Whole pixels of v, rounded toward minus infinity.
+static inline int fixFloor(fixed v)
+{
+    return (int)((v - (v & (FIX_ONE - 1))) / FIX_ONE);
+}
+
+static inline void fixMove(int* px, uint16_t* frac, fixed delta)
+{
+    fixed v = fixJoin(*px, *frac) + delta;
+    *frac = (uint16_t)(v & (FIX_ONE - 1));
+    *px   = fixFloor(v);
+}
+
+// "2", "0.5", "1.25" to 16.16, rounded to the nearest 1/65536. No floats,
+// so a wave file means the same on every build. False on anything else.
+static bool parseFixed(const char* text, fixed* out)
+{
+    const char* p = text;
+    long whole = 0;
+    uint64_t num = 0, den = 1;
+    bool digits = false;
+    for (; *p >= '0' && *p <= '9' && whole < 32768; p++, digits = true) {
+        whole = whole * 10 + (*p - '0');
+    }
+    if (*p == '.') {
+        for (p++; *p >= '0' && *p <= '9'; p++, digits = true) {
+            if (den < 1000000000ull) {
+                num = num * 10 + (uint64_t)(*p - '0');
+                den *= 10;
+            }
+        }
+    }
+    if (!digits || *p != '\0' || whole >= 32768) return false;
+    *out = (fixed)(whole * FIX_ONE + (long)((num * FIX_ONE + den / 2) / den));
+    return true;
+}
+
+// ------------------ Entity Storage --------------------
+// Archetype storage for entities. An archetype is a fixed set of
+// components; its entities live in chunks of at most 16 KB that hold one
+// column per component (SoA), every column 16-byte aligned and padded to
+// a multiple of four, so SIMD loops run straight down it. A query names
+// the components it needs and walks the chunks of every archetype that
+// has them, in order. Entities are appended to the last chunk and removal
+// compacts, so chunks stay full and a new kind of entity is an archetype
+// plus a query rather than another set of arrays and loops.
+//
+// A world owns no memory. Its caller hands it a pool, each archetype
+// reserves the chunks for its capacity there up front, and everything
+// is an offset: world to pool, header to column. The simulation keeps
+// its world and pool inside GameState (SimEntities), which resets,
+// replays, spectators and snapshots copy whole. An archetype that needs
+// less than a full chunk gets one sized to fit.
+
+void ecsWorldInit(EcsWorld* world)
+{
+    memset(world, 0, sizeof(*world));
+}
+
+// Returns the new component's id, or -1 when the table is full. Size 0
+// makes a tag: it is part of archetype masks but has no column.
+int ecsComponent(EcsWorld* world, size_t size)
+{
+    if (world->componentCount == ECS_MAX_COMPONENTS) return -1;
+    world->componentSize[world->componentCount] = (uint32_t)size;
+    return world->componentCount++;
+}
+
+// Entities per chunk and bytes per chunk for an archetype of `mask` with
+// room for `capacity`: as many as fit ECS_CHUNK_BYTES, or a smaller chunk
+// when that already holds them all. False if a chunk can't hold four.
+static bool ecsChunkLayout(const EcsWorld* world, EcsMask mask, int capacity,
+                           int* perChunk, size_t* bytes)
+{
+    size_t perEntity = 0, padding = 0;
+    for (int c = 0; c < world->componentCount; c++) {
+        if ((mask & ECS_BIT(c)) && world->componentSize[c]) {
+            perEntity += world->componentSize[c];
+            padding   += 15;
+        }
+    }
+    if (perEntity == 0 || capacity < 1) return false;
+    int fit  = (int)((ECS_CHUNK_BYTES - ECS_CHUNK_HEADER - padding) / perEntity) & ~3;
+    int want = (capacity + 3) & ~3;
+    if (fit < 4) return false;
+    *perChunk = want < fit ? want : fit;
+
+    size_t at = ECS_CHUNK_HEADER;
+    for (int c = 0; c < world->componentCount; c++) {
+        if ((mask & ECS_BIT(c)) && world->componentSize[c]) {
+            at = (at + (size_t)*perChunk * world->componentSize[c] + 15) & ~(size_t)15;
+        }
+    }
+    *bytes = at;
+    return true;
+}
+
+// Pool bytes an archetype of `mask` with room for `capacity` reserves;
+// 0 if it can't be added.
+size_t ecsArchetypeBytes(const EcsWorld* world, EcsMask mask, int capacity)
+{
+    int    perChunk;
+    size_t bytes;
+    if (!ecsChunkLayout(world, mask, capacity, &perChunk, &bytes)) return 0;
+    return (size_t)((capacity + perChunk - 1) / perChunk) * bytes;
+}
+
+// Hands the world its chunk pool: `bytes` at `pool`, 16-byte aligned. The
+// world finds it by its distance from itself, so the two move together.
+void ecsWorldPool(EcsWorld* world, void* pool, size_t bytes)
+{
+    world->pool      = (int64_t)((uint8_t*)pool - (uint8_t*)world);
+    world->poolBytes = (uint32_t)bytes;
+    world->poolUsed  = 0;
+}
+
+// Chunk k of an archetype. Like strchr, it hands out a writable chunk of
+// a const world; only callers that may write the world write through it.
+static inline EcsChunk* ecsChunkAt(const EcsWorld* world, int archetype, int k)
+{
+    const EcsArchetype* a = &world->archetypes[archetype];
+    return (EcsChunk*)((uint8_t*)world + world->pool + a->firstChunk + (size_t)k * a->chunkBytes);
+}
+
+// Returns the archetype's index with its chunks reserved and zeroed, or
+// -1 if none can be added, a chunk can't hold four entities or the pool
+// is too small.
+int ecsArchetype(EcsWorld* world, EcsMask mask, int capacity)
+{
+    int    perChunk;
+    size_t bytes;
+    if (world->archetypeCount == ECS_MAX_ARCHETYPES ||
+        !ecsChunkLayout(world, mask, capacity, &perChunk, &bytes)) {
+        return -1;
+    }
+    int chunks = (capacity + perChunk - 1) / perChunk;
+    if ((size_t)chunks * bytes > world->poolBytes - world->poolUsed) return -1;
+
+    int           k = world->archetypeCount++;
+    EcsArchetype* a = &world->archetypes[k];
+    a->mask          = mask;
+    a->chunkCapacity = perChunk;
+    a->count         = 0;
+    a->chunkCount    = chunks;
+    a->chunkBytes    = (uint32_t)bytes;
+    a->firstChunk    = world->poolUsed;
+    world->poolUsed += (uint32_t)(chunks * bytes);
+
+    for (int n = 0; n < chunks; n++) {
+        EcsChunk* chunk = ecsChunkAt(world, k, n);
+        memset(chunk, 0, bytes);   // padding lanes stay finite
+        chunk->capacity = perChunk;
+        size_t at = ECS_CHUNK_HEADER;
+        for (int c = 0; c < world->componentCount; c++) {
+            if (!(mask & ECS_BIT(c)) || !world->componentSize[c]) continue;
+            chunk->columns[c] = (uint32_t)at;
+            at = (at + (size_t)perChunk * world->componentSize[c] + 15) & ~(size_t)15;
+        }
+    }
+    return k;
+}
+
+// Appends one entity to `archetype` and returns its chunk, with *index
+// set to its slot there; its components are whatever the slot last held.
+// NULL when the archetype is full.
+EcsChunk* ecsAppend(EcsWorld* world, int archetype, int* index)
+{
+    EcsArchetype* a = &world->archetypes[archetype];
+    if (a->count == a->chunkCount * a->chunkCapacity) return NULL;
+    EcsChunk* chunk = ecsChunkAt(world, archetype, a->count / a->chunkCapacity);
+    *index = chunk->count++;
+    a->count++;
+    return chunk;
+}
+
+// Sets the number of entities of `archetype`, packed from the front:
+// callers compact the survivors first when shrinking, and a grown range
+// keeps whatever its slots last held. False if it doesn't fit.
+bool ecsResize(EcsWorld* world, int archetype, int count)
+{
+    EcsArchetype* a = &world->archetypes[archetype];
+    if (count < 0 || count > a->chunkCount * a->chunkCapacity) return false;
+    a->count = count;
+    for (int c = 0; c < a->chunkCount; c++) {
+        int left = count - c * a->chunkCapacity;
+        ecsChunkAt(world, archetype, c)->count =
+            left <= 0 ? 0 : left < a->chunkCapacity ? left : a->chunkCapacity;
+    }
+    return true;
+}
+
+typedef struct {
+    const EcsWorld* world;
+    EcsMask         mask;
+    int             archetype;   // of the chunk ecsNext returned last
+    int             chunk;       // next chunk of that archetype
+    int             base;        // archetype slot of that chunk's first entity
+} EcsQuery;
+
+static inline EcsQuery ecsQuery(const EcsWorld* world, EcsMask mask)
+{
+    EcsQuery q = { world, mask, 0, 0, 0 };
+    return q;
+}
+
+// Next non-empty chunk whose archetype has every component in the mask.
+static inline EcsChunk* ecsNext(EcsQuery* q)
+{
+    for (; q->archetype < q->world->archetypeCount; q->archetype++, q->chunk = 0) {
+        const EcsArchetype* a = &q->world->archetypes[q->archetype];
+        if ((a->mask & q->mask) != q->mask) continue;
+        if (q->chunk * a->chunkCapacity < a->count) {
+            q->base = q->chunk * a->chunkCapacity;
+            return ecsChunkAt(q->world, q->archetype, q->chunk++);
+        }
+    }
+    return NULL;
+}
+
+// The chunk of `other`, a world with the same layout, in the place of the
+// one ecsNext returned last: for walking two copies of a state in step.
+static inline EcsChunk* ecsPeer(const EcsWorld* other, const EcsQuery* q)
+{
+    return ecsChunkAt(other, q->archetype, q->chunk - 1);
+}
+
+// A chunk of simulated entities as arrays; row i is archetype slot
+// base + i.
+typedef struct {
+    int      *x, *y, *w, *h;
+    uint16_t *fx, *fy;
+    bool     *active;
+    fixed    *vx;       // NULL without EC_VX
+    int       count;
+    int       base;
+} EntityColumns;
+
+static inline EntityColumns entityColumns(const EcsChunk* c, int base)
+{
+    EntityColumns e = {
+        ECS_COLUMN(c, EC_X, int),       ECS_COLUMN(c, EC_Y, int),
+        ECS_COLUMN(c, EC_W, int),       ECS_COLUMN(c, EC_H, int),
+        ECS_COLUMN(c, EC_FX, uint16_t), ECS_COLUMN(c, EC_FY, uint16_t),
+        ECS_COLUMN(c, EC_ACTIVE, bool),
+        c->columns[EC_VX] ? ECS_COLUMN(c, EC_VX, fixed) : NULL,
+        c->count, base,
+    };
+    return e;
+}
+
+// The chunk of `archetype` holding `slot`, with *row set to its row.
+static inline EntityColumns simSlot(const GameState* game, int archetype, int slot, int* row)
+{
+    int per = game->entities.world.archetypes[archetype].chunkCapacity;
+    *row = slot % per;
+    return entityColumns(ecsChunkAt(&game->entities.world, archetype, slot / per), slot - *row);
+}
+
+// The player is the one entity of SIM_PLAYER, row 0 of its chunk.
+static inline EntityColumns playerColumns(const GameState* game)
+{
+    return entityColumns(ecsChunkAt(&game->entities.world, SIM_PLAYER, 0), 0);
+}
+
+static inline int alienCount(const GameState* game)
+{
+    return game->entities.world.archetypes[SIM_ALIENS].count;
+}
+
+static inline bool alienAlive(const GameState* game, int i)
+{
+    int row;
+    return simSlot(game, SIM_ALIENS, i, &row).active[row];
+}
+
+// Registers the components and archetypes of the simulated entities in
+// `e`, its pool included, and adds every shot slot, idle. The player and
+// the aliens are added by buildWaveTemplate.
+static void simEntitiesInit(SimEntities* e)
+{
+    static const size_t kSizes[EC_COUNT] = {
+        sizeof(int), sizeof(int), sizeof(int), sizeof(int),
+        sizeof(uint16_t), sizeof(uint16_t), sizeof(bool), sizeof(fixed),
+    };
+    const EcsMask body = ECS_BIT(EC_X) | ECS_BIT(EC_Y) | ECS_BIT(EC_W) | ECS_BIT(EC_H) |
+                         ECS_BIT(EC_FX) | ECS_BIT(EC_FY) | ECS_BIT(EC_ACTIVE);
+    EcsWorld* w = &e->world;
+    ecsWorldInit(w);
+    for (int c = 0; c < EC_COUNT; c++) ecsComponent(w, kSizes[c]);
+    ecsWorldPool(w, e->pool, sizeof(e->pool));
+    ecsArchetype(w, body | ECS_BIT(EC_VX) | ECS_BIT(EC_PLAYER), 1);
+    ecsArchetype(w, body | ECS_BIT(EC_SHOT), MAX_BULLETS);
+    ecsArchetype(w, body | ECS_BIT(EC_ENEMY_SHOT), MAX_ENEMY_BULLETS);
+    ecsArchetype(w, body | ECS_BIT(EC_ALIEN), MAX_ALIENS);
+
+    ecsResize(w, SIM_SHOTS, MAX_BULLETS);
+    ecsResize(w, SIM_ENEMY_SHOTS, MAX_ENEMY_BULLETS);
+    EcsQuery  q = ecsQuery(w, ECS_BIT(EC_SHOT));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns s = entityColumns(c, q.base);
+        for (int i = 0; i < s.count; i++) {
+            s.w[i] = BULLET_WIDTH;
+            s.h[i] = BULLET_HEIGHT;
+        }
+    }
+    q = ecsQuery(w, ECS_BIT(EC_ENEMY_SHOT));
+    while ((c = ecsNext(&q))) {
+        EntityColumns s = entityColumns(c, q.base);
+        for (int i = 0; i < s.count; i++) {
+            s.w[i] = ENEMY_BULLET_WIDTH;
+            s.h[i] = ENEMY_BULLET_HEIGHT;
+        }
+    }
+}
+
+// The world every state starts from, built on first use. States are only
+// ever copies of it, so it is also the layout theirs is checked against.
+static SimEntities gSimEntities;
+static bool        gSimEntitiesReady = false;
+
+static const SimEntities* simEntitiesEmpty(void)
+{
+    if (!gSimEntitiesReady) {
+        simEntitiesInit(&gSimEntities);
+        gSimEntitiesReady = true;
+    }
+    return &gSimEntities;
+}
+
+// ------------------ Collision Check -------------------
+bool rect_collide(int x1, int y1, int w1, int h1,
+                  int x2, int y2, int w2, int h2)
+{
+    return (x1 < x2 + w2) && (x1 + w1 > x2) &&
+           (y1 < y2 + h2) && (y1 + h1 > y2);
+}
+
+// ------------------ Collision Masks -------------------
+// Narrow phase behind rect_collide. Each sprite gets a 1-bit mask at its
+// on-screen size, one 64-bit word per row, built once from the image
+// file. A pair that passes the AABB test collides only if some row of
+// one mask ANDed with the other's row, shifted by the x offset, is
+// non-zero. Until sprite masks are loaded every mask is a full box, which
+// is exactly the old AABB behaviour.
+typedef struct {
+    int      w, h;
+    uint64_t rows[MASK_MAX_SIZE];
+} SpriteMask;
+
+typedef struct {
+    SpriteMask ship;
+    SpriteMask alien;
+    SpriteMask bullet;
+    SpriteMask enemyBullet;
+} CollisionMasks;
+
+static CollisionMasks gMasks;
+static bool           gMasksReady = false;
+
+static void maskFill(SpriteMask* m, int w, int h)
+{
+    memset(m, 0, sizeof(*m));
+    m->w = w;
+    m->h = h;
+    for (int r = 0; r < h; r++) {
+        m->rows[r] = (w == 64) ? ~0ull : (1ull << w) - 1;
+    }
+}
+
+static const CollisionMasks* collisionMasks(void)
+{
+    if (!gMasksReady) {
+        maskFill(&gMasks.ship, PLAYER_WIDTH, PLAYER_HEIGHT);
+        maskFill(&gMasks.alien, ALIEN_WIDTH, ALIEN_HEIGHT);
+        maskFill(&gMasks.bullet, BULLET_WIDTH, BULLET_HEIGHT);
+        maskFill(&gMasks.enemyBullet, ENEMY_BULLET_WIDTH, ENEMY_BULLET_HEIGHT);
+        gMasksReady = true;
+    }
+    return &gMasks;
+}
+
+// Samples the image at the size it is drawn, one texel per cell center.
+static bool maskFromImage(SpriteMask* m, const char* path, int w, int h)
+{
+    SDL_Surface* loaded = IMG_Load(path);
+    if (!loaded) {
+        printf("Collision mask: IMG_Load(%s) failed: %s\n", path, IMG_GetError());
+        return false;
+    }
+    SDL_Surface* surf = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+    if (!surf) return false;
+
+    SDL_LockSurface(surf);
+    memset(m, 0, sizeof(*m));
+    m->w = w;
+    m->h = h;
+    for (int r = 0; r < h; r++) {
+        const Uint32* row = (const Uint32*)((const Uint8*)surf->pixels +
+                            (size_t)((2 * r + 1) * surf->h / (2 * h)) * surf->pitch);
+        for (int c = 0; c < w; c++) {
+            Uint32 px = row[(2 * c + 1) * surf->w / (2 * w)];
+            int    a  = px >> 24;
+            int    rgb = (int)((px >> 16) & 0xFF) + (int)((px >> 8) & 0xFF) + (int)(px & 0xFF);
+            if (a >= MASK_ALPHA_MIN && rgb >= MASK_RGB_MIN) {
+                m->rows[r] |= 1ull << c;
+            }
+        }
+    }
+    SDL_UnlockSurface(surf);
+    SDL_FreeSurface(surf);
+    return true;
+}
+
+// Replaces the ship and alien boxes with masks from their images. A
+// sprite whose image can't be read keeps its full box.
+void collisionMasksLoad(const char* shipPath, const char* alienPath)
+{
+    CollisionMasks* masks = (CollisionMasks*)collisionMasks();
+    SpriteMask      m;
+    if (maskFromImage(&m, shipPath, PLAYER_WIDTH, PLAYER_HEIGHT)) masks->ship = m;
+    if (maskFromImage(&m, alienPath, ALIEN_WIDTH, ALIEN_HEIGHT))  masks->alien = m;
+}
+
+static bool masksOverlap(const SpriteMask* a, int ax, int ay,
+                         const SpriteMask* b, int bx, int by)
+{
+    int dx = bx - ax;                      // b's columns in a's frame
+    if (dx >= 64 || dx <= -64) return false;
+    int y0 = ay > by ? ay : by;
+    int y1 = ay + a->h < by + b->h ? ay + a->h : by + b->h;
+    for (int y = y0; y < y1; y++) {
+        uint64_t rowB = b->rows[y - by];
+        if (a->rows[y - ay] & (dx >= 0 ? rowB << dx : rowB >> -dx)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// AABB first; the mask test only runs for boxes that overlap.
+static inline bool spriteCollide(const SpriteMask* a, int ax, int ay,
+                                 const SpriteMask* b, int bx, int by)
+{
+    return rect_collide(ax, ay, a->w, a->h, bx, by, b->w, b->h) &&
+           masksOverlap(a, ax, ay, b, bx, by);
+}
+
+// ------------------ Swept Collision -------------------
+// Continuous tests for things that move several pixels per step. The
+// caller passes positions at the start of the step and the motion of a
+// relative to b, so a moving target is handled by subtracting its own
+// motion. The boxes overlap for t in (enter, exit); inside that window
+// the masks are tested one pixel of relative motion at a time, so fast
+// bullets and coarse time steps can't tunnel through a sprite.
+// Times are exact fractions (num / den, den > 0) compared by cross-
+// multiplying, and a hit is reported as step k of n, so the result is
+// the same on every compiler and FPU; the simulation hashes it.
+typedef struct {
+    int64_t num, den;
+} SweepTime;
+
+static inline bool sweepBefore(SweepTime a, SweepTime b)
+{
+    return a.num * b.den < b.num * a.den;
+}
+
+// Narrows [enter, exit] to the times the boxes overlap on one axis.
+static bool sweptAxis(int a0, int aw, int d, int b0, int bw,
+                      SweepTime* enter, SweepTime* exit)
+{
+    if (d == 0) return a0 < b0 + bw && a0 + aw > b0;
+    int64_t   sign = d < 0 ? -1 : 1;
+    SweepTime t0 = { sign * (b0 - (a0 + aw)), sign * d };
+    SweepTime t1 = { sign * (b0 + bw - a0),   sign * d };
+    if (t0.num > t1.num) { SweepTime t = t0; t0 = t1; t1 = t; }
+    if (sweepBefore(*enter, t0)) *enter = t0;
+    if (sweepBefore(t1, *exit))  *exit  = t1;
+    return sweepBefore(*enter, *exit);
+}
+
+// Whether a, moving by (dx, dy) during the step, hits b. On a hit, the
+// earliest contact is step *k of *n (time *k / *n, *n > 0).
+static inline bool sweptSpriteHit(const SpriteMask* a, int ax, int ay, int dx, int dy,
+                                  const SpriteMask* b, int bx, int by, int* k, int* n)
+{
+    // Cheap reject: the box covering a's whole path misses b
+    int pathX = dx < 0 ? ax + dx : ax, pathY = dy < 0 ? ay + dy : ay;
+    if (!rect_collide(pathX, pathY, a->w + abs(dx), a->h + abs(dy),
+                      bx, by, b->w, b->h)) {
+        return false;
+    }
+
+    SweepTime enter = { 0, 1 }, exit = { 1, 1 };
+    if (!sweptAxis(ax, a->w, dx, bx, b->w, &enter, &exit) ||
+        !sweptAxis(ay, a->h, dy, by, b->h, &enter, &exit)) {
+        return false;
+    }
+
+    int steps = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+    if (steps == 0) {
+        *k = 0;
+        *n = 1;
+        return masksOverlap(a, ax, ay, b, bx, by);
+    }
+    // enter >= 0, so these divisions are floors
+    int k0 = (int)(enter.num * steps / enter.den);
+    int k1 = (int)(exit.num * steps / exit.den) + 1;
+    if (k1 > steps) k1 = steps;
+    for (int s = k0; s <= k1; s++) {
+        if (spriteCollide(a, ax + dx * s / steps, ay + dy * s / steps, b, bx, by)) {
+            *k = s;
+            *n = steps;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ------------------ State Hashing ---------------------
+// The hash is a sum (mod 2^64) of one term per entity, K + X*x + Y*y,
+// where K/X/Y are per-slot random odd constants and x/y the full 16.16
+// positions, fraction included. Because the sum is
+// linear in positions, moving every live alien by (dx, dy) changes it by
+// dx*alienSumX + dy*alienSumY, so the formation march costs O(1).
+// Other mutations swap a single entity's term. Inactive entities
+// contribute nothing. The exposed value is the sum run through a
+// finalizer so every bit depends on every term.
+enum { HASH_PLAYER = 1, HASH_BULLET, HASH_ALIEN, HASH_GLOBALS,
+       HASH_ENEMY_BULLET, HASH_SHIELD };
+enum { HASH_K, HASH_X, HASH_Y, HASH_VX, HASH_SCORE, HASH_LIVES,
+       HASH_DIR, HASH_OVER, HASH_WAVE, HASH_RNG };
+
+static inline uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t hashKey(uint32_t kind, uint32_t slot, uint32_t field)
+{
+    return mix64(HASH_SEED ^ ((uint64_t)kind << 48) ^
+                 ((uint64_t)slot << 16) ^ field) | 1;
+}
+
+// Hash kind of each simulated archetype, by index.
+static const uint32_t kSimHashKind[SIM_ARCHETYPES] = {
+    HASH_PLAYER, HASH_BULLET, HASH_ENEMY_BULLET, HASH_ALIEN
+};
+
+// Term of row i of a chunk of `kind` entities; the player's includes its
+// velocity.
+static inline uint64_t entityTerm(uint32_t kind, const EntityColumns* e, int i)
+{
+    if (!e->active[i]) return 0;
+    uint32_t slot = (uint32_t)(e->base + i);
+    uint64_t term = hashKey(kind, slot, HASH_K)
+                  + hashKey(kind, slot, HASH_X) * (uint64_t)fixJoin(e->x[i], e->fx[i])
+                  + hashKey(kind, slot, HASH_Y) * (uint64_t)fixJoin(e->y[i], e->fy[i]);
+    if (e->vx) term += hashKey(kind, slot, HASH_VX) * (uint64_t)e->vx[i];
+    return term;
+}
+
+// One term per shield row; erosion swaps the terms of the rows it touched.
+static inline uint64_t shieldRowTerm(int s, int r, uint64_t bits)
+{
+    return hashKey(HASH_SHIELD, s * SHIELD_HEIGHT + r, HASH_K) * bits;
+}
+
+static inline uint64_t globalsTerm(const GameState* game)
+{
+    return hashKey(HASH_GLOBALS, 0, HASH_SCORE) * (uint64_t)game->score
+         + hashKey(HASH_GLOBALS, 0, HASH_LIVES) * (uint64_t)game->lives
+         + hashKey(HASH_GLOBALS, 0, HASH_DIR)   * (uint64_t)game->alienMoveDir
+         + hashKey(HASH_GLOBALS, 0, HASH_OVER)  * (uint64_t)game->gameOver
+         + hashKey(HASH_GLOBALS, 0, HASH_WAVE)  * (uint64_t)game->waveIndex
+         + hashKey(HASH_GLOBALS, 0, HASH_RNG)   * (uint64_t)game->rng;
+}
+
+// Full recompute; used after resets and to verify the incremental value.
+StateHash stateHashCompute(const GameState* game)
+{
+    StateHash h = { 0, 0, 0 };
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(EC_ACTIVE));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns e    = entityColumns(c, q.base);
+        uint32_t      kind = kSimHashKind[q.archetype];
+        for (int i = 0; i < e.count; i++) {
+            h.sum += entityTerm(kind, &e, i);
+            if (kind == HASH_ALIEN && e.active[i]) {
+                h.alienSumX += hashKey(HASH_ALIEN, e.base + i, HASH_X);
+                h.alienSumY += hashKey(HASH_ALIEN, e.base + i, HASH_Y);
+            }
+        }
+    }
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        for (int r = 0; r < SHIELD_HEIGHT; r++) {
+            h.sum += shieldRowTerm(s, r, game->shields[s].rows[r]);
+        }
+    }
+    h.sum += globalsTerm(game);
+    return h;
+}
+
+uint64_t stateHashDigest(const StateHash* h)
+{
+    return mix64(h->sum ^ HASH_SEED);
+}
+
+static inline void hashAlienKill(StateHash* h, const EntityColumns* a, int i)
+{
+    h->sum       -= entityTerm(HASH_ALIEN, a, i);
+    h->alienSumX -= hashKey(HASH_ALIEN, a->base + i, HASH_X);
+    h->alienSumY -= hashKey(HASH_ALIEN, a->base + i, HASH_Y);
+}
+
+static inline void hashAlienAdd(StateHash* h, const EntityColumns* a, int i)
+{
+    h->sum       += entityTerm(HASH_ALIEN, a, i);
+    h->alienSumX += hashKey(HASH_ALIEN, a->base + i, HASH_X);
+    h->alienSumY += hashKey(HASH_ALIEN, a->base + i, HASH_Y);
+}
+
+static inline void hashAlienShift(StateHash* h, fixed dx, fixed dy)
+{
+    h->sum += h->alienSumX * (uint64_t)dx + h->alienSumY * (uint64_t)dy;
+}
+
+// ------------------ Shooter Column Index --------------
+// Only the bottom-most live alien of a column may fire. colBottom holds
+// that alien per column and shooterCols is a dense list of the columns
+// that still have one, so picking a shooter is O(1). A kill only walks
+// up its own column, and only if the dead alien was the shooter.
+static void shooterIndexBuild(GameState* game)
+{
+    int rows = game->wave.rows, cols = game->wave.cols;
+    game->shooterCount = 0;
+    for (int c = 0; c < cols; c++) {
+        int i = (rows - 1) * cols + c;
+        while (i >= 0 && !alienAlive(game, i)) i -= cols;
+        game->colBottom[c] = (int16_t)i;
+        if (i >= 0) {
+            game->shooterSlot[c] = (int16_t)game->shooterCount;
+            game->shooterCols[game->shooterCount++] = (int16_t)c;
+        }
+    }
+}
+
+static void shooterIndexKill(GameState* game, int i)
+{
+    int cols = game->wave.cols;
+    int c    = i % cols;
+    if (game->colBottom[c] != i) return;   // someone below still covers it
+
+    int j = i - cols;
+    while (j >= 0 && !alienAlive(game, j)) j -= cols;
+    game->colBottom[c] = (int16_t)j;
+    if (j < 0) {
+        // Column is empty: swap the last listed column into its slot
+        int slot = game->shooterSlot[c];
+        int last = game->shooterCols[--game->shooterCount];
+        game->shooterCols[slot] = (int16_t)last;
+        game->shooterSlot[last] = (int16_t)slot;
+    }
+}
+
+static inline uint32_t gameRandom(GameState* game)
+{
+    uint32_t x = game->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return game->rng = x;
+}
+
+// ------------------ Shields ---------------------------
+// Hit tests and erosion work on whole rows: a bullet becomes a bit mask
+// of the columns it covers, a row is hit if (row & mask) != 0, and a
+// crater is cut with row &= ~stamp.
+#define SHIELD_ROW_MASK  (SHIELD_WIDTH == 64 ? ~0ull : (1ull << SHIELD_WIDTH) - 1)
+
+static const uint8_t kShieldCrater[] = {   // 8x8, centered on the impact
+    0x18, 0x5A, 0x7E, 0xFF, 0xFF, 0x7E, 0x5A, 0x18
+};
+
+static void shieldBuild(Shield* sh, int x, int y)
+{
+    sh->x = x;
+    sh->y = y;
+    for (int r = 0; r < SHIELD_HEIGHT; r++) {
+        uint64_t bits = SHIELD_ROW_MASK;
+        int cut = 8 - r;                      // bevelled top corners
+        if (cut > 0) {
+            bits &= ~((1ull << cut) - 1);
+            bits &= ~(((1ull << cut) - 1) << (SHIELD_WIDTH - cut));
+        }
+        if (r >= SHIELD_HEIGHT * 2 / 3) {     // arch at the bottom
+            int w = SHIELD_WIDTH / 3;
+            bits &= ~(((1ull << w) - 1) << ((SHIELD_WIDTH - w) / 2));
+        }
+        sh->rows[r] = bits;
+    }
+}
+
+static void shieldsBuild(GameState* game)
+{
+    int gap = (WINDOW_WIDTH - SHIELD_COUNT * SHIELD_WIDTH) / (SHIELD_COUNT + 1);
+    int y   = playerColumns(game).y[0] - SHIELD_GAP_ABOVE - SHIELD_HEIGHT;
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        shieldBuild(&game->shields[s], gap + s * (gap + SHIELD_WIDTH), y);
+    }
+}
+
+// Bits of the shield's columns [x0, x1) clipped to the shield.
+static inline uint64_t shieldSpan(const Shield* sh, int x0, int x1)
+{
+    x0 -= sh->x;
+    x1 -= sh->x;
+    if (x0 < 0) x0 = 0;
+    if (x1 > SHIELD_WIDTH) x1 = SHIELD_WIDTH;
+    if (x0 >= x1) return 0;
+    uint64_t bits = (x1 - x0 == 64) ? ~0ull : (1ull << (x1 - x0)) - 1;
+    return bits << x0;
+}
+
+static void shieldErode(GameState* game, int s, int row, int cx)
+{
+    Shield* sh = &game->shields[s];
+    int     dx = cx - sh->x - 4;              // crater's left column
+    for (int k = 0; k < 8; k++) {
+        int r = row - 4 + k;
+        if (r < 0 || r >= SHIELD_HEIGHT) continue;
+        uint64_t stamp = dx >= 0 ? (uint64_t)kShieldCrater[k] << dx
+                                 : (uint64_t)kShieldCrater[k] >> -dx;
+        uint64_t old   = sh->rows[r];
+        sh->rows[r]    = old & ~stamp;
+        game->hash.sum += shieldRowTerm(s, r, sh->rows[r]) - shieldRowTerm(s, r, old);
+    }
+}
+
+// Stops the bullet at the first solid row it overlaps, scanning in its
+// direction of travel (dir -1: up, +1: down), and blasts a crater there.
+// x, y, w, h is the path the bullet swept this tick.
+static bool shieldsHit(GameState* game, int x, int y, int w, int h, int dir)
+{
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        const Shield* sh = &game->shields[s];
+        if (!rect_collide(x, y, w, h, sh->x, sh->y, SHIELD_WIDTH, SHIELD_HEIGHT)) {
+            continue;
+        }
+        uint64_t mask = shieldSpan(sh, x, x + w);
+        int r0 = y - sh->y;
+        int r1 = y + h - sh->y;
+        if (r0 < 0) r0 = 0;
+        if (r1 > SHIELD_HEIGHT) r1 = SHIELD_HEIGHT;
+        for (int k = 0; k < r1 - r0; k++) {
+            int r = dir < 0 ? r1 - 1 - k : r0 + k;
+            if (sh->rows[r] & mask) {
+                shieldErode(game, s, r, x + w / 2);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// ------------------ Alien Scripts ---------------------
+// Per-wave alien movement written in a tiny expression language inside
+// the wave file, compiled to register bytecode and carried in the
+// WaveDef, so every copy of the state (templates, replays, snapshots)
+// has it. Example:
+//
+//   script zigzag
+//     dx = march * (1 + sin(tick / 120 + col / 8))
+//     dy = drop + sin(tick / 60 + row / 4) / 2
+//   end
+//
+// Each line is `name = expression` with + - * /, parentheses, numbers
+// and the functions sin (of turns: sin(0.25) = 1), abs, min, max and
+// lt (1 if a < b, else 0). Everything is 16.16 fixed point, so a script
+// runs identically everywhere. These registers are loaded per alien:
+//   dx, dy      the alien's move this update, read back at the end;
+//               they start as march and drop
+//   march       the formation's horizontal step (0 on a descent)
+//   drop        descent in px on the update the formation turns, else 0
+//   speed, dir  the wave's speed and the march direction (+1 / -1)
+//   tick, step  game tick (wraps every 32768) and ticks per update
+//   index, col, row, x, y   the alien's slot and position
+// Any other name is a new variable. The formation still turns at the
+// edges as before; scripted aliens are then kept inside the window.
+//
+// The interpreter runs one instruction across a batch of up to
+// SCRIPT_BATCH aliens before the next, so decoding is paid once per
+// batch and each instruction is a plain lane loop the compiler can
+// vectorize. The compiler flags instructions whose operands are the same
+// for every alien (constants, tick, march, ...); those are computed once
+// and broadcast. Division rounds down like multiplication, so dividing
+// by a power of two compiles to an exact multiply.
+enum { SOP_LOADK, SOP_MOV, SOP_ADD, SOP_SUB, SOP_MUL, SOP_DIV, SOP_MIN,
+       SOP_MAX, SOP_LT, SOP_NEG, SOP_ABS, SOP_SIN };
+#define SOP_UNIFORM 0x80    // opcode flag: same result for every alien
+#define SCRIPT_UNIFORM_INPUTS (1u << SR_DX | 1u << SR_DY | 1u << SR_MARCH | \
+                               1u << SR_DROP | 1u << SR_SPEED | 1u << SR_DIR | \
+                               1u << SR_TICK | 1u << SR_STEP)
+enum { SR_DX, SR_DY, SR_MARCH, SR_DROP, SR_SPEED, SR_DIR, SR_TICK, SR_STEP,
+       SR_INDEX, SR_COL, SR_ROW, SR_X, SR_Y, SR_INPUTS };
+
+static const char* const kScriptInputs[SR_INPUTS] = {
+    "dx", "dy", "march", "drop", "speed", "dir", "tick", "step",
+    "index", "col", "row", "x", "y",
+};
+
+// -------- Compiler --------
+typedef struct {
+    AlienScript* out;
+    const char*  p;         // cursor in the current line
+    char         names[SCRIPT_MAX_REGS][SCRIPT_NAME_LEN];
+    int          varCount;  // named registers; temporaries sit above them
+    int          top;       // next free temporary
+    uint32_t     uniform;   // registers holding the same value in every lane
+    const char*  error;     // first error, NULL while all is well
+} ScriptCompiler;
+
+void scriptCompileBegin(ScriptCompiler* c, AlienScript* out)
+{
+    memset(c, 0, sizeof(*c));
+    memset(out, 0, sizeof(*out));
+    c->out      = out;
+    c->varCount = SR_INPUTS;
+    c->uniform  = SCRIPT_UNIFORM_INPUTS;
+    for (int r = 0; r < SR_INPUTS; r++) {
+        snprintf(c->names[r], SCRIPT_NAME_LEN, "%s", kScriptInputs[r]);
+    }
+}
+
+static void scriptFail(ScriptCompiler* c, const char* error)
+{
+    if (!c->error) c->error = error;
+}
+
+static void scriptSkipSpace(ScriptCompiler* c)
+{
+    while (*c->p == ' ' || *c->p == '\t' || *c->p == '\r' || *c->p == '\n') c->p++;
+}
+
+// Consumes `ch` if it is the next character.
+static bool scriptAccept(ScriptCompiler* c, char ch)
+{
+    scriptSkipSpace(c);
+    if (*c->p != ch) return false;
+    c->p++;
+    return true;
+}
+
+static bool scriptIdent(ScriptCompiler* c, char* name)
+{
+    scriptSkipSpace(c);
+    int n = 0;
+    while ((*c->p >= 'a' && *c->p <= 'z') || *c->p == '_' ||
+           (n > 0 && *c->p >= '0' && *c->p <= '9')) {
+        if (n < SCRIPT_NAME_LEN - 1) name[n++] = *c->p;
+        c->p++;
+    }
+    name[n] = '\0';
+    return n > 0;
+}
+
+static int scriptLookup(const ScriptCompiler* c, const char* name)
+{
+    for (int r = 0; r < c->varCount; r++) {
+        if (strcmp(c->names[r], name) == 0) return r;
+    }
+    return -1;
+}
+
+static void scriptEmit(ScriptCompiler* c, int op, int dst, int a, int b)
+{
+    AlienScript* s = c->out;
+    if (s->opCount == SCRIPT_MAX_OPS) {
+        scriptFail(c, "script too long");
+        return;
+    }
+    bool uniform = op == SOP_LOADK ||
+                   (c->uniform >> a & 1 && c->uniform >> b & 1);
+    c->uniform = (c->uniform & ~(1u << dst)) | (uint32_t)uniform << dst;
+    uint8_t* ins = s->ops[s->opCount++];
+    ins[0] = (uint8_t)(op | (uniform ? SOP_UNIFORM : 0));
+    ins[1] = (uint8_t)dst;
+    ins[2] = (uint8_t)a;
+    ins[3] = (uint8_t)b;
+}
+
+// Result register for an op reading a and b: the lower of their
+// temporaries if either is one (temporaries form a stack), else a new one.
+static int scriptResult(ScriptCompiler* c, int a, int b)
+{
+    int dst = a >= c->varCount ? a : b >= c->varCount ? b : c->top;
+    if (dst == SCRIPT_MAX_REGS) {
+        scriptFail(c, "expression too complex");
+        return -1;
+    }
+    c->top = dst + 1;
+    return dst;
+}
+
+static int scriptOp(ScriptCompiler* c, int op, int a, int b)
+{
+    if (a < 0 || b < 0) return -1;
+    int dst = scriptResult(c, a, b);
+    if (dst >= 0) scriptEmit(c, op, dst, a, b);
+    return dst;
+}
+
+// Index of v in the constant pool, added if new; -1 when the pool is full.
+static int scriptConstIndex(ScriptCompiler* c, fixed v)
+{
+    AlienScript* s = c->out;
+    int k = 0;
+    while (k < s->constCount && s->consts[k] != v) k++;
+    if (k == SCRIPT_MAX_CONSTS) {
+        scriptFail(c, "too many constants");
+        return -1;
+    }
+    if (k == s->constCount) s->consts[s->constCount++] = v;
+    return k;
+}
+
+static int scriptConstant(ScriptCompiler* c, fixed v)
+{
+    int k = scriptConstIndex(c, v);
+    if (k < 0) return -1;
+    int dst = scriptResult(c, 0, 0);
+    if (dst >= 0) scriptEmit(c, SOP_LOADK, dst, k, 0);
+    return dst;
+}
+
+static int scriptExpr(ScriptCompiler* c);
+
+static int scriptPrimary(ScriptCompiler* c)
+{
+    scriptSkipSpace(c);
+    if ((*c->p >= '0' && *c->p <= '9') || *c->p == '.') {
+        char  text[32];
+        int   n = 0;
+        fixed v;
+        while (((*c->p >= '0' && *c->p <= '9') || *c->p == '.') && n < 31) {
+            text[n++] = *c->p++;
+        }
+        text[n] = '\0';
+        if (!parseFixed(text, &v)) {
+            scriptFail(c, "bad number");
+            return -1;
+        }
+        return scriptConstant(c, v);
+    }
+    if (scriptAccept(c, '(')) {
+        int r = scriptExpr(c);
+        if (!scriptAccept(c, ')')) scriptFail(c, "missing )");
+        return r;
+    }
+
+    char name[SCRIPT_NAME_LEN];
+    if (!scriptIdent(c, name)) {
+        scriptFail(c, "expected a value");
+        return -1;
+    }
+    if (!scriptAccept(c, '(')) {
+        int r = scriptLookup(c, name);
+        if (r < 0) scriptFail(c, "unknown name");
+        return r;
+    }
+
+    static const struct { const char* name; int op, args; } kFunctions[] = {
+        { "sin", SOP_SIN, 1 }, { "abs", SOP_ABS, 1 }, { "min", SOP_MIN, 2 },
+        { "max", SOP_MAX, 2 }, { "lt", SOP_LT, 2 },
+    };
+    for (size_t f = 0; f < sizeof(kFunctions) / sizeof(kFunctions[0]); f++) {
+        if (strcmp(name, kFunctions[f].name) != 0) continue;
+        int a = scriptExpr(c), b = a;
+        if (kFunctions[f].args == 2 && !scriptAccept(c, ',')) scriptFail(c, "missing ,");
+        if (kFunctions[f].args == 2) b = scriptExpr(c);
+        if (!scriptAccept(c, ')')) scriptFail(c, "missing )");
+        return scriptOp(c, kFunctions[f].op, a, b);
+    }
+    scriptFail(c, "unknown function");
+    return -1;
+}
+
+static int scriptUnary(ScriptCompiler* c)
+{
+    if (scriptAccept(c, '-')) {
+        int a = scriptUnary(c);
+        return scriptOp(c, SOP_NEG, a, a);
+    }
+    return scriptPrimary(c);
+}
+
+// x / 2^k: if the divisor is a temporary that was just loaded as a
+// constant, load its exact reciprocal instead and multiply. A named
+// variable keeps its value for later lines, so it is never rewritten.
+// Returns the op to emit.
+static int scriptDivide(ScriptCompiler* c, int divisor)
+{
+    AlienScript* s   = c->out;
+    uint8_t*     ins = s->opCount > 0 ? s->ops[s->opCount - 1] : NULL;
+    if (divisor < c->varCount || !ins || (ins[0] & ~SOP_UNIFORM) != SOP_LOADK || ins[1] != divisor) {
+        return SOP_DIV;
+    }
+    fixed v = s->consts[ins[2]];
+    if (v < 4 || (v & (v - 1)) != 0) return SOP_DIV;   // reciprocal must fit
+    // The rewrite is optional, so a full pool keeps the divide rather
+    // than failing the script the way scriptConstIndex would.
+    fixed inv = (fixed)(((int64_t)FIX_ONE * FIX_ONE) / v);
+    int   k   = 0;
+    while (k < s->constCount && s->consts[k] != inv) k++;
+    if (k == SCRIPT_MAX_CONSTS) return SOP_DIV;
+    if (k == s->constCount) s->consts[s->constCount++] = inv;
+    ins[2] = (uint8_t)k;
+    return SOP_MUL;
+}
+
+static int scriptTerm(ScriptCompiler* c)
+{
+    int r = scriptUnary(c);
+    for (;;) {
+        if (scriptAccept(c, '*')) {
+            r = scriptOp(c, SOP_MUL, r, scriptUnary(c));
+        } else if (scriptAccept(c, '/')) {
+            int divisor = scriptUnary(c);
+            r = scriptOp(c, scriptDivide(c, divisor), r, divisor);
+        } else {
+            return r;
+        }
+    }
+}
+
+static int scriptExpr(ScriptCompiler* c)
+{
+    int r = scriptTerm(c);
+    for (;;) {
+        if (scriptAccept(c, '+'))      r = scriptOp(c, SOP_ADD, r, scriptTerm(c));
+        else if (scriptAccept(c, '-')) r = scriptOp(c, SOP_SUB, r, scriptTerm(c));
+        else return r;
+    }
+}
+
+// Compiles one `name = expression` line; blank and '#' lines are fine.
+// False (and c->error set) on the first error, after which further
+// lines are ignored.
+bool scriptCompileLine(ScriptCompiler* c, const char* line)
+{
+    if (c->error) return false;
+    c->p = line;
+    scriptSkipSpace(c);
+    if (*c->p == '\0' || *c->p == '#') return true;
+
+    char name[SCRIPT_NAME_LEN];
+    if (!scriptIdent(c, name) || !scriptAccept(c, '=')) {
+        scriptFail(c, "expected name = expression");
+        return false;
+    }
+    c->top = c->varCount;
+    int r = scriptExpr(c);
+    scriptSkipSpace(c);
+    if (*c->p != '\0' && *c->p != '#') scriptFail(c, "unexpected text");
+    if (c->error) return false;
+
+    bool temp    = r >= c->varCount;   // then it is the last op's result
+    bool uniform = c->uniform >> r & 1;
+    int  dst     = scriptLookup(c, name);
+    if (dst < 0) {
+        if (c->varCount == SCRIPT_MAX_REGS) {
+            scriptFail(c, "too many variables");
+            return false;
+        }
+        dst = c->varCount;
+        snprintf(c->names[c->varCount++], SCRIPT_NAME_LEN, "%s", name);
+    }
+    if (temp) {
+        c->out->ops[c->out->opCount - 1][1] = (uint8_t)dst;
+        c->uniform = (c->uniform & ~(1u << dst)) | (uint32_t)uniform << dst;
+    } else if (r != dst) {
+        scriptEmit(c, SOP_MOV, dst, r, r);
+    }
+    return !c->error;
+}
+
+bool scriptCompileEnd(ScriptCompiler* c)
+{
+    if (!c->error && c->out->opCount == 0) scriptFail(c, "empty script");
+    return !c->error;
+}
+
+// Checks bytecode that didn't come from the compiler (snapshots) before
+// it is run: every register and constant index in range.
+bool scriptValid(const AlienScript* s)
+{
+    if (s->opCount > SCRIPT_MAX_OPS || s->constCount > SCRIPT_MAX_CONSTS) return false;
+    for (int pc = 0; pc < s->opCount; pc++) {
+        const uint8_t* ins = s->ops[pc];
+        int op = ins[0] & ~SOP_UNIFORM;
+        if (op > SOP_SIN || ins[1] >= SCRIPT_MAX_REGS || ins[3] >= SCRIPT_MAX_REGS ||
+            (op == SOP_LOADK ? ins[2] >= s->constCount : ins[2] >= SCRIPT_MAX_REGS)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// -------- Interpreter --------
+// Floor of a*b, like fixFloor: no shift of a negative value.
+static inline fixed scriptMul(fixed a, fixed b)
+{
+    int64_t p = (int64_t)a * b;
+    return (fixed)((p - (p & (FIX_ONE - 1))) / FIX_ONE);
+}
+
+// a / b rounded down like scriptMul, so a / 2^k == a * 2^-k exactly.
+// Division by zero gives 0.
+static inline fixed scriptDiv(fixed a, fixed b)
+{
+    if (!b) return 0;
+    int64_t num = (int64_t)a * FIX_ONE, q = num / b;
+    return (fixed)(q - ((num % b != 0) & ((num < 0) != (b < 0))));
+}
+
+// sin of v turns: a parabola per half turn with one correction step,
+// within 0.1% of the real thing and integer-only.
+static inline fixed scriptSin(fixed v)
+{
+    int32_t u = v & (FIX_ONE - 1);
+    int32_t h = u & (FIX_ONE / 2 - 1);
+    fixed   p = (fixed)((int64_t)16 * h * (FIX_ONE / 2 - h) / FIX_ONE);
+    fixed   y = p + scriptMul(14746, scriptMul(p, p) - p);   // 0.225
+    return u < FIX_ONE / 2 ? y : -y;
+}
+
+static void scriptRun(const AlienScript* s, fixed (*r)[SCRIPT_BATCH], int n)
+{
+    for (int pc = 0; pc < s->opCount; pc++) {
+        const uint8_t* ins = s->ops[pc];
+        fixed*         d   = r[ins[1]];
+        const fixed*   a   = r[ins[2]];
+        const fixed*   b   = r[ins[3]];
+        int            m   = ins[0] & SOP_UNIFORM ? 1 : n;   // lanes to compute
+        switch (ins[0] & ~SOP_UNIFORM) {
+        case SOP_LOADK: d[0] = s->consts[ins[2]]; m = 1; break;
+        case SOP_MOV: for (int i = 0; i < m; i++) d[i] = a[i]; break;
+        case SOP_ADD:
+            for (int i = 0; i < m; i++) d[i] = (fixed)((uint32_t)a[i] + (uint32_t)b[i]);
+            break;
+        case SOP_SUB:
+            for (int i = 0; i < m; i++) d[i] = (fixed)((uint32_t)a[i] - (uint32_t)b[i]);
+            break;
+        case SOP_MUL: for (int i = 0; i < m; i++) d[i] = scriptMul(a[i], b[i]); break;
+        case SOP_DIV: for (int i = 0; i < m; i++) d[i] = scriptDiv(a[i], b[i]); break;
+        case SOP_MIN: for (int i = 0; i < m; i++) d[i] = a[i] < b[i] ? a[i] : b[i]; break;
+        case SOP_MAX: for (int i = 0; i < m; i++) d[i] = a[i] > b[i] ? a[i] : b[i]; break;
+        case SOP_LT:  for (int i = 0; i < m; i++) d[i] = a[i] < b[i] ? FIX_ONE : 0; break;
+        case SOP_NEG: for (int i = 0; i < m; i++) d[i] = (fixed)(0u - (uint32_t)a[i]); break;
+        case SOP_ABS:
+            for (int i = 0; i < m; i++) d[i] = a[i] < 0 ? (fixed)(0u - (uint32_t)a[i]) : a[i];
+            break;
+        case SOP_SIN: for (int i = 0; i < m; i++) d[i] = scriptSin(a[i]); break;
+        }
+        for (int i = m; i < n; i++) d[i] = d[0];   // broadcast a uniform result
+    }
+}
+
+// Moves every live alien by the wave script's dx/dy and records each
+// one's whole-pixel step in stepX/stepY (for the swept collision).
+void alienScriptMove(GameState* game, fixed march, fixed drop, int scale,
+                     int* stepX, int* stepY)
+{
+    const AlienScript* s = &game->wave.script;
+    fixed r[SCRIPT_MAX_REGS][SCRIPT_BATCH];
+    int   lanes[SCRIPT_BATCH];
+    int   cols = game->wave.cols > 0 ? game->wave.cols : 1;
+
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(EC_ALIEN));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns a   = entityColumns(c, q.base);
+        int           col = a.base % cols, row = a.base / cols;   // of `next`
+        for (int next = 0; next < a.count; ) {
+            int n = 0;
+            for (; next < a.count && n < SCRIPT_BATCH; next++) {
+                if (a.active[next]) {
+                    r[SR_COL][n] = FIX(col);
+                    r[SR_ROW][n] = FIX(row);
+                    lanes[n++]   = next;
+                }
+                if (++col == cols) {
+                    col = 0;
+                    row++;
+                }
+            }
+            for (int k = 0; k < n; k++) {
+                int i = lanes[k];
+                r[SR_DX][k]    = march;
+                r[SR_DY][k]    = drop;
+                r[SR_MARCH][k] = march;
+                r[SR_DROP][k]  = drop;
+                r[SR_SPEED][k] = game->wave.speed;
+                r[SR_DIR][k]   = FIX(game->alienMoveDir);
+                r[SR_TICK][k]  = FIX((int)(game->tick & 0x7FFF));
+                r[SR_STEP][k]  = FIX(scale);
+                r[SR_INDEX][k] = FIX(a.base + i);
+                r[SR_X][k]     = fixJoin(a.x[i], a.fx[i]);
+                r[SR_Y][k]     = fixJoin(a.y[i], a.fy[i]);
+            }
+            if (n == 0) break;
+            scriptRun(s, r, n);
+
+            for (int k = 0; k < n; k++) {
+                int   i = lanes[k], slot = a.base + i;
+                int   x0 = a.x[i], y0 = a.y[i];
+                fixed fx0 = fixJoin(a.x[i], a.fx[i]), fy0 = fixJoin(a.y[i], a.fy[i]);
+                fixMove(&a.x[i], &a.fx[i], r[SR_DX][k]);
+                fixMove(&a.y[i], &a.fy[i], r[SR_DY][k]);
+                if (a.x[i] < 0) {
+                    a.x[i]  = 0;
+                    a.fx[i] = 0;
+                }
+                if (a.x[i] + a.w[i] > WINDOW_WIDTH) {
+                    a.x[i]  = WINDOW_WIDTH - a.w[i];
+                    a.fx[i] = 0;
+                }
+                // The hash is linear in position: add just this alien's move.
+                game->hash.sum +=
+                    hashKey(HASH_ALIEN, slot, HASH_X) * (uint64_t)(fixJoin(a.x[i], a.fx[i]) - fx0) +
+                    hashKey(HASH_ALIEN, slot, HASH_Y) * (uint64_t)(fixJoin(a.y[i], a.fy[i]) - fy0);
+                stepX[slot] = a.x[i] - x0;
+                stepY[slot] = a.y[i] - y0;
+            }
+        }
+    }
+}
+
+// ------------------ Wave Templates --------------------
+// Builds the opening state of a wave, field by field. This runs once per
+// wave (or once per process for the classic wave); resets then copy the
+// result.
+void buildWaveTemplate(GameState* tmpl, const WaveDef* wave, int waveIndex)
+{
+    memset(tmpl, 0, sizeof(*tmpl));
+    tmpl->config       = kSimConfigDefaults;   // resets keep the game's own
+    tmpl->lives        = PLAYER_LIVES;
+    tmpl->alienMoveDir = 1;
+    tmpl->wave         = *wave;
+    tmpl->waveIndex    = waveIndex;
+
+    EcsWorld* world = &tmpl->entities.world;
+    tmpl->entities  = *simEntitiesEmpty();
+    ecsResize(world, SIM_PLAYER, 1);
+    EntityColumns player = playerColumns(tmpl);
+    player.active[0] = true;
+    player.w[0]      = PLAYER_WIDTH;
+    player.h[0]      = PLAYER_HEIGHT;
+    player.x[0]      = (WINDOW_WIDTH - player.w[0]) / 2;
+    player.y[0]      = WINDOW_HEIGHT - (player.h[0] + 40);
+
+    ecsResize(world, SIM_ALIENS, wave->rows * wave->cols);
+    tmpl->aliveCount = alienCount(tmpl);
+    EcsQuery  q = ecsQuery(world, ECS_BIT(EC_ALIEN));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns a = entityColumns(c, q.base);
+        for (int i = 0; i < a.count; i++) {
+            int slot    = a.base + i;
+            a.active[i] = true;
+            a.w[i]      = ALIEN_WIDTH;
+            a.h[i]      = ALIEN_HEIGHT;
+            a.x[i]      = wave->startX + (slot % wave->cols) * wave->spacingX;
+            a.y[i]      = wave->startY + (slot / wave->cols) * wave->spacingY;
+        }
+    }
+    shooterIndexBuild(tmpl);
+    shieldsBuild(tmpl);
+    tmpl->rng            = (uint32_t)mix64(HASH_SEED + (uint64_t)waveIndex) | 1;
+    tmpl->enemyFireTimer = ENEMY_FIRE_TICKS;
+
+    tmpl->hash = stateHashCompute(tmpl);
+}
+
+// ------------------ Wave Streaming --------------------
+// Waves come from a text file (one "wave" line each), from a seeded
+// generator (endless mode), or both: the generator takes over when the
+// file runs out. A loader thread keeps the next WAVE_PREFETCH waves
+// parsed in a ring, so starting a wave only pops an entry. Wave 0 is
+// cached for restarts, and seeking elsewhere (restart, replay) is handed
+// to the loader; the game only waits if it asks for a wave the loader
+// hasn't reached yet, which is counted as a stall.
+//
+// File format, '#' starts a comment:
+//   wave <rows> <cols> <speed> <descent> [startX startY spacingX spacingY]
+//        [script <name>]
+//   script <name>
+//     <statements, see "Alien Scripts">
+//   end
+// speed is px per tick and may be fractional ("0.5"). A script must be
+// defined above the first wave that names it.
+typedef struct {
+    char        name[SCRIPT_NAME_LEN];
+    long        offset;        // where its "script" line is in the file
+    AlienScript script;
+} WaveScript;
+
+struct WaveSource {
+    FILE*       file;          // NULL: generator only
+    bool        endless;
+    uint32_t    seed;
+    long*       offsets;       // file offset of each wave line seen so far
+    int         offsetCount;
+    int         offsetCap;
+    int         fileIndex;     // wave index the file position is at
+    bool        fileDone;
+    WaveScript  scripts[SCRIPT_MAX_DEFS];   // loader thread only
+    int         scriptCount;
+
+    WaveDef     first;
+    ResetTemplates templates;
+    WaveDef     ring[WAVE_PREFETCH];
+    int         ringStart;
+    int         ringCount;
+    int         nextIndex;     // index the loader produces next
+    bool        ended;         // no waves at or after nextIndex
+    int         seekTo;        // -1: none pending
+    bool        quit;
+
+    uint64_t    loaded;
+    uint64_t    stalls;
+    SDL_mutex*  lock;
+    SDL_cond*   changed;
+    SDL_Thread* worker;
+};
+
+// Every field in range: a formation of at most MAX_ALIENS that starts
+// inside the window. Rows and cols are checked on their own first so
+// their product can't overflow. `why` (NULL with len 0 is fine) gets
+// the first field out of range and its limits.
+static bool waveDefCheck(const WaveDef* w, char* why, size_t len)
+{
+    if (w->rows < 1 || w->rows > MAX_ALIENS) {
+        snprintf(why, len, "rows %d not in 1..%d", w->rows, MAX_ALIENS);
+    } else if (w->cols < 1 || w->cols > MAX_ALIENS) {
+        snprintf(why, len, "cols %d not in 1..%d", w->cols, MAX_ALIENS);
+    } else if (w->rows * w->cols > MAX_ALIENS) {
+        snprintf(why, len, "%d aliens, at most %d", w->rows * w->cols, MAX_ALIENS);
+    } else if (w->speed <= 0 || w->speed > FIX(64)) {
+        snprintf(why, len, "speed not above 0 and at most 64");
+    } else if (w->descent < 0 || w->descent > WINDOW_HEIGHT) {
+        snprintf(why, len, "descent %d not in 0..%d", w->descent, WINDOW_HEIGHT);
+    } else if (w->startX < 0 || w->startX > WINDOW_WIDTH - ALIEN_WIDTH) {
+        snprintf(why, len, "startX %d not in 0..%d", w->startX, WINDOW_WIDTH - ALIEN_WIDTH);
+    } else if (w->startY < 0 || w->startY > WINDOW_HEIGHT - ALIEN_HEIGHT) {
+        snprintf(why, len, "startY %d not in 0..%d", w->startY, WINDOW_HEIGHT - ALIEN_HEIGHT);
+    } else if (w->spacingX < 0 || w->spacingX > WINDOW_WIDTH) {
+        snprintf(why, len, "spacingX %d not in 0..%d", w->spacingX, WINDOW_WIDTH);
+    } else if (w->spacingY < 0 || w->spacingY > WINDOW_HEIGHT) {
+        snprintf(why, len, "spacingY %d not in 0..%d", w->spacingY, WINDOW_HEIGHT);
+    } else {
+        return true;
+    }
+    return false;
+}
+
+bool waveDefValid(const WaveDef* w)
+{
+    return waveDefCheck(w, NULL, 0);
+}
+
+// The wave played without --waves/--endless, as `cfg` describes it. The
+// loader fills unspecified wave fields from the defaults.
+WaveDef classicWave(const SimConfig* cfg)
+{
+    WaveDef w = { cfg->alienRows, cfg->alienCols, cfg->alienStartX, cfg->alienStartY,
+                  cfg->alienSpacing, WAVE_ROW_SPACING, cfg->alienSpeed, cfg->alienDescent,
+                  { 0 } };   // no script: the built-in march
+    return w;
+}
+
+// Difficulty ramps with the index: more rows, faster march, bigger drops.
+static void generateWave(uint32_t seed, int index, WaveDef* w)
+{
+    uint64_t r = mix64(((uint64_t)seed << 32) ^ (uint64_t)index);
+    *w = classicWave(&kSimConfigDefaults);
+    w->rows    = 1 + (index / 3 < 4 ? index / 3 : 4);
+    w->cols    = 6 + (int)(r % 5);
+    w->speed   = FIX(1) + (index < 12 ? index : 12) * FIX(1) / 4;   // 1 .. 4 px
+    w->descent = ALIEN_DESCENT + 4 * (index / 6 < 3 ? index / 6 : 3);
+}
+
+// `report`: this line is read for the first time (the file is re-read
+// after seeks), so tell about an unknown script.
+static bool parseWaveLine(const WaveSource* src, const char* line, WaveDef* w,
+                          bool report)
+{
+    *w = classicWave(&kSimConfigDefaults);
+    char body[256], speed[32], name[SCRIPT_NAME_LEN] = "";
+    snprintf(body, sizeof(body), "%s", line);
+    char* tail = strstr(body, " script ");
+    if (tail) {
+        sscanf(tail + 8, "%31s", name);
+        *tail = '\0';
+    }
+    int n = sscanf(body, " wave %d %d %31s %d %d %d %d %d",
+                   &w->rows, &w->cols, speed, &w->descent,
+                   &w->startX, &w->startY, &w->spacingX, &w->spacingY);
+    if (n < 4) {
+        return false;   // not a wave line
+    }
+    if (!parseFixed(speed, &w->speed)) {
+        if (report) printf("Wave file: wave %d x %d speed \"%s\" is not a number, skipped\n",
+                           w->rows, w->cols, speed);
+        return false;
+    }
+    char why[64];
+    if (!waveDefCheck(w, why, sizeof(why))) {
+        if (report) printf("Wave file: wave %d x %d out of range (%s), skipped\n", w->rows, w->cols, why);
+        return false;
+    }
+    if (name[0]) {
+        int k = 0;
+        while (k < src->scriptCount && strcmp(src->scripts[k].name, name) != 0) k++;
+        if (k < src->scriptCount) {
+            w->script = src->scripts[k].script;
+        } else if (report) {
+            printf("Wave file: unknown script %s, using the plain march\n", name);
+        }
+    }
+    return true;
+}
+
+// Compiles the block after a "script <name>" line at offset `at`, up to
+// its "end" line. The file is re-read after seeks, so a block that was
+// compiled before is only skipped over.
+static void readScriptBlock(WaveSource* src, long at, const char* name)
+{
+    bool seen = false, named = false;
+    for (int k = 0; k < src->scriptCount; k++) {
+        seen  |= src->scripts[k].offset == at;
+        named |= strcmp(src->scripts[k].name, name) == 0;
+    }
+
+    ScriptCompiler c;
+    AlienScript    script;
+    char           line[256], word[8];
+    scriptCompileBegin(&c, &script);
+    while (fgets(line, sizeof(line), src->file)) {
+        if (sscanf(line, " %7s", word) == 1 && strcmp(word, "end") == 0) break;
+        if (!seen) scriptCompileLine(&c, line);
+    }
+    if (seen) return;
+
+    if (!scriptCompileEnd(&c)) {
+        printf("Wave file: script %s: %s\n", name, c.error);
+    } else if (named) {
+        printf("Wave file: script %s defined twice, keeping the first\n", name);
+    } else if (src->scriptCount == SCRIPT_MAX_DEFS) {
+        printf("Wave file: more than %d scripts, %s ignored\n", SCRIPT_MAX_DEFS, name);
+    } else {
+        WaveScript* def = &src->scripts[src->scriptCount++];
+        snprintf(def->name, sizeof(def->name), "%s", name);
+        def->offset = at;
+        def->script = script;
+    }
+}
+
+// Reads the wave at the current file position. Called on the loader
+// thread only.
+static bool readFileWave(WaveSource* src, WaveDef* w)
+{
+    char line[256];
+    for (;;) {
+        long at = ftell(src->file);
+        if (!fgets(line, sizeof(line), src->file)) {
+            src->fileDone = true;
+            return false;
+        }
+        char name[SCRIPT_NAME_LEN];
+        if (sscanf(line, " script %31s", name) == 1) {
+            readScriptBlock(src, at, name);
+            continue;
+        }
+        if (!parseWaveLine(src, line, w, src->fileIndex == src->offsetCount)) {
+            continue;   // comment, blank or junk
+        }
+
+        if (src->fileIndex == src->offsetCount) {
+            if (src->offsetCount == src->offsetCap) {
+                int   cap  = src->offsetCap ? src->offsetCap * 2 : 256;
+                long* grow = realloc(src->offsets, (size_t)cap * sizeof(long));
+                if (!grow) return false;
+                src->offsets   = grow;
+                src->offsetCap = cap;
+            }
+            src->offsets[src->offsetCount++] = at;
+        }
+        src->fileIndex++;
+        return true;
+    }
+}
+
+static void seekFile(WaveSource* src, int index)
+{
+    int known = index < src->offsetCount ? index : src->offsetCount;
+    src->fileDone = false;
+    if (known > 0) {
+        fseek(src->file, src->offsets[known - 1], SEEK_SET);
+        src->fileIndex = known - 1;
+    } else {
+        rewind(src->file);
+        src->fileIndex = 0;
+    }
+    WaveDef skip;
+    while (src->fileIndex < index && readFileWave(src, &skip)) {
+    }
+}
+
+static bool produceWave(WaveSource* src, int index, WaveDef* w)
+{
+    if (src->file && !src->fileDone) {
+        if (readFileWave(src, w)) return true;
+    }
+    if (!src->endless) return false;
+    generateWave(src->seed, index, w);
+    return true;
+}
+
+static int waveLoader(void* data)
+{
+    WaveSource* src = data;
+    TRACE_THREAD_NAME("wave loader");
+    SDL_LockMutex(src->lock);
+    while (!src->quit) {
+        if (src->seekTo >= 0) {
+            int target = src->seekTo;
+            src->seekTo = -1;
+            if (src->file) seekFile(src, target);
+            src->ringCount = 0;
+            src->nextIndex = target;
+            src->ended     = false;
+            SDL_CondBroadcast(src->changed);
+            continue;
+        }
+        if (src->ended || src->ringCount == WAVE_PREFETCH) {
+            SDL_CondWait(src->changed, src->lock);
+            continue;
+        }
+
+        int     index = src->nextIndex;
+        WaveDef w;
+        SDL_UnlockMutex(src->lock);
+        TRACE_BEGIN("load wave");
+        bool ok = produceWave(src, index, &w);
+        TRACE_END();
+        SDL_LockMutex(src->lock);
+        if (src->seekTo >= 0) continue;   // superseded while parsing
+
+        if (ok) {
+            src->ring[(src->ringStart + src->ringCount) % WAVE_PREFETCH] = w;
+            src->ringCount++;
+            src->nextIndex++;
+            src->loaded++;
+        } else {
+            src->ended = true;
+        }
+        SDL_CondBroadcast(src->changed);
+    }
+    SDL_UnlockMutex(src->lock);
+    return 0;
+}
+
+// Pops wave `index` from the ring, seeking and waiting if it isn't there.
+// Called with the lock held.
+static bool waveSourceTake(WaveSource* src, int index, WaveDef* out)
+{
+    bool waited = false;
+    for (;;) {
+        if (src->seekTo < 0) {
+            int base = src->nextIndex - src->ringCount;
+            if (index < base || index > src->nextIndex) {
+                src->seekTo = index;
+                SDL_CondBroadcast(src->changed);
+            } else {
+                while (src->ringCount > 0 && base < index) {
+                    src->ringStart = (src->ringStart + 1) % WAVE_PREFETCH;
+                    src->ringCount--;
+                    base++;
+                }
+                if (src->ringCount > 0 || src->ended) break;
+                SDL_CondBroadcast(src->changed);   // ring has room again
+            }
+        }
+        waited = true;
+        SDL_CondWait(src->changed, src->lock);
+    }
+    if (waited) src->stalls++;
+
+    bool ok = src->ringCount > 0;
+    if (ok) {
+        *out = src->ring[src->ringStart];
+        src->ringStart = (src->ringStart + 1) % WAVE_PREFETCH;
+        src->ringCount--;
+        SDL_CondBroadcast(src->changed);
+    }
+    return ok;
+}
+
+// Returns wave `index` (> 0), or false once the stream has no such wave.
+bool waveSourceGet(WaveSource* src, int index, WaveDef* out)
+{
+    SDL_LockMutex(src->lock);
+    bool ok = waveSourceTake(src, index, out);
+    SDL_UnlockMutex(src->lock);
+    return ok;
+}
+
+// Restart: wave 0 is cached in templates.gameStart, so only ask the
+// loader to refill from wave 1 without waiting for it.
+void waveSourceRewind(WaveSource* src)
+{
+    SDL_LockMutex(src->lock);
+    if (src->seekTo != 1 && src->nextIndex - src->ringCount != 1) {
+        src->seekTo = 1;
+        SDL_CondBroadcast(src->changed);
+    }
+    SDL_UnlockMutex(src->lock);
+}
+
+bool waveSourceOpen(WaveSource* src, const char* path, bool endless, uint32_t seed)
+{
+    memset(src, 0, sizeof(*src));
+    src->endless = endless;
+    src->seed    = seed;
+    src->seekTo  = -1;
+    if (path) {
+        src->file = fopen(path, "r");
+        if (!src->file) {
+            printf("Cannot open wave file %s\n", path);
+            return false;
+        }
+    }
+    src->lock    = SDL_CreateMutex();
+    src->changed = SDL_CreateCond();
+    src->worker  = SDL_CreateThread(waveLoader, "waves", src);
+    if (!src->lock || !src->changed || !src->worker) {
+        printf("Wave loader start failed: %s\n", SDL_GetError());
+        return false;
+    }
+
+    // Wave 0 is needed before the first frame; waiting here is load time.
+    SDL_LockMutex(src->lock);
+    bool ok = waveSourceTake(src, 0, &src->first);
+    src->stalls = 0;
+    SDL_UnlockMutex(src->lock);
+    if (!ok) {
+        printf("Wave source has no waves\n");
+        return false;
+    }
+    buildWaveTemplate(&src->templates.gameStart, &src->first, 0);
+    src->templates.current = &src->templates.gameStart;
+    return true;
+}
+
+void waveSourceClose(WaveSource* src)
+{
+    if (src->worker) {
+        SDL_LockMutex(src->lock);
+        src->quit = true;
+        SDL_CondBroadcast(src->changed);
+        SDL_UnlockMutex(src->lock);
+        SDL_WaitThread(src->worker, NULL);
+        printf("waves: %llu parsed ahead, %llu frame stalls\n",
+               (unsigned long long)src->loaded, (unsigned long long)src->stalls);
+    }
+    if (src->changed) SDL_DestroyCond(src->changed);
+    if (src->lock)    SDL_DestroyMutex(src->lock);
+    if (src->file)    fclose(src->file);
+    free(src->offsets);
+    memset(src, 0, sizeof(*src));
+}
+
+// ------------------ Texture Loading -------------------
+SDL_Texture* loadTexture(SDL_Renderer* renderer, const char* path)
+{
+    SDL_Surface* surface = IMG_Load(path);
+    if (!surface) {
+        printf("IMG_Load failed for %s: %s\n", path, IMG_GetError());
+        return NULL;
+    }
+    SDL_Texture* tex = SDL_CreateTextureFromSurface(renderer, surface);
+    SDL_FreeSurface(surface);
+    return tex;
+}
+
+// ------------------ Text Rendering --------------------
+SDL_Texture* renderText(SDL_Renderer* renderer, TTF_Font* font,
+                        const char* message, SDL_Color color,
+                        int* outWidth, int* outHeight)
+{
+    SDL_Surface* surf = TTF_RenderText_Solid(font, message, color);
+    if (!surf) {
+        printf("TTF_RenderText_Solid failed: %s\n", TTF_GetError());
+        return NULL;
+    }
+    SDL_Texture* textTex = SDL_CreateTextureFromSurface(renderer, surf);
+    *outWidth  = surf->w;
+    *outHeight = surf->h;
+    SDL_FreeSurface(surf);
+    return textTex;
+}
+
+// ------------------ Game Reset Function ----------------
+// The classic wave's templates are built on first use and shared by every
+// GameState without a wave source (e.g. all envs of a batch). They are
+// rebuilt when a game's config asks for a different formation.
+static ResetTemplates gClassicTemplates;
+static bool           gClassicTemplatesReady = false;
+
+static ResetTemplates* resetTemplates(GameState* game)
+{
+    if (game->waves) {
+        return &game->waves->templates;
+    }
+    WaveDef classic = classicWave(&game->config);
+    if (!gClassicTemplatesReady ||
+        memcmp(&classic, &gClassicTemplates.gameStart.wave, offsetof(WaveDef, script)) != 0) {
+        buildWaveTemplate(&gClassicTemplates.gameStart, &classic, 0);
+        gClassicTemplates.current = &gClassicTemplates.gameStart;
+        gClassicTemplatesReady = true;
+    }
+    return &gClassicTemplates;
+}
+
+// The single reset path: copy a template over the whole state, then put
+// back what carries over. With keepSession the player, score and lives
+// survive (life loss, next wave); otherwise lives come from the config.
+// The hash is patched in O(1): the template's bullets are all inactive,
+// so only the player and globals terms differ from the template's
+// precomputed hash.
+static void restoreWaveStart(GameState* game, const GameState* tmpl,
+                             bool keepSession, bool keepMoveDir)
+{
+    SimConfig   config = game->config;
+    int         lives  = game->lives;
+    int         score  = game->score;
+    int         dir    = game->alienMoveDir;
+    uint64_t    tick   = game->tick;
+    int         scale  = game->timeScale;
+    WaveSource* waves  = game->waves;
+    GameEvents* events = game->events;
+
+    // The player is kept by saving its chunk; every state shares the
+    // template's layout, so it goes back to the same place.
+    _Alignas(16) uint8_t player[SIM_PLAYER_BYTES];
+    EcsChunk* playerChunk = ecsChunkAt(&game->entities.world, SIM_PLAYER, 0);
+    size_t    playerBytes = game->entities.world.archetypes[SIM_PLAYER].chunkBytes;
+    memcpy(player, playerChunk, playerBytes);
+
+    memcpy(game, tmpl, sizeof(*game));
+    game->tick      = tick;
+    game->timeScale = scale;
+    game->config    = config;
+    game->waves     = waves;
+    game->events    = events;
+    game->enemyFireTimer = config.enemyFireTicks;
+
+    if (keepSession) {
+        memcpy(playerChunk, player, playerBytes);
+        game->lives    = lives;
+        game->score    = score;
+        if (keepMoveDir) game->alienMoveDir = dir;
+    } else {
+        game->lives    = config.lives;
+    }
+    EntityColumns now = playerColumns(game), was = playerColumns(tmpl);
+    game->hash.sum += entityTerm(HASH_PLAYER, &now, 0) - entityTerm(HASH_PLAYER, &was, 0)
+                    + globalsTerm(game) - globalsTerm(tmpl);
+}
+
+// Restart from wave 0. A state fresh from memset gets the default config.
+void resetGame(GameState* game)
+{
+    if (game->config.bullets == 0) {
+        game->config = kSimConfigDefaults;
+    }
+    ResetTemplates* templates = resetTemplates(game);
+    templates->current = &templates->gameStart;
+    if (game->waves) {
+        waveSourceRewind(game->waves);
+    }
+    restoreWaveStart(game, templates->current, false, false);
+}
+
+bool allAliensDead(const GameState* game)
+{
+    return game->aliveCount == 0;
+}
+
+static inline void emitEvent(GameState* game, int type, int x, int y, int param)
+{
+    GameEvents* events = game->events;
+    if (events && events->count < MAX_EVENTS) {
+        GameEvent* e = &events->list[events->count++];
+        e->type  = type;
+        e->x     = x;
+        e->y     = y;
+        e->param = param;
+    }
+}
+
+// ------------------ Particle System -------------------
+// Cosmetic explosion debris, one archetype in an entity world: five float
+// components, so each chunk is five SoA columns and integration runs
+// four particles per SIMD instruction down them. Dead particles are
+// squeezed out by a branchless compaction pass across the chunks after
+// each update instead of being freed one at a time. The whole pool is
+// drawn as one SDL_RenderGeometry call.
+enum { PC_X, PC_Y, PC_VX, PC_VY, PC_LIFE, PC_COUNT };   // component ids
+#define PARTICLE_MASK ((1u << PC_COUNT) - 1)
+
+typedef struct {
+    EcsWorld*   world;      // and its chunk pool, one block
+    int         archetype;  // PARTICLE_MASK; life is 1 at spawn, dead at <= 0
+    int         count;
+    int         capacity;
+    uint32_t    rng;
+    uint64_t    dropped;    // spawns refused because the pool was full
+    SDL_Vertex* vertices;   // 4 per particle, rebuilt every frame
+    int*        indices;    // 6 per particle, fixed pattern
+} ParticleSystem;
+
+bool particlesInit(ParticleSystem* ps, int capacity)
+{
+    memset(ps, 0, sizeof(*ps));
+    ps->capacity = capacity;
+    ps->rng      = 0x9E3779B9u;
+
+    // Register the components first to learn the pool size, then move
+    // the world into the block that holds the pool right behind it.
+    EcsWorld layout;
+    ecsWorldInit(&layout);
+    for (int c = 0; c < PC_COUNT; c++) {
+        ecsComponent(&layout, sizeof(float));
+    }
+    size_t worldBytes = (sizeof(EcsWorld) + 63) & ~(size_t)63;
+    size_t poolBytes  = ecsArchetypeBytes(&layout, PARTICLE_MASK, capacity);
+    ps->world = poolBytes ? SDL_SIMDAlloc(worldBytes + poolBytes) : NULL;
+    if (!ps->world) return false;
+    *ps->world = layout;
+    ecsWorldPool(ps->world, (uint8_t*)ps->world + worldBytes, poolBytes);
+    ps->archetype = ecsArchetype(ps->world, PARTICLE_MASK, capacity);
+    ps->vertices  = malloc((size_t)capacity * 4 * sizeof(SDL_Vertex));
+    ps->indices   = malloc((size_t)capacity * 6 * sizeof(int));
+    if (ps->archetype < 0 || !ps->vertices || !ps->indices) {
+        return false;
+    }
+
+    for (int p = 0; p < capacity; p++) {
+        int* idx = &ps->indices[p * 6];
+        int  v   = p * 4;
+        idx[0] = v;     idx[1] = v + 1; idx[2] = v + 2;
+        idx[3] = v + 2; idx[4] = v + 1; idx[5] = v + 3;
+    }
+    for (int v = 0; v < capacity * 4; v++) {
+        ps->vertices[v].tex_coord.x = 0.0f;
+        ps->vertices[v].tex_coord.y = 0.0f;
+    }
+    return true;
+}
+
+void particlesFree(ParticleSystem* ps)
+{
+    SDL_SIMDFree(ps->world);
+    free(ps->vertices);
+    free(ps->indices);
+    memset(ps, 0, sizeof(*ps));
+}
+
+// New capacity from a config reload. The pool is only reallocated when
+// the capacity changes, which drops the live particles; if that fails
+// the old capacity is restored.
+bool particlesResize(ParticleSystem* ps, int capacity)
+{
+    int old = ps->capacity;
+    if (capacity == old) return true;
+    particlesFree(ps);
+    if (particlesInit(ps, capacity)) return true;
+    printf("Particle pool of %d failed, keeping %d\n", capacity, old);
+    particlesFree(ps);
+    return particlesInit(ps, old);
+}
+
+static inline float particleRandom(ParticleSystem* ps)   // [-1, 1)
+{
+    ps->rng = ps->rng * 1664525u + 1013904223u;
+    return (float)(ps->rng >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+void particlesSpawnExplosion(ParticleSystem* ps, float x, float y, int n)
+{
+    for (int k = 0; k < n; k++) {
+        int       i;
+        EcsChunk* c = ps->count < ps->capacity
+                    ? ecsAppend(ps->world, ps->archetype, &i) : NULL;
+        if (!c) {
+            ps->dropped += (uint64_t)(n - k);
+            return;
+        }
+        ps->count++;
+        ECS_COLUMN(c, PC_X, float)[i]    = x;
+        ECS_COLUMN(c, PC_Y, float)[i]    = y;
+        ECS_COLUMN(c, PC_VX, float)[i]   = PARTICLE_SPEED * particleRandom(ps);
+        ECS_COLUMN(c, PC_VY, float)[i]   = PARTICLE_SPEED * particleRandom(ps);
+        ECS_COLUMN(c, PC_LIFE, float)[i] = 1.0f - 0.3f * (particleRandom(ps) + 1.0f) * 0.5f;
+    }
+}
+
+void particlesSpawnFromEvents(ParticleSystem* ps, const GameEvents* events)
+{
+    for (int i = 0; i < events->count; i++) {
+        const GameEvent* e = &events->list[i];
+        if (e->type == EVENT_ALIEN_KILLED) {
+            particlesSpawnExplosion(ps, (float)e->x, (float)e->y, EXPLOSION_PARTICLES);
+        }
+    }
+}
+
+// n is a multiple of 4; lanes past the chunk's count are integrated too.
+static void particlesIntegrate(float* x, float* y, float* vx, float* vy,
+                               float* life, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 drag  = _mm_set1_ps(PARTICLE_DRAG);
+    const __m128 grav  = _mm_set1_ps(PARTICLE_GRAVITY);
+    const __m128 decay = _mm_set1_ps(1.0f / PARTICLE_LIFE_TICKS);
+    for (; i < n; i += 4) {
+        __m128 nvx = _mm_mul_ps(_mm_load_ps(vx + i), drag);
+        __m128 nvy = _mm_add_ps(_mm_mul_ps(_mm_load_ps(vy + i), drag), grav);
+        _mm_store_ps(vx + i, nvx);
+        _mm_store_ps(vy + i, nvy);
+        _mm_store_ps(x + i, _mm_add_ps(_mm_load_ps(x + i), nvx));
+        _mm_store_ps(y + i, _mm_add_ps(_mm_load_ps(y + i), nvy));
+        _mm_store_ps(life + i, _mm_sub_ps(_mm_load_ps(life + i), decay));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t drag  = vdupq_n_f32(PARTICLE_DRAG);
+    const float32x4_t grav  = vdupq_n_f32(PARTICLE_GRAVITY);
+    const float32x4_t decay = vdupq_n_f32(1.0f / PARTICLE_LIFE_TICKS);
+    for (; i < n; i += 4) {
+        float32x4_t nvx = vmulq_f32(vld1q_f32(vx + i), drag);
+        float32x4_t nvy = vmlaq_f32(grav, vld1q_f32(vy + i), drag);
+        vst1q_f32(vx + i, nvx);
+        vst1q_f32(vy + i, nvy);
+        vst1q_f32(x + i, vaddq_f32(vld1q_f32(x + i), nvx));
+        vst1q_f32(y + i, vaddq_f32(vld1q_f32(y + i), nvy));
+        vst1q_f32(life + i, vsubq_f32(vld1q_f32(life + i), decay));
+    }
+#endif
+    for (; i < n; i++) {
+        vx[i] *= PARTICLE_DRAG;
+        vy[i]  = vy[i] * PARTICLE_DRAG + PARTICLE_GRAVITY;
+        x[i]  += vx[i];
+        y[i]  += vy[i];
+        life[i] -= 1.0f / PARTICLE_LIFE_TICKS;
+    }
+}
+
+// One tick of motion plus compaction.
+void particlesUpdate(ParticleSystem* ps)
+{
+    TRACE_SCOPE("particles update");
+    EcsQuery  q = ecsQuery(ps->world, PARTICLE_MASK);
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        particlesIntegrate(ECS_COLUMN(c, PC_X, float), ECS_COLUMN(c, PC_Y, float),
+                           ECS_COLUMN(c, PC_VX, float), ECS_COLUMN(c, PC_VY, float),
+                           ECS_COLUMN(c, PC_LIFE, float), (c->count + 3) & ~3);
+    }
+
+    // Keep live particles packed at the front, in order. The write
+    // position trails the read position, possibly chunks behind it.
+    EcsArchetype* a   = &ps->world->archetypes[ps->archetype];
+    int           outChunk = 0;
+    EcsChunk*     out = ecsChunkAt(ps->world, ps->archetype, outChunk);
+    int           at  = 0, live = 0;
+    float* wx    = ECS_COLUMN(out, PC_X, float);
+    float* wy    = ECS_COLUMN(out, PC_Y, float);
+    float* wvx   = ECS_COLUMN(out, PC_VX, float);
+    float* wvy   = ECS_COLUMN(out, PC_VY, float);
+    float* wlife = ECS_COLUMN(out, PC_LIFE, float);
+    q = ecsQuery(ps->world, PARTICLE_MASK);
+    while ((c = ecsNext(&q))) {
+        const float* x  = ECS_COLUMN(c, PC_X, float);
+        const float* y  = ECS_COLUMN(c, PC_Y, float);
+        const float* vx = ECS_COLUMN(c, PC_VX, float);
+        const float* vy = ECS_COLUMN(c, PC_VY, float);
+        const float* life = ECS_COLUMN(c, PC_LIFE, float);
+        for (int k = 0; k < c->count; k++) {
+            if (at == a->chunkCapacity) {
+                out = ecsChunkAt(ps->world, ps->archetype, ++outChunk);
+                at  = 0;
+                wx  = ECS_COLUMN(out, PC_X, float);   wy    = ECS_COLUMN(out, PC_Y, float);
+                wvx = ECS_COLUMN(out, PC_VX, float);  wvy   = ECS_COLUMN(out, PC_VY, float);
+                wlife = ECS_COLUMN(out, PC_LIFE, float);
+            }
+            wx[at]    = x[k];
+            wy[at]    = y[k];
+            wvx[at]   = vx[k];
+            wvy[at]   = vy[k];
+            wlife[at] = life[k];
+            at   += life[k] > 0.0f;
+            live += life[k] > 0.0f;
+        }
+    }
+    ecsResize(ps->world, ps->archetype, live);
+    ps->count = live;
+}
+
+// Fills the vertex batch; returns the number of particles in it.
+int particlesBuildBatch(ParticleSystem* ps)
+{
+    const float s = PARTICLE_SIZE;
+    SDL_Vertex* v = ps->vertices;
+    EcsQuery  q = ecsQuery(ps->world, PARTICLE_MASK);
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        const float* px   = ECS_COLUMN(c, PC_X, float);
+        const float* py   = ECS_COLUMN(c, PC_Y, float);
+        const float* life = ECS_COLUMN(c, PC_LIFE, float);
+        for (int i = 0; i < c->count; i++, v += 4) {
+            SDL_Color c4 = { 255, (Uint8)(80 + 175 * life[i]), 40, (Uint8)(255 * life[i]) };
+            float x = px[i], y = py[i];
+            v[0].position.x = x;     v[0].position.y = y;     v[0].color = c4;
+            v[1].position.x = x + s; v[1].position.y = y;     v[1].color = c4;
+            v[2].position.x = x;     v[2].position.y = y + s; v[2].color = c4;
+            v[3].position.x = x + s; v[3].position.y = y + s; v[3].color = c4;
+        }
+    }
+    return ps->count;
+}
+
+void renderParticles(SDL_Renderer* renderer, ParticleSystem* ps)
+{
+    int n = particlesBuildBatch(ps);
+    if (n == 0) return;
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_RenderGeometry(renderer, NULL, ps->vertices, n * 4, ps->indices, n * 6);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+
+// ------------------ Asset Loading ---------------------
+typedef struct {
+    SDL_Texture* shipTex;
+    SDL_Texture* alienTex;
+    TTF_Font*    font;     // may be NULL in headless runs (HUD is skipped)
+    SDL_Texture* shieldTex[SHIELD_COUNT];
+    uint64_t     shieldUploaded[SHIELD_COUNT][SHIELD_HEIGHT]; // texture contents
+    uint64_t     shieldRowsUploaded;
+} RenderAssets;
+
+bool loadAssets(SDL_Renderer* renderer, RenderAssets* assets, bool requireFont)
+{
+    assets->shipTex  = loadTexture(renderer, "ship.png");
+    assets->alienTex = loadTexture(renderer, "alien.jpg");
+    assets->font     = NULL;
+    if (!assets->shipTex || !assets->alienTex) {
+        SDL_DestroyTexture(assets->shipTex);
+        SDL_DestroyTexture(assets->alienTex);
+        return false;
+    }
+
+    // Shield textures start transparent; renderShields uploads rows as
+    // they differ from what the texture holds.
+    static const Uint32 clear[SHIELD_WIDTH * SHIELD_HEIGHT];
+    memset(assets->shieldUploaded, 0, sizeof(assets->shieldUploaded));
+    assets->shieldRowsUploaded = 0;
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        SDL_Texture* tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                             SDL_TEXTUREACCESS_STATIC,
+                                             SHIELD_WIDTH, SHIELD_HEIGHT);
+        if (tex) {
+            SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+            SDL_UpdateTexture(tex, NULL, clear, SHIELD_WIDTH * sizeof(Uint32));
+        } else {
+            printf("Shield texture failed: %s\n", SDL_GetError());
+        }
+        assets->shieldTex[s] = tex;
+    }
+
+    assets->font = TTF_OpenFont(FONT_PATH, FONT_SIZE);
+    if (!assets->font) {
+        printf("TTF_OpenFont failed: %s\n", TTF_GetError());
+        if (requireFont) {
+            SDL_DestroyTexture(assets->shipTex);
+            SDL_DestroyTexture(assets->alienTex);
+            return false;
+        }
+    }
+    return true;
+}
+
+void freeAssets(RenderAssets* assets)
+{
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        SDL_DestroyTexture(assets->shieldTex[s]);
+    }
+    if (assets->font) TTF_CloseFont(assets->font);
+    SDL_DestroyTexture(assets->alienTex);
+    SDL_DestroyTexture(assets->shipTex);
+}
+
+// ------------------ Game Rendering --------------------
+// Re-uploads only the rows of each shield that changed since the last
+// upload, as one partial SDL_UpdateTexture per shield.
+static void renderShields(SDL_Renderer* renderer, const GameState* game,
+                          RenderAssets* assets)
+{
+    Uint32 pixels[SHIELD_HEIGHT][SHIELD_WIDTH];
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        const Shield* sh       = &game->shields[s];
+        uint64_t*     uploaded = assets->shieldUploaded[s];
+        if (!assets->shieldTex[s]) continue;
+
+        int top = SHIELD_HEIGHT, bottom = -1;
+        for (int r = 0; r < SHIELD_HEIGHT; r++) {
+            if (sh->rows[r] != uploaded[r]) {
+                if (top > r) top = r;
+                bottom = r;
+            }
+        }
+        if (bottom >= 0) {
+            for (int r = top; r <= bottom; r++) {
+                uint64_t bits = sh->rows[r];
+                for (int x = 0; x < SHIELD_WIDTH; x++) {
+                    pixels[r][x] = (bits >> x & 1) ? 0xFF20E040u : 0;
+                }
+                uploaded[r] = bits;
+            }
+            SDL_Rect rows = { 0, top, SHIELD_WIDTH, bottom - top + 1 };
+            SDL_UpdateTexture(assets->shieldTex[s], &rows, pixels[top],
+                              SHIELD_WIDTH * sizeof(Uint32));
+            assets->shieldRowsUploaded += (uint64_t)(bottom - top + 1);
+        }
+
+        SDL_Rect dst = { sh->x, sh->y, SHIELD_WIDTH, SHIELD_HEIGHT };
+        SDL_RenderCopy(renderer, assets->shieldTex[s], NULL, &dst);
+    }
+}
+
+// Draws every live entity tagged `tag`: the texture if there is one,
+// else a rect in the current draw color.
+static void renderEntities(SDL_Renderer* renderer, const GameState* game, int tag,
+                           SDL_Texture* tex)
+{
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(tag));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns e = entityColumns(c, q.base);
+        for (int i = 0; i < e.count; i++) {
+            if (!e.active[i]) continue;
+            SDL_Rect rect = { e.x[i], e.y[i], e.w[i], e.h[i] };
+            if (tex) {
+                SDL_RenderCopy(renderer, tex, NULL, &rect);
+            } else {
+                SDL_RenderFillRect(renderer, &rect);
+            }
+        }
+    }
+}
+
+void renderGame(SDL_Renderer* renderer, const GameState* game,
+                RenderAssets* assets, ParticleSystem* particles)
+{
+    TRACE_BEGIN("render sprites");
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+
+    // Draw player
+    if (assets->shipTex) {
+        renderEntities(renderer, game, EC_PLAYER, assets->shipTex);
+    }
+
+    // Draw bullets (white rects)
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    renderEntities(renderer, game, EC_SHOT, NULL);
+
+    // Draw shields
+    TRACE_BEGIN("render shields");
+    renderShields(renderer, game, assets);
+    TRACE_END();
+
+    // Draw enemy bullets
+    SDL_SetRenderDrawColor(renderer, 255, 80, 80, 255);
+    renderEntities(renderer, game, EC_ENEMY_SHOT, NULL);
+
+    // Draw aliens
+    if (assets->alienTex) {
+        renderEntities(renderer, game, EC_ALIEN, assets->alienTex);
+    }
+
+    TRACE_END();
+
+    // Explosion debris, one batched draw
+    if (particles) {
+        TRACE_SCOPE("render particles");
+        renderParticles(renderer, particles);
+    }
+
+    if (!assets->font) return;
+    TRACE_SCOPE("render HUD");
+
+    // Draw scoreboard (top-left corner)
+    {
+        char scoreBuf[64];
+        if (game->waves) {
+            sprintf(scoreBuf, "Score: %d   Lives: %d   Wave: %d",
+                    game->score, game->lives, game->waveIndex + 1);
+        } else {
+            sprintf(scoreBuf, "Score: %d   Lives: %d", game->score, game->lives);
+        }
+        SDL_Color white = {255, 255, 255, 255};
+        int textW = 0, textH = 0;
+        SDL_Texture* scoreTex = renderText(renderer, assets->font, scoreBuf, white, &textW, &textH);
+        if (scoreTex) {
+            SDL_Rect scoreRect = { 10, 10, textW, textH };
+            SDL_RenderCopy(renderer, scoreTex, NULL, &scoreRect);
+            SDL_DestroyTexture(scoreTex);
+        }
+    }
+
+    // If game over, display "Victory!" or "Game Over!" + "Press R"
+    if (game->gameOver) {
+        SDL_Color color = {255, 0, 0, 255}; // Red text
+        const char* msg = (allAliensDead(game) && game->lives > 0) ? "Victory!" : "Game Over!";
+        int textW = 0, textH = 0;
+        SDL_Texture* textTexture = renderText(renderer, assets->font, msg, color, &textW, &textH);
+        if (textTexture) {
+            // Center the text
+            SDL_Rect dstRect = {
+                (WINDOW_WIDTH - textW)/2,
+                (WINDOW_HEIGHT - textH)/2,
+                textW,
+                textH
+            };
+            SDL_RenderCopy(renderer, textTexture, NULL, &dstRect);
+            SDL_DestroyTexture(textTexture);
+        }
+
+        // Additional prompt: Press R to restart
+        {
+            SDL_Color white = {255, 255, 255, 255};
+            int rw=0, rh=0;
+            SDL_Texture* restartTex = renderText(renderer, assets->font,
+                                                 "Press R to restart",
+                                                 white, &rw, &rh);
+            if (restartTex) {
+                SDL_Rect rdst = {
+                    (WINDOW_WIDTH - rw)/2,
+                    (WINDOW_HEIGHT - rh)/2 + 50, // some offset below
+                    rw,
+                    rh
+                };
+                SDL_RenderCopy(renderer, restartTex, NULL, &rdst);
+                SDL_DestroyTexture(restartTex);
+            }
+        }
+    }
+}
+
+// ------------------ Internal Resolution ---------------
+// With --internal-res the game is drawn into a small target texture
+// instead of the window: the world (WINDOW_WIDTH x WINDOW_HEIGHT) is
+// scaled uniformly to fit it and letterboxed. The texture then goes to
+// the output (window or capture target) in one copy, enlarged by the
+// largest whole factor that fits and centered, with nearest-neighbour
+// filtering so pixels stay square and sharp. Sprite fill happens at the
+// low resolution, and any window size works with the same path.
+typedef struct {
+    SDL_Texture* texture;      // NULL: draw straight to the output
+    int          width, height;
+    float        scale;        // world px -> internal px
+    SDL_Rect     world;        // letterboxed world viewport, in world units
+} LowResTarget;
+
+bool lowResOpen(LowResTarget* lr, SDL_Renderer* renderer, int width, int height)
+{
+    memset(lr, 0, sizeof(*lr));
+    lr->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_TARGET, width, height);
+    if (!lr->texture) {
+        printf("Internal render target %dx%d failed: %s\n", width, height, SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureScaleMode(lr->texture, SDL_ScaleModeNearest);
+    lr->width  = width;
+    lr->height = height;
+    float sx = (float)width / WINDOW_WIDTH, sy = (float)height / WINDOW_HEIGHT;
+    lr->scale  = sx < sy ? sx : sy;
+    // SDL scales the viewport too, so it is given in world units
+    lr->world.x = (int)(((float)width  - WINDOW_WIDTH  * lr->scale) / 2 / lr->scale);
+    lr->world.y = (int)(((float)height - WINDOW_HEIGHT * lr->scale) / 2 / lr->scale);
+    lr->world.w = WINDOW_WIDTH;
+    lr->world.h = WINDOW_HEIGHT;
+    printf("render: internal %dx%d (world scale %.3f)\n", width, height, lr->scale);
+    return true;
+}
+
+// renderGame through the internal target when there is one.
+void lowResRender(LowResTarget* lr, SDL_Renderer* renderer, const GameState* game,
+                  RenderAssets* assets, ParticleSystem* particles)
+{
+    if (!lr || !lr->texture) {
+        renderGame(renderer, game, assets, particles);
+        return;
+    }
+
+    SDL_Texture* output = SDL_GetRenderTarget(renderer);
+    SDL_SetRenderTarget(renderer, lr->texture);
+    SDL_RenderSetScale(renderer, lr->scale, lr->scale);
+    SDL_RenderSetViewport(renderer, &lr->world);
+    renderGame(renderer, game, assets, particles);
+    SDL_SetRenderTarget(renderer, output);  // back to the output's own scale
+
+    TRACE_SCOPE("render upscale");
+    int outW, outH;
+    if (output) {
+        SDL_QueryTexture(output, NULL, NULL, &outW, &outH);
+    } else {
+        SDL_GetRendererOutputSize(renderer, &outW, &outH);
+    }
+    int factor = outW / lr->width < outH / lr->height ? outW / lr->width : outH / lr->height;
+    SDL_Rect dst;
+    if (factor >= 1) {
+        dst.w = lr->width * factor;
+        dst.h = lr->height * factor;
+    } else {            // output smaller than the target: shrink to fit
+        float fit = (float)outW / lr->width < (float)outH / lr->height
+                  ? (float)outW / lr->width : (float)outH / lr->height;
+        dst.w = (int)(lr->width * fit);
+        dst.h = (int)(lr->height * fit);
+    }
+    dst.x = (outW - dst.w) / 2;
+    dst.y = (outH - dst.h) / 2;
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, lr->texture, NULL, &dst);
+}
+
+void lowResClose(LowResTarget* lr)
+{
+    if (lr->texture) SDL_DestroyTexture(lr->texture);
+    lr->texture = NULL;
+}
+
+// ------------------ Software Blitter ------------------
+// --soft-blit skips SDL_Renderer entirely: frames are drawn by hand into
+// the window surface and shown with SDL_UpdateWindowSurface, for
+// machines without a GPU. Sprites are converted once, at load, to
+// premultiplied ARGB at their on-screen size, and every row is tagged
+// empty, opaque or mixed, so a row blit is a skip, a memcpy or an
+// SSE2/NEON "over" blend of four pixels per step. HUD glyphs are cached
+// the same way in each text colour. Rects are clipped to the canvas
+// before any pixel loop, so the inner loops never test bounds.
+enum { SOFT_ROW_EMPTY, SOFT_ROW_OPAQUE, SOFT_ROW_BLEND };
+enum { SOFT_TEXT_WHITE, SOFT_TEXT_RED, SOFT_TEXT_COLORS };
+#define SOFT_GLYPH_FIRST  32    // printable ASCII is cached
+#define SOFT_GLYPH_COUNT  95
+
+typedef struct {
+    uint32_t* pixels;    // premultiplied ARGB, w * h
+    uint8_t*  rowKind;   // SOFT_ROW_* per row
+    int       w, h;
+} SoftSprite;
+
+typedef struct {
+    uint32_t* pixels;
+    int       w, h;
+    int       stride;    // in pixels
+} SoftCanvas;
+
+typedef struct {
+    SoftSprite   ship;
+    SoftSprite   alien;
+    SoftSprite   glyphs[SOFT_TEXT_COLORS][SOFT_GLYPH_COUNT];
+    bool         hasFont;
+    SDL_Surface* staging;   // used when the window surface isn't xRGB8888
+} SoftBlitter;
+
+// d * (255 - a) / 255, rounded, for one 8-bit channel.
+static inline uint32_t softScale(uint32_t d, uint32_t inv)
+{
+    uint32_t x = d * inv + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Premultiplied "over": src + dst * (1 - srcAlpha), saturating. The SIMD
+// paths compute exactly the same bytes.
+static inline uint32_t softOver(uint32_t s, uint32_t d)
+{
+    uint32_t inv = 255 - (s >> 24), out = 0;
+    for (int sh = 0; sh < 32; sh += 8) {
+        uint32_t c = (s >> sh & 0xFF) + softScale(d >> sh & 0xFF, inv);
+        out |= (c > 255 ? 255 : c) << sh;
+    }
+    return out;
+}
+
+static void softOverRow(uint32_t* dst, const uint32_t* src, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i full = _mm_set1_epi32(255);
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        // 255 - alpha, copied into each pixel's four 16-bit channels
+        __m128i inv = _mm_sub_epi32(full, _mm_srli_epi32(s, 24));
+        inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 16));
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(inv, inv));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(inv, inv));
+        lo = _mm_add_epi16(lo, bias);
+        hi = _mm_add_epi16(hi, bias);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+#elif defined(__ARM_NEON)
+    const uint16x8_t bias = vdupq_n_u16(128);
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t s32 = vld1q_u32(src + i);
+        uint8x16_t s   = vreinterpretq_u8_u32(s32);
+        uint8x16_t d   = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+        uint32x4_t inv32 = vsubq_u32(vdupq_n_u32(255), vshrq_n_u32(s32, 24));
+        uint8x16_t inv = vreinterpretq_u8_u32(vmulq_n_u32(inv32, 0x01010101u));
+        uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(d), vget_low_u8(inv)), bias);
+        uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(d), vget_high_u8(inv)), bias);
+        lo = vshrq_n_u16(vaddq_u16(lo, vshrq_n_u16(lo, 8)), 8);
+        hi = vshrq_n_u16(vaddq_u16(hi, vshrq_n_u16(hi, 8)), 8);
+        uint8x16_t r = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vqaddq_u8(s, r)));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = softOver(src[i], dst[i]);
+    }
+}
+
+static void softFillRow(uint32_t* dst, uint32_t color, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i c = _mm_set1_epi32((int)color);
+    for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(dst + i), c);
+#elif defined(__ARM_NEON)
+    const uint32x4_t c = vdupq_n_u32(color);
+    for (; i + 4 <= n; i += 4) vst1q_u32(dst + i, c);
+#endif
+    for (; i < n; i++) dst[i] = color;
+}
+
+// Clips the w x h rect at (*x, *y) to the canvas. On success *x/*y/*w/*h
+// are the visible part and *sx/*sy how far into the source it starts.
+static bool softClip(const SoftCanvas* cv, int* x, int* y, int* w, int* h,
+                     int* sx, int* sy)
+{
+    *sx = *x < 0 ? -*x : 0;
+    *sy = *y < 0 ? -*y : 0;
+    int x1 = *x + *w < cv->w ? *x + *w : cv->w;
+    int y1 = *y + *h < cv->h ? *y + *h : cv->h;
+    *x += *sx;
+    *y += *sy;
+    *w = x1 - *x;
+    *h = y1 - *y;
+    return *w > 0 && *h > 0;
+}
+
+void softFillRect(SoftCanvas* cv, int x, int y, int w, int h, uint32_t color)
+{
+    int sx, sy;
+    if (!softClip(cv, &x, &y, &w, &h, &sx, &sy)) return;
+    for (int r = 0; r < h; r++) {
+        softFillRow(cv->pixels + (size_t)(y + r) * cv->stride + x, color, w);
+    }
+}
+
+void softBlitSprite(SoftCanvas* cv, const SoftSprite* sp, int x, int y)
+{
+    int w = sp->w, h = sp->h, sx, sy;
+    if (!sp->pixels || !softClip(cv, &x, &y, &w, &h, &sx, &sy)) return;
+    for (int r = 0; r < h; r++) {
+        const uint32_t* src = sp->pixels + (size_t)(sy + r) * sp->w + sx;
+        uint32_t*       dst = cv->pixels + (size_t)(y + r) * cv->stride + x;
+        switch (sp->rowKind[sy + r]) {
+            case SOFT_ROW_OPAQUE: memcpy(dst, src, (size_t)w * sizeof(uint32_t)); break;
+            case SOFT_ROW_BLEND:  softOverRow(dst, src, w);                        break;
+            default:              break;
+        }
+    }
+}
+
+// Solid pixels of a shield are drawn as runs of set bits, found a word at
+// a time with count-trailing-zeros.
+static void softDrawShield(SoftCanvas* cv, const Shield* sh, uint32_t color)
+{
+    for (int r = 0; r < SHIELD_HEIGHT; r++) {
+        uint64_t bits = sh->rows[r];
+        while (bits) {
+            int start = __builtin_ctzll(bits);
+            uint64_t rest = ~bits >> start;
+            int len = rest ? __builtin_ctzll(rest) : 64 - start;
+            softFillRect(cv, sh->x + start, sh->y + r, len, 1, color);
+            bits &= len + start >= 64 ? 0 : ~0ull << (start + len);
+        }
+    }
+}
+
+static void softDrawParticles(SoftCanvas* cv, ParticleSystem* ps)
+{
+    const int size = (int)PARTICLE_SIZE;
+    EcsQuery  q = ecsQuery(ps->world, PARTICLE_MASK);
+    EcsChunk* chunk;
+    while ((chunk = ecsNext(&q))) {
+        const float* px    = ECS_COLUMN(chunk, PC_X, float);
+        const float* py    = ECS_COLUMN(chunk, PC_Y, float);
+        const float* lives = ECS_COLUMN(chunk, PC_LIFE, float);
+        for (int i = 0; i < chunk->count; i++) {
+            uint32_t a = (uint32_t)(255 * lives[i]);
+            uint32_t g = (uint32_t)(80 + 175 * lives[i]);
+            uint32_t c = a << 24 | (255 * a / 255) << 16 | (g * a / 255) << 8 | (40 * a / 255);
+            int x = (int)px[i], y = (int)py[i], w = size, h = size, sx, sy;
+            if (!softClip(cv, &x, &y, &w, &h, &sx, &sy)) continue;
+            for (int r = 0; r < h; r++) {
+                uint32_t* dst = cv->pixels + (size_t)(y + r) * cv->stride + x;
+                for (int k = 0; k < w; k++) dst[k] = softOver(c, dst[k]);
+            }
+        }
+    }
+}
+
+static int softTextWidth(const SoftBlitter* sb, const char* text)
+{
+    int w = 0;
+    for (const char* p = text; *p; p++) {
+        int g = (unsigned char)*p - SOFT_GLYPH_FIRST;
+        if (g >= 0 && g < SOFT_GLYPH_COUNT) w += sb->glyphs[0][g].w;
+    }
+    return w;
+}
+
+static int softTextHeight(const SoftBlitter* sb)
+{
+    return sb->glyphs[0][0].h;   // every glyph is a full line tall
+}
+
+// Glyphs are placed side by side by their advance width (no kerning).
+static void softDrawText(SoftCanvas* cv, const SoftBlitter* sb, int color,
+                         const char* text, int x, int y)
+{
+    for (const char* p = text; *p; p++) {
+        int g = (unsigned char)*p - SOFT_GLYPH_FIRST;
+        if (g < 0 || g >= SOFT_GLYPH_COUNT) continue;
+        const SoftSprite* sp = &sb->glyphs[color][g];
+        softBlitSprite(cv, sp, x, y);
+        x += sp->w;
+    }
+}
+
+// Premultiplies `surf` into a w x h sprite, sampling one texel per cell
+// center like the collision masks do, and classifies its rows.
+static bool softSpriteFromSurface(SoftSprite* sp, SDL_Surface* loaded, int w, int h)
+{
+    memset(sp, 0, sizeof(*sp));
+    SDL_Surface* surf = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    if (!surf) return false;
+    sp->pixels  = malloc((size_t)w * h * sizeof(uint32_t) + (size_t)h);
+    if (!sp->pixels) {
+        SDL_FreeSurface(surf);
+        return false;
+    }
+    sp->rowKind = (uint8_t*)(sp->pixels + (size_t)w * h);
+    sp->w = w;
+    sp->h = h;
+
+    SDL_LockSurface(surf);
+    for (int r = 0; r < h; r++) {
+        const Uint32* row = (const Uint32*)((const Uint8*)surf->pixels +
+                            (size_t)((2 * r + 1) * surf->h / (2 * h)) * surf->pitch);
+        int opaque = 0, clear = 0;
+        for (int c = 0; c < w; c++) {
+            Uint32   px = row[(2 * c + 1) * surf->w / (2 * w)];
+            uint32_t a  = px >> 24;
+            sp->pixels[(size_t)r * w + c] = a << 24 |
+                ((px >> 16 & 0xFF) * a / 255) << 16 |
+                ((px >> 8 & 0xFF) * a / 255) << 8 |
+                ((px & 0xFF) * a / 255);
+            opaque += a == 255;
+            clear  += a == 0;
+        }
+        sp->rowKind[r] = opaque == w ? SOFT_ROW_OPAQUE
+                       : clear == w  ? SOFT_ROW_EMPTY : SOFT_ROW_BLEND;
+    }
+    SDL_UnlockSurface(surf);
+    SDL_FreeSurface(surf);
+    return true;
+}
+
+static bool softSpriteLoad(SoftSprite* sp, const char* path, int w, int h)
+{
+    SDL_Surface* loaded = IMG_Load(path);
+    if (!loaded) {
+        printf("IMG_Load failed for %s: %s\n", path, IMG_GetError());
+        memset(sp, 0, sizeof(*sp));
+        return false;
+    }
+    bool ok = softSpriteFromSurface(sp, loaded, w, h);
+    SDL_FreeSurface(loaded);
+    return ok;
+}
+
+void softBlitClose(SoftBlitter* sb)
+{
+    free(sb->ship.pixels);
+    free(sb->alien.pixels);
+    for (int c = 0; c < SOFT_TEXT_COLORS; c++) {
+        for (int g = 0; g < SOFT_GLYPH_COUNT; g++) free(sb->glyphs[c][g].pixels);
+    }
+    if (sb->staging) SDL_FreeSurface(sb->staging);
+    memset(sb, 0, sizeof(*sb));
+}
+
+// Loads the sprites and, if the font opens, the HUD glyphs. Without a
+// font the HUD is skipped, as in renderGame.
+bool softBlitOpen(SoftBlitter* sb)
+{
+    memset(sb, 0, sizeof(*sb));
+    if (!softSpriteLoad(&sb->ship, "ship.png", PLAYER_WIDTH, PLAYER_HEIGHT) ||
+        !softSpriteLoad(&sb->alien, "alien.jpg", ALIEN_WIDTH, ALIEN_HEIGHT)) {
+        softBlitClose(sb);
+        return false;
+    }
+
+    TTF_Font* font = TTF_OpenFont(FONT_PATH, FONT_SIZE);
+    if (!font) {
+        printf("TTF_OpenFont failed: %s\n", TTF_GetError());
+        return true;
+    }
+    static const SDL_Color colors[SOFT_TEXT_COLORS] = {
+        { 255, 255, 255, 255 }, { 255, 0, 0, 255 }
+    };
+    sb->hasFont = true;
+    for (int c = 0; c < SOFT_TEXT_COLORS; c++) {
+        for (int g = 0; g < SOFT_GLYPH_COUNT; g++) {
+            SDL_Surface* surf = TTF_RenderGlyph_Blended(font, (Uint16)(SOFT_GLYPH_FIRST + g),
+                                                        colors[c]);
+            if (!surf || !softSpriteFromSurface(&sb->glyphs[c][g], surf, surf->w, surf->h)) {
+                sb->hasFont = false;
+            }
+            if (surf) SDL_FreeSurface(surf);
+        }
+    }
+    TTF_CloseFont(font);
+    if (!sb->hasFont) printf("Glyph cache failed; HUD disabled\n");
+    return true;
+}
+
+// Every live entity tagged `tag`: the sprite if there is one, else a
+// rect of `color`.
+static void softDrawEntities(SoftCanvas* cv, const GameState* game, int tag,
+                             const SoftSprite* sprite, uint32_t color)
+{
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(tag));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns e = entityColumns(c, q.base);
+        for (int i = 0; i < e.count; i++) {
+            if (!e.active[i]) continue;
+            if (sprite) {
+                softBlitSprite(cv, sprite, e.x[i], e.y[i]);
+            } else {
+                softFillRect(cv, e.x[i], e.y[i], e.w[i], e.h[i], color);
+            }
+        }
+    }
+}
+
+// Same picture as renderGame, drawn straight into `cv`.
+void softRender(SoftBlitter* sb, SoftCanvas* cv, const GameState* game,
+                ParticleSystem* particles)
+{
+    TRACE_BEGIN("render sprites");
+    for (int r = 0; r < cv->h; r++) {
+        softFillRow(cv->pixels + (size_t)r * cv->stride, 0xFF000000u, cv->w);
+    }
+
+    softDrawEntities(cv, game, EC_PLAYER, &sb->ship, 0);
+    softDrawEntities(cv, game, EC_SHOT, NULL, 0xFFFFFFFFu);
+    TRACE_BEGIN("render shields");
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        softDrawShield(cv, &game->shields[s], 0xFF20E040u);
+    }
+    TRACE_END();
+    softDrawEntities(cv, game, EC_ENEMY_SHOT, NULL, 0xFFFF5050u);
+    softDrawEntities(cv, game, EC_ALIEN, &sb->alien, 0);
+    TRACE_END();
+
+    if (particles) {
+        TRACE_SCOPE("render particles");
+        softDrawParticles(cv, particles);
+    }
+
+    if (!sb->hasFont) return;
+    TRACE_SCOPE("render HUD");
+    char scoreBuf[64];
+    if (game->waves) {
+        sprintf(scoreBuf, "Score: %d   Lives: %d   Wave: %d",
+                game->score, game->lives, game->waveIndex + 1);
+    } else {
+        sprintf(scoreBuf, "Score: %d   Lives: %d", game->score, game->lives);
+    }
+    softDrawText(cv, sb, SOFT_TEXT_WHITE, scoreBuf, 10, 10);
+
+    if (game->gameOver) {
+        const char* msg = (allAliensDead(game) && game->lives > 0) ? "Victory!" : "Game Over!";
+        const char* restart = "Press R to restart";
+        int h = softTextHeight(sb);
+        softDrawText(cv, sb, SOFT_TEXT_RED, msg,
+                     (WINDOW_WIDTH - softTextWidth(sb, msg)) / 2, (WINDOW_HEIGHT - h) / 2);
+        softDrawText(cv, sb, SOFT_TEXT_WHITE, restart,
+                     (WINDOW_WIDTH - softTextWidth(sb, restart)) / 2, (WINDOW_HEIGHT - h) / 2 + 50);
+    }
+}
+
+// Draws into a 32-bit ARGB/xRGB surface directly; any other window
+// format goes through an ARGB8888 staging surface and one SDL blit.
+void softRenderSurface(SoftBlitter* sb, SDL_Surface* surf, const GameState* game,
+                       ParticleSystem* particles)
+{
+    Uint32 format = surf->format->format;
+    bool direct = format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_RGB888;
+    SDL_Surface* target = surf;
+    if (!direct) {
+        if (!sb->staging || sb->staging->w != surf->w || sb->staging->h != surf->h) {
+            if (sb->staging) SDL_FreeSurface(sb->staging);
+            sb->staging = SDL_CreateRGBSurfaceWithFormat(0, surf->w, surf->h, 32,
+                                                         SDL_PIXELFORMAT_ARGB8888);
+            if (!sb->staging) return;
+        }
+        target = sb->staging;
+    }
+
+    if (SDL_MUSTLOCK(target)) SDL_LockSurface(target);
+    SoftCanvas cv = { target->pixels, target->w, target->h,
+                      target->pitch / (int)sizeof(uint32_t) };
+    softRender(sb, &cv, game, particles);
+    if (SDL_MUSTLOCK(target)) SDL_UnlockSurface(target);
+    if (!direct) SDL_BlitSurface(target, NULL, surf, NULL);
+}
+
+// ------------------ Game Update (one tick) -------------
+// The tick is a run of systems over the entity world: each one queries
+// the archetypes it acts on by tag and walks their chunks.
+
+// Puts the first idle one of the first `limit` shots tagged `tag` in
+// flight, centered on cx, with its bottom edge on y when dir < 0 (up)
+// and its top edge on y otherwise. False if they are all flying.
+static bool fireShot(GameState* game, int tag, int limit, int cx, int y, int dir, int event)
+{
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(tag));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns s = entityColumns(c, q.base);
+        for (int i = 0; i < s.count && s.base + i < limit; i++) {
+            if (s.active[i]) continue;
+            s.active[i] = true;
+            s.x[i]  = cx - s.w[i] / 2;
+            s.y[i]  = dir < 0 ? y - s.h[i] : y;
+            s.fx[i] = s.fy[i] = 0;
+            game->hash.sum += entityTerm(kSimHashKind[q.archetype], &s, i);
+            emitEvent(game, event, s.x[i], s.y[i], 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves every live shot tagged `tag` by dy (16.16 px) and records its
+// whole-pixel step by slot in `steps`, which depends on the shot's
+// fraction when the speed isn't whole. A shield stops a shot anywhere
+// along the path it swept. A move adds dy times the slot's Y constant to
+// the hash; only a stopped shot takes its whole term out.
+static void shotsMove(GameState* game, int tag, fixed dy, int* steps)
+{
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(tag));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns s    = entityColumns(c, q.base);
+        uint32_t      kind = kSimHashKind[q.archetype];
+        for (int i = 0; i < s.count; i++) {
+            if (!s.active[i]) continue;
+            int y0 = s.y[i];
+            fixMove(&s.y[i], &s.fy[i], dy);
+            int step = s.y[i] - y0;
+            steps[s.base + i] = step;
+            game->hash.sum += hashKey(kind, (uint32_t)(s.base + i), HASH_Y) * (uint64_t)dy;
+            if (shieldsHit(game, s.x[i], step < 0 ? s.y[i] : y0, s.w[i],
+                           s.h[i] + (step < 0 ? -step : step), dy < 0 ? -1 : 1)) {
+                game->hash.sum -= entityTerm(kind, &s, i);
+                s.active[i] = false;
+            }
+        }
+    }
+}
+
+// The alien each live shot (only slot `only`, if >= 0) hits earliest
+// along its swept path, by shot slot in `hit`: an alien slot, or -1.
+// The formation is walked once for all of them, in slot order, so ties
+// go to the first alien as they would shot by shot.
+static void shotsFindHits(const GameState* game, const int* stepX, const int* stepY,
+                          const int* shotDy, int only, int* hit)
+{
+    const CollisionMasks* masks = collisionMasks();
+    int x[MAX_BULLETS], y[MAX_BULLETS], dy[MAX_BULLETS], slot[MAX_BULLETS];
+    int bestK[MAX_BULLETS], bestN[MAX_BULLETS];   // earliest: step bestK of bestN
+    int n = 0;
+
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(EC_SHOT));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns s = entityColumns(c, q.base);
+        for (int b = 0; b < s.count; b++) {
+            if (!s.active[b] || (only >= 0 && s.base + b != only)) continue;
+            slot[n] = s.base + b;
+            dy[n]   = shotDy[slot[n]];
+            x[n]    = s.x[b];
+            y[n]    = s.y[b] - dy[n];
+            hit[slot[n++]] = -1;
+        }
+    }
+    q = ecsQuery(&game->entities.world, ECS_BIT(EC_ALIEN));
+    while (n > 0 && (c = ecsNext(&q))) {
+        EntityColumns a = entityColumns(c, q.base);
+        for (int i = 0; i < a.count; i++) {
+            if (!a.active[i]) continue;
+            int sx = stepX[a.base + i], sy = stepY[a.base + i];
+            for (int b = 0; b < n; b++) {
+                int k, m;
+                if (sweptSpriteHit(&masks->bullet, x[b], y[b], -sx, dy[b] - sy,
+                                   &masks->alien, a.x[i] - sx, a.y[i] - sy, &k, &m) &&
+                    (hit[slot[b]] < 0 || (int64_t)k * bestN[b] < (int64_t)bestK[b] * m)) {
+                    hit[slot[b]] = a.base + i;
+                    bestK[b]     = k;
+                    bestN[b]     = m;
+                }
+            }
+        }
+    }
+}
+
+// Whether a live alien's bottom edge reached y.
+static bool aliensReached(const GameState* game, int y)
+{
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(EC_ALIEN));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns a = entityColumns(c, q.base);
+        for (int i = 0; i < a.count; i++) {
+            if (a.active[i] && a.y[i] + a.h[i] >= y) return true;
+        }
+    }
+    return false;
+}
+
+void updateGame(GameState* game, const GameInput* input)
+{
+    EcsWorld*     world  = &game->entities.world;
+    StateHash*    hash   = &game->hash;
+    const CollisionMasks* masks = collisionMasks();
+    int           scale  = game->timeScale > 1 ? game->timeScale : 1;
+    EcsQuery      q;
+    EcsChunk*     c;
+
+    if (game->events) {
+        game->events->count = 0;
+    }
+
+    // Press R to restart if game over
+    if (input->restart && game->gameOver) {
+        resetGame(game);
+    }
+
+    TRACE_SCOPE("update");
+    uint64_t      globalsBefore = globalsTerm(game);
+    EntityColumns player = playerColumns(game);   // resets keep it in place
+
+    fixed vx = input->move * game->config.playerSpeed;
+    hash->sum += hashKey(HASH_PLAYER, 0, HASH_VX) * (uint64_t)(vx - player.vx[0]);
+    player.vx[0] = vx;
+
+    // Fire bullet if any of the allowed slots is free
+    if (input->fire && !game->gameOver) {
+        fireShot(game, EC_SHOT, game->config.bullets, player.x[0] + player.w[0] / 2,
+                 player.y[0], -1, EVENT_SHOT);
+    }
+
+    // Update Logic if not game over
+    if (!game->gameOver) {
+        // Move player
+        TRACE_BEGIN("update player+bullets");
+        int   playerX0 = player.x[0];
+        fixed playerFx0 = fixJoin(player.x[0], player.fx[0]);
+        fixMove(&player.x[0], &player.fx[0], player.vx[0] * scale);
+        if (player.x[0] < 0) {
+            player.x[0]  = 0;
+            player.fx[0] = 0;
+        }
+        if (player.x[0] + player.w[0] > WINDOW_WIDTH) {
+            player.x[0]  = WINDOW_WIDTH - player.w[0];
+            player.fx[0] = 0;
+        }
+        hash->sum += hashKey(HASH_PLAYER, 0, HASH_X) *
+                     (uint64_t)(fixJoin(player.x[0], player.fx[0]) - playerFx0);
+
+        // Update bullets
+        int bulletDy[MAX_BULLETS] = { 0 };
+        shotsMove(game, EC_SHOT, -game->config.bulletSpeed * scale, bulletDy);
+
+        TRACE_END();
+
+        // Check if aliens need to descend
+        TRACE_BEGIN("update aliens");
+        // Without a script, aliens start a wave on whole pixels and always
+        // move together, so they share one fraction and one whole-pixel
+        // step. stepX/stepY hold each live alien's step for the sweep.
+        fixed marchDx = game->wave.speed * game->alienMoveDir * scale;
+        int   stepX[MAX_ALIENS], stepY[MAX_ALIENS];
+        bool  needDescend = false;
+        q = ecsQuery(world, ECS_BIT(EC_ALIEN));
+        while (!needDescend && (c = ecsNext(&q))) {
+            EntityColumns a = entityColumns(c, q.base);
+            for (int i = 0; i < a.count; i++) {
+                if (!a.active[i]) continue;
+                int newX = fixFloor(fixJoin(a.x[i], a.fx[i]) + marchDx);
+                if (newX < 0 || (newX + a.w[i] > WINDOW_WIDTH)) {
+                    needDescend = true;
+                    break;
+                }
+            }
+        }
+
+        if (needDescend) {
+            game->alienMoveDir = -game->alienMoveDir;
+        }
+        if (game->wave.script.opCount > 0) {
+            TRACE_SCOPE("alien script");
+            alienScriptMove(game, needDescend ? 0 : marchDx,
+                            needDescend ? FIX(game->wave.descent) : 0, scale,
+                            stepX, stepY);
+        } else {
+            // Move aliens down at an edge, else horizontally
+            q = ecsQuery(world, ECS_BIT(EC_ALIEN));
+            while ((c = ecsNext(&q))) {
+                EntityColumns a = entityColumns(c, q.base);
+                for (int i = 0; i < a.count; i++) {
+                    if (!a.active[i]) continue;
+                    int slot = a.base + i;
+                    if (needDescend) {
+                        a.y[i] += game->wave.descent;
+                        stepX[slot] = 0;
+                        stepY[slot] = game->wave.descent;
+                    } else {
+                        int x0 = a.x[i];
+                        fixMove(&a.x[i], &a.fx[i], marchDx);
+                        stepX[slot] = a.x[i] - x0;
+                        stepY[slot] = 0;
+                    }
+                }
+            }
+            if (needDescend) {
+                hashAlienShift(hash, 0, FIX(game->wave.descent));
+            } else {
+                hashAlienShift(hash, marchDx, 0);
+            }
+        }
+
+        // March beat speeds up as the formation thins out
+        if ((game->marchTimer -= scale) <= 0) {
+            emitEvent(game, EVENT_MARCH, 0, 0, game->marchNote);
+            game->marchNote  = (game->marchNote + 1) & 3;
+            game->marchTimer = MARCH_TICKS_MIN + (MARCH_TICKS_MAX - MARCH_TICKS_MIN) *
+                               game->aliveCount / (alienCount(game) > 0 ? alienCount(game) : 1);
+        }
+
+        TRACE_END();
+
+        // Collision: bullet vs. aliens, swept over the step in each
+        // alien's frame; the alien hit earliest along the path dies, and
+        // a bullet that hit nothing is dropped once it leaves the screen.
+        // One walk of the formation finds every bullet's hit up front.
+        TRACE_BEGIN("collision");
+        int shotHit[MAX_BULLETS];
+        shotsFindHits(game, stepX, stepY, bulletDy, -1, shotHit);
+        q = ecsQuery(world, ECS_BIT(EC_SHOT));
+        while ((c = ecsNext(&q))) {
+            EntityColumns s = entityColumns(c, q.base);
+            for (int b = 0; b < s.count; b++) {
+                if (!s.active[b]) continue;
+                int hit = shotHit[s.base + b];
+                if (hit >= 0 && !alienAlive(game, hit)) {   // an earlier bullet took it
+                    shotsFindHits(game, stepX, stepY, bulletDy, s.base + b, shotHit);
+                    hit = shotHit[s.base + b];
+                }
+                if (hit >= 0) {
+                    int           row;
+                    EntityColumns a = simSlot(game, SIM_ALIENS, hit, &row);
+                    hashAlienKill(hash, &a, row);
+                    hash->sum -= entityTerm(HASH_BULLET, &s, b);
+                    a.active[row] = false;
+                    s.active[b]   = false;
+                    shooterIndexKill(game, hit);
+                    game->aliveCount--;
+                    game->score += 10;
+                    emitEvent(game, EVENT_ALIEN_KILLED, a.x[row] + a.w[row] / 2,
+                              a.y[row] + a.h[row] / 2, 0);
+                } else if (s.y[b] + s.h[b] < 0) {   // left the screen
+                    hash->sum -= entityTerm(HASH_BULLET, &s, b);
+                    s.active[b] = false;
+                }
+            }
+        }
+
+        TRACE_END();
+
+        // Enemy fire: a random column's bottom-most alien shoots
+        TRACE_BEGIN("enemy fire");
+        if ((game->enemyFireTimer -= scale) <= 0 && game->shooterCount > 0) {
+            uint32_t r = gameRandom(game);
+            game->enemyFireTimer = game->config.enemyFireTicks +
+                                   (int)(r >> 16) % game->config.enemyFireJitter;
+            int           row;
+            EntityColumns a = simSlot(game, SIM_ALIENS,
+                                      game->colBottom[game->shooterCols[(r & 0xFFFF) % game->shooterCount]],
+                                      &row);
+            fireShot(game, EC_ENEMY_SHOT, game->config.enemyBullets, a.x[row] + a.w[row] / 2,
+                     a.y[row] + a.h[row], 1, EVENT_ENEMY_SHOT);
+        }
+
+        // Move enemy bullets, then sweep them all against the player at once
+        int      enemyDy[MAX_ENEMY_BULLETS] = { 0 };   // whole-pixel steps
+        int      playerDx = player.x[0] - playerX0;
+        uint32_t hits = 0;                             // by slot
+        shotsMove(game, EC_ENEMY_SHOT, game->config.enemyBulletSpeed * scale, enemyDy);
+        q = ecsQuery(world, ECS_BIT(EC_ENEMY_SHOT));
+        while ((c = ecsNext(&q))) {
+            EntityColumns e = entityColumns(c, q.base);
+            for (int k = 0; k < e.count; k++) {
+                int  dy = enemyDy[e.base + k], step, steps;
+                bool hit = e.active[k] &
+                           sweptSpriteHit(&masks->enemyBullet, e.x[k], e.y[k] - dy,
+                                          -playerDx, dy, &masks->ship,
+                                          playerX0, player.y[0], &step, &steps);
+                hits |= (uint32_t)hit << (e.base + k);
+                if (e.active[k] && !hit && e.y[k] >= WINDOW_HEIGHT) {
+                    hash->sum -= entityTerm(HASH_ENEMY_BULLET, &e, k);
+                    e.active[k] = false;
+                }
+            }
+        }
+        // Ship destroyed: clear the air and carry on with the wave
+        q = ecsQuery(world, ECS_BIT(EC_ENEMY_SHOT));
+        while (hits && (c = ecsNext(&q))) {
+            EntityColumns e = entityColumns(c, q.base);
+            for (int k = 0; k < e.count; k++) {
+                if (e.active[k]) {
+                    hash->sum -= entityTerm(HASH_ENEMY_BULLET, &e, k);
+                    e.active[k] = false;
+                }
+            }
+        }
+        if (hits) {
+            game->lives--;
+            emitEvent(game, EVENT_LIFE_LOST, player.x[0] + player.w[0] / 2,
+                      player.y[0], 0);
+            if (game->lives <= 0) {
+                game->gameOver = true;
+            }
+        }
+
+        TRACE_END();
+
+        // Check if aliens reached bottom => lose life or game over
+        TRACE_BEGIN("life-loss check");
+        if (aliensReached(game, player.y[0])) {
+            // Aliens reached player row
+            game->lives--;
+            emitEvent(game, EVENT_LIFE_LOST, player.x[0] + player.w[0] / 2,
+                      player.y[0], 0);
+            if (game->lives <= 0) {
+                game->gameOver = true;
+            } else {
+                // Reset aliens & bullets
+                restoreWaveStart(game, resetTemplates(game)->current, true, true);
+                globalsBefore = globalsTerm(game);
+            }
+        }
+        TRACE_END();
+    }
+
+    // Check if all aliens are dead => next wave, or victory after the last
+    if (allAliensDead(game) && !game->gameOver) {
+        WaveDef next;
+        if (game->waves && waveSourceGet(game->waves, game->waveIndex + 1, &next)) {
+            ResetTemplates* templates = resetTemplates(game);
+            buildWaveTemplate(&templates->waveStart, &next, game->waveIndex + 1);
+            templates->current = &templates->waveStart;
+            restoreWaveStart(game, templates->current, true, false);
+            globalsBefore = globalsTerm(game);
+        } else {
+            game->gameOver = true;
+        }
+    }
+
+    // Resets leave a consistent hash; everything else was applied in place.
+    hash->sum += globalsTerm(game) - globalsBefore;
+    game->tick += (uint64_t)scale;
+}
+
+// ------------------ Autopilot --------------------------
+// Deterministic stand-in for a player: chase the lowest live alien,
+// fire whenever possible and restart when the game ends.
+void autopilotInput(const GameState* game, GameInput* input)
+{
+    EntityColumns player = playerColumns(game);
+    bool found   = false;
+    int  targetX = 0, targetY = 0;   // the lowest, first on ties
+
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(EC_ALIEN));
+    EcsChunk* c;
+    while ((c = ecsNext(&q))) {
+        EntityColumns a = entityColumns(c, q.base);
+        for (int i = 0; i < a.count; i++) {
+            if (a.active[i] && (!found || a.y[i] > targetY)) {
+                found   = true;
+                targetX = a.x[i] + a.w[i] / 2;
+                targetY = a.y[i];
+            }
+        }
+    }
+
+    input->move    = 0;
+    input->fire    = !game->gameOver;
+    input->restart = game->gameOver;
+    if (found) {
+        int px = player.x[0] + player.w[0] / 2;
+        int deadZone = fixFloor(game->config.playerSpeed * (game->timeScale > 1 ? game->timeScale : 1));
+        if (targetX < px - deadZone) input->move = -1;
+        if (targetX > px + deadZone) input->move = 1;
+    }
+}
+
+// ------------------ Hash Log ---------------------------
+void logStateHash(FILE* log, const GameState* game)
+{
+    if (log) {
+        fprintf(log, "%llu %016llx\n",
+                (unsigned long long)game->tick,
+                (unsigned long long)stateHashDigest(&game->hash));
+    }
+}
+
+// ------------------ Config ----------------------------
+// --config FILE overrides the tunables whose #defines are only defaults.
+// One "key = value" per line, '#' starts a comment; keys are the lower
+// case names of those #defines and speeds are px per tick, which may be
+// fractional (space_invaders.cfg lists every key):
+//   player_speed = 6.5
+//   max_bullets  = 8
+// The parser walks the file where it lies: lines and fields are found
+// with memchr, keys are matched against a table, and nothing is
+// allocated, so a reload costs microseconds. A file with any bad line is
+// rejected whole and the running values stay, so saving a half-edited
+// file does no harm.
+//
+// On Linux an inotify watch on the file's directory (editors often
+// replace a file instead of writing it) tells the main loop that it was
+// saved, without blocking and without polling the disk. The simulation
+// values are published through two slots and a version counter, and
+// whichever thread runs updateGame adopts them between ticks; the sim
+// thread never waits for the main thread. Speeds, shot limits and enemy
+// fire apply from the next tick, player_lives from the next game and the
+// alien_* formation the next time the classic wave starts. The particle
+// pool is reallocated only when max_particles changes. Bullet and alien
+// slots are never reallocated: they are MAX_* entities of the world inside
+// GameState, which resets, replays and spectators copy whole, and the
+// config only chooses how many of them are used.
+typedef struct {
+    SimConfig sim;
+    int       windowWidth, windowHeight;
+    int       particles;
+} Config;
+
+typedef struct {
+    const char* key;
+    size_t      offset;     // of an int in Config
+    bool        isFixed;    // px per tick: above 0 and at most max px
+    int         min, max;
+} ConfigKey;
+
+static const ConfigKey kConfigKeys[] = {
+    { "window_width",       offsetof(Config, windowWidth),          false, 160, 7680 },
+    { "window_height",      offsetof(Config, windowHeight),         false, 120, 4320 },
+    { "player_speed",       offsetof(Config, sim.playerSpeed),      true,  0, 64 },
+    { "player_lives",       offsetof(Config, sim.lives),            false, 1, 99 },
+    { "bullet_speed",       offsetof(Config, sim.bulletSpeed),      true,  0, 64 },
+    { "max_bullets",        offsetof(Config, sim.bullets),          false, 1, MAX_BULLETS },
+    { "enemy_bullet_speed", offsetof(Config, sim.enemyBulletSpeed), true,  0, 64 },
+    { "max_enemy_bullets",  offsetof(Config, sim.enemyBullets),     false, 1, MAX_ENEMY_BULLETS },
+    { "enemy_fire_ticks",   offsetof(Config, sim.enemyFireTicks),   false, 1, 3600 },
+    { "enemy_fire_jitter",  offsetof(Config, sim.enemyFireJitter),  false, 1, 3600 },
+    { "alien_count",        offsetof(Config, sim.alienCols),        false, 1, MAX_ALIENS },
+    { "alien_rows",         offsetof(Config, sim.alienRows),        false, 1, MAX_ALIENS },
+    { "alien_start_x",      offsetof(Config, sim.alienStartX),      false, 0, WINDOW_WIDTH - ALIEN_WIDTH },
+    { "alien_start_y",      offsetof(Config, sim.alienStartY),      false, 0, WINDOW_HEIGHT - ALIEN_HEIGHT },
+    { "alien_spacing",      offsetof(Config, sim.alienSpacing),     false, 0, WINDOW_WIDTH },
+    { "alien_speed",        offsetof(Config, sim.alienSpeed),       true,  0, 64 },
+    { "alien_descent",      offsetof(Config, sim.alienDescent),     false, 0, WINDOW_HEIGHT },
+    { "max_particles",      offsetof(Config, particles),            false, 4, 1 << 20 },
+};
+#define CONFIG_KEYS ((int)(sizeof(kConfigKeys) / sizeof(kConfigKeys[0])))
+
+void configDefaults(Config* cfg)
+{
+    cfg->sim          = kSimConfigDefaults;
+    cfg->windowWidth  = WINDOW_WIDTH;
+    cfg->windowHeight = WINDOW_HEIGHT;
+    cfg->particles    = MAX_PARTICLES;
+}
+
+static inline bool configInRange(const ConfigKey* key, long v)
+{
+    return key->isFixed ? v > 0 && v <= FIX(key->max) : v >= key->min && v <= key->max;
+}
+
+// Every field in range and the formation within MAX_ALIENS; the
+// snapshot decoder checks what it receives with this.
+bool configValid(const SimConfig* sim)
+{
+    for (int i = 0; i < CONFIG_KEYS; i++) {
+        const ConfigKey* key = &kConfigKeys[i];
+        // sim is Config's first member, so its offsets are SimConfig's
+        if (key->offset + sizeof(int) > sizeof(SimConfig)) continue;
+        int v;
+        memcpy(&v, (const uint8_t*)sim + key->offset, sizeof(v));
+        if (!configInRange(key, v)) return false;
+    }
+    return sim->alienRows * sim->alienCols <= MAX_ALIENS;
+}
+
+static inline bool configBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// `len` bytes of value text for `key`; the text is copied to the stack
+// only to give parseFixed/strtol their terminator.
+static bool configValue(const ConfigKey* key, const char* text, int len, int* out)
+{
+    char buf[CONFIG_MAX_VALUE];
+    if (len <= 0 || len >= (int)sizeof(buf)) return false;
+    memcpy(buf, text, (size_t)len);
+    buf[len] = '\0';
+    long v;
+    if (key->isFixed) {
+        fixed f;
+        if (!parseFixed(buf, &f)) return false;
+        v = f;
+    } else {
+        char* end;
+        v = strtol(buf, &end, 10);
+        if (*end != '\0') return false;
+    }
+    if (!configInRange(key, v)) return false;
+    *out = (int)v;
+    return true;
+}
+
+// Parses `size` bytes of config text over the defaults into *out. Every
+// bad line is reported (`name` is for the messages); if there was one,
+// *out is left alone and the result is false.
+bool configParse(const char* text, size_t size, const char* name, Config* out)
+{
+    Config cfg;
+    configDefaults(&cfg);
+    bool ok   = true;
+    int  line = 0;
+    const char* end = text + size;
+    for (const char* p = text; p < end; line++) {
+        const char* eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        const char* stop = memchr(p, '#', (size_t)(eol - p));
+        if (!stop) stop = eol;
+        const char* k = p;
+        p = eol + 1;
+
+        while (k < stop && configBlank(*k)) k++;
+        if (k == stop) continue;                   // blank or comment
+        const char* eq   = memchr(k, '=', (size_t)(stop - k));
+        const char* kEnd = eq ? eq : stop;
+        while (kEnd > k && configBlank(kEnd[-1])) kEnd--;
+        int keyLen = (int)(kEnd - k);
+        if (!eq) {
+            printf("Config %s line %d: expected \"key = value\"\n", name, line + 1);
+            ok = false;
+            continue;
+        }
+        const ConfigKey* key = NULL;
+        for (int i = 0; i < CONFIG_KEYS && !key; i++) {
+            if (strncmp(kConfigKeys[i].key, k, (size_t)keyLen) == 0 &&
+                kConfigKeys[i].key[keyLen] == '\0') {
+                key = &kConfigKeys[i];
+            }
+        }
+        const char* v    = eq + 1;
+        const char* vEnd = stop;
+        while (v < vEnd && configBlank(*v)) v++;
+        while (vEnd > v && configBlank(vEnd[-1])) vEnd--;
+        int value;
+        if (!key) {
+            printf("Config %s line %d: unknown key \"%.*s\"\n", name, line + 1, keyLen, k);
+            ok = false;
+        } else if (!configValue(key, v, (int)(vEnd - v), &value)) {
+            if (key->isFixed) {
+                printf("Config %s line %d: %s wants a number above 0, at most %d\n",
+                       name, line + 1, key->key, key->max);
+            } else {
+                printf("Config %s line %d: %s wants a whole number %d..%d\n",
+                       name, line + 1, key->key, key->min, key->max);
+            }
+            ok = false;
+        } else {
+            memcpy((uint8_t*)&cfg + key->offset, &value, sizeof(value));
+        }
+    }
+    if (ok && cfg.sim.alienRows * cfg.sim.alienCols > MAX_ALIENS) {
+        printf("Config %s: alien_rows x alien_count is more than %d aliens\n",
+               name, MAX_ALIENS);
+        ok = false;
+    }
+    if (ok) {
+        cfg.particles = (cfg.particles + 3) & ~3;   // the pool's SIMD width
+        *out = cfg;
+    }
+    return ok;
+}
+
+// Reads and parses `path`; false, with *out unchanged, if the file can't
+// be read, is too big or has a bad line.
+bool configLoad(const char* path, Config* out)
+{
+    static char text[CONFIG_MAX_BYTES + 1];   // main thread only
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        printf("Cannot open config %s\n", path);
+        return false;
+    }
+    size_t size = fread(text, 1, sizeof(text), f);
+    fclose(f);
+    if (size > CONFIG_MAX_BYTES) {
+        printf("Config %s is over %d bytes\n", path, CONFIG_MAX_BYTES);
+        return false;
+    }
+    return configParse(text, size, path, out);
+}
+
+// -------- Handing values to the simulation --------
+// The latest published SimConfig is in slot (version & 1). The writer
+// fills the other slot before bumping the version, and a reader that
+// sees the same version before and after its copy has a whole one.
+static SimConfig   gConfigSlots[2];
+static atomic_uint gConfigVersion;
+
+// Main thread.
+void configPublish(const SimConfig* sim)
+{
+    unsigned v = atomic_load_explicit(&gConfigVersion, memory_order_relaxed) + 1;
+    gConfigSlots[v & 1] = *sim;
+    atomic_store_explicit(&gConfigVersion, v, memory_order_release);
+}
+
+// Between ticks, on whichever thread runs updateGame: takes a config
+// published after version *seen. One atomic load when there is none.
+void configAdopt(GameState* game, unsigned* seen)
+{
+    unsigned v = atomic_load_explicit(&gConfigVersion, memory_order_acquire);
+    if (v == *seen) return;
+    SimConfig sim = gConfigSlots[v & 1];
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&gConfigVersion, memory_order_relaxed) != v) return;   // next tick
+    game->config = sim;
+    *seen = v;
+}
+
+// -------- Watching the file --------
+typedef struct {
+    const char* path;       // NULL: no --config
+    int         fd;         // inotify descriptor, -1: not watching
+    char        name[256];  // the file's name within its directory
+} ConfigWatch;
+
+#if defined(__linux__)
+bool configWatchOpen(ConfigWatch* w, const char* path)
+{
+    char        dir[4096] = ".";
+    const char* slash     = strrchr(path, '/');
+    if (slash) {
+        snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    }
+    snprintf(w->name, sizeof(w->name), "%s", slash ? slash + 1 : path);
+    w->path = path;
+    w->fd   = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0 || inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        printf("config: cannot watch %s (%s), no hot reload\n", path, strerror(errno));
+        if (w->fd >= 0) close(w->fd);
+        w->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// True if the file was saved since the last call; never blocks.
+static bool configWatchChanged(ConfigWatch* w)
+{
+    if (w->fd < 0) return false;
+    _Alignas(struct inotify_event) char buf[4096];
+    bool    changed = false;
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (const char* p = buf; p < buf + n; ) {
+            const struct inotify_event* e = (const struct inotify_event*)(const void*)p;
+            if (e->len > 0 && strcmp(e->name, w->name) == 0) changed = true;
+            p += sizeof(*e) + e->len;
+        }
+    }
+    return changed;
+}
+
+void configWatchClose(ConfigWatch* w)
+{
+    if (w->fd >= 0) close(w->fd);
+    w->fd = -1;
+}
+#else
+bool configWatchOpen(ConfigWatch* w, const char* path)
+{
+    w->path = path;
+    w->fd   = -1;
+    printf("config: hot reload needs inotify (Linux); %s is read once\n", path);
+    return false;
+}
+
+static bool configWatchChanged(ConfigWatch* w)
+{
+    (void)w;
+    return false;
+}
+
+void configWatchClose(ConfigWatch* w)
+{
+    w->fd = -1;
+}
+#endif
+
+// Main loop side of a reload: if the file was saved, parse it and
+// publish the simulation values. True if *cfg changed, so the caller
+// resizes what it owns (window, particle pool).
+bool configReload(ConfigWatch* w, Config* cfg)
+{
+    if (!configWatchChanged(w)) return false;
+    Uint64 start = SDL_GetPerformanceCounter();
+    Config next;
+    if (!configLoad(w->path, &next)) {
+        printf("config: %s not applied, the previous values stay\n", w->path);
+        return false;
+    }
+    double us = 1e6 * (double)(SDL_GetPerformanceCounter() - start) /
+                (double)SDL_GetPerformanceFrequency();
+    if (memcmp(&next, cfg, sizeof(next)) == 0) return false;
+    *cfg = next;
+    configPublish(&cfg->sim);
+    printf("config: reloaded %s (read and parsed in %.1f us)\n", w->path, us);
+    return true;
+}
+
+// The window takes the configured size; the playfield stays WINDOW_WIDTH
+// x WINDOW_HEIGHT and the renderer scales it to fit, unless an internal
+// target does its own upscaling. --soft-blit draws it unscaled.
+void configApplyWindow(SDL_Window* window, SDL_Renderer* renderer, const Config* cfg,
+                       bool scaleRenderer)
+{
+    SDL_SetWindowSize(window, cfg->windowWidth, cfg->windowHeight);
+    if (renderer && scaleRenderer) {
+        SDL_RenderSetLogicalSize(renderer, WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+}
+
+// ------------------ Replay Files ----------------------
+// A replay is a sequence of chunks, each an 8-byte {type, size} header
+// followed by its payload, only ever appended to:
+//   HEAD  ReplayHeader: how to rebuild the session (waves, time scale)
+//   KEYF  frame number, state hash, full GameState before that frame
+//   INPT  one run-length coded input per update until the next KEYF
+// A keyframe is written every REPLAY_KEYFRAME_TICKS updates, and at any
+// update where the game's config changed (a --config reload), each
+// followed by the inputs of its interval. A crash loses at most the
+// last unfinished chunk; the reader stops at the first truncated one.
+// Playback maps the file and indexes the chunk headers only, so
+// seeking copies the nearest keyframe at or before the target and
+// re-simulates at most one interval, whatever the file's length.
+#define REPLAY_CHUNK_HEAD 0x44414548u   // "HEAD"
+#define REPLAY_CHUNK_KEYF 0x4659454Bu   // "KEYF"
+#define REPLAY_CHUNK_INPT 0x54504E49u   // "INPT"
+#define REPLAY_VERSION    4
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;      // payload bytes
+} ReplayChunk;
+
+typedef struct {
+    char     magic[8];          // "SIREPLAY"
+    uint32_t version;
+    uint32_t keyframeInterval;
+    uint32_t stateSize;         // sizeof(GameState) of the writer
+    int32_t  timeScale;
+    uint32_t waveSeed;
+    uint8_t  endless;
+    uint8_t  pad[3];
+    char     wavePath[256];     // empty: no wave file
+} ReplayHeader;
+
+typedef struct {
+    uint64_t frame;
+    uint64_t hash;              // stateHashDigest of state
+    GameState state;            // events/waves pointers cleared
+} ReplayKeyframe;
+
+typedef struct {
+    uint8_t  input;             // replayEncodeInput
+    uint8_t  pad;
+    uint16_t count;
+} ReplayRun;
+
+static inline uint8_t replayEncodeInput(const GameInput* in)
+{
+    return (uint8_t)((in->move < 0 ? 1 : in->move > 0 ? 2 : 0) |
+                     (in->fire ? 4 : 0) | (in->restart ? 8 : 0));
+}
+
+static inline void replayDecodeInput(uint8_t code, GameInput* in)
+{
+    in->move    = (code & 3) == 1 ? -1 : (code & 3) == 2 ? 1 : 0;
+    in->fire    = (code & 4) != 0;
+    in->restart = (code & 8) != 0;
+}
+
+// -------- Writing --------
+typedef struct {
+    FILE*     file;
+    uint64_t  frame;            // updates recorded so far
+    uint64_t  keyframes;
+    ReplayRun runs[REPLAY_KEYFRAME_TICKS];
+    int       runCount;
+    SimConfig config;           // as of the last keyframe
+} ReplayWriter;
+
+static void replayWriteChunk(ReplayWriter* w, uint32_t type,
+                             const void* payload, uint32_t size)
+{
+    ReplayChunk chunk = { type, size };
+    fwrite(&chunk, sizeof(chunk), 1, w->file);
+    fwrite(payload, 1, size, w->file);
+    fflush(w->file);            // whole chunks reach the OS; no fsync
+}
+
+static void replayFlushInputs(ReplayWriter* w)
+{
+    if (w->runCount == 0) return;
+    replayWriteChunk(w, REPLAY_CHUNK_INPT, w->runs,
+                     (uint32_t)(w->runCount * sizeof(ReplayRun)));
+    w->runCount = 0;
+}
+
+bool replayWriterOpen(ReplayWriter* w, const char* path, const ReplayHeader* header)
+{
+    memset(w, 0, sizeof(*w));
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        printf("Cannot open replay file %s\n", path);
+        return false;
+    }
+    replayWriteChunk(w, REPLAY_CHUNK_HEAD, header, sizeof(*header));
+    return true;
+}
+
+// Call with the state before updateGame applies `input`.
+void replayRecord(ReplayWriter* w, const GameState* game, const GameInput* input)
+{
+    if (!w || !w->file) return;
+    if (w->frame % REPLAY_KEYFRAME_TICKS == 0 ||
+        memcmp(&game->config, &w->config, sizeof(w->config)) != 0) {
+        static ReplayKeyframe key;   // one at a time; too big for the stack
+        replayFlushInputs(w);
+        key.frame  = w->frame;
+        key.hash   = stateHashDigest(&game->hash);
+        key.state  = *game;
+        key.state.waves  = NULL;
+        key.state.events = NULL;
+        replayWriteChunk(w, REPLAY_CHUNK_KEYF, &key, sizeof(key));
+        w->keyframes++;
+        w->config = game->config;
+    }
+
+    uint8_t code = replayEncodeInput(input);
+    if (w->runCount > 0 && w->runs[w->runCount - 1].input == code) {
+        w->runs[w->runCount - 1].count++;
+    } else {
+        ReplayRun run = { code, 0, 1 };
+        w->runs[w->runCount++] = run;
+    }
+    w->frame++;
+}
+
+void replayWriterClose(ReplayWriter* w)
+{
+    if (!w->file) return;
+    replayFlushInputs(w);
+    long bytes = ftell(w->file);
+    fclose(w->file);
+    w->file = NULL;
+    printf("replay: recorded %llu updates, %llu keyframes, %ld bytes\n",
+           (unsigned long long)w->frame, (unsigned long long)w->keyframes, bytes);
+}
+
+// -------- Reading --------
+typedef struct {
+    uint64_t       frame;
+    const uint8_t* state;       // ReplayKeyframe in the mapping
+    const uint8_t* runs;        // its INPT payload, NULL if none
+    uint32_t       runCount;
+} ReplayIndex;
+
+typedef struct {
+    const uint8_t* base;
+    size_t         size;
+    ReplayHeader   header;
+    ReplayIndex*   index;
+    int            indexCount;
+    uint64_t       frames;      // updates with recorded input
+
+    int            loaded;      // interval decoded into inputs[], -1: none
+    uint8_t        inputs[REPLAY_KEYFRAME_TICKS];
+    int            inputCount;
+} ReplayReader;
+
+void replayClose(ReplayReader* r);
+
+// The entity world of a state from outside: the layout of
+// simEntitiesEmpty (its offsets are followed blindly), the player and
+// every shot slot present, and chunk counts that agree with their
+// archetype's.
+static bool simEntitiesValid(const SimEntities* e)
+{
+    static const int kCounts[SIM_ARCHETYPES - 1] = { 1, MAX_BULLETS, MAX_ENEMY_BULLETS };
+    const EcsWorld* w = &e->world;
+    const EcsWorld* r = &simEntitiesEmpty()->world;
+    if (memcmp(w->componentSize, r->componentSize, sizeof(w->componentSize)) != 0 ||
+        w->componentCount != r->componentCount || w->archetypeCount != r->archetypeCount ||
+        w->pool != r->pool || w->poolBytes != r->poolBytes || w->poolUsed != r->poolUsed) {
+        return false;
+    }
+    for (int k = 0; k < r->archetypeCount; k++) {
+        const EcsArchetype* a  = &w->archetypes[k];
+        const EcsArchetype* ra = &r->archetypes[k];
+        if (a->mask != ra->mask || a->chunkCapacity != ra->chunkCapacity ||
+            a->chunkCount != ra->chunkCount || a->chunkBytes != ra->chunkBytes ||
+            a->firstChunk != ra->firstChunk || (k < SIM_ALIENS && a->count != kCounts[k]) ||
+            a->count < 0 || a->count > a->chunkCount * a->chunkCapacity) {
+            return false;
+        }
+        for (int n = 0; n < a->chunkCount; n++) {
+            const EcsChunk* c    = ecsChunkAt(w, k, n);
+            const EcsChunk* rc   = ecsChunkAt(r, k, n);
+            int             left = a->count - n * a->chunkCapacity;
+            if (c->capacity != rc->capacity ||
+                memcmp(c->columns, rc->columns, sizeof(c->columns)) != 0 ||
+                c->count != (left <= 0 ? 0 : left < c->capacity ? left : c->capacity)) {
+                return false;
+            }
+        }
+    }
+    return entityColumns(ecsChunkAt(w, SIM_PLAYER, 0), 0).active[0];
+}
+
+// A whole GameState from outside the process (replay keyframes, snapshot
+// deltas, spectator keyframes) is only used if it passes this: the entity
+// world has the layout of ours, the formation's shape, the live aliens and
+// the shooter index agree with each other, and the config and script are
+// in range. The simulation indexes arrays with all of these.
+bool gameStateValid(const GameState* game)
+{
+    const WaveDef* w = &game->wave;
+    if (!simEntitiesValid(&game->entities) ||
+        w->rows < 1 || w->rows > MAX_ALIENS || w->cols < 1 || w->cols > MAX_ALIENS ||
+        w->rows * w->cols > MAX_ALIENS || alienCount(game) != w->rows * w->cols) {
+        return false;
+    }
+    // Every slot of the chunks, past the count too: none of those is live.
+    const EcsArchetype* aliens = &game->entities.world.archetypes[SIM_ALIENS];
+    int alive = 0;
+    for (int n = 0; n < aliens->chunkCount; n++) {
+        EntityColumns a = entityColumns(ecsChunkAt(&game->entities.world, SIM_ALIENS, n),
+                                        n * aliens->chunkCapacity);
+        for (int i = 0; i < aliens->chunkCapacity; i++) {
+            if (a.active[i] && a.base + i >= alienCount(game)) return false;
+            alive += a.active[i];
+        }
+    }
+    if (game->aliveCount != alive) return false;
+
+    // colBottom: a live alien in its own column, or < 0; shooterCols lists
+    // exactly the columns that have one, and shooterSlot inverts it.
+    int shooters = 0;
+    for (int c = 0; c < w->cols; c++) {
+        int i = game->colBottom[c];
+        if (i >= alienCount(game)) return false;
+        if (i >= 0 && (i % w->cols != c || !alienAlive(game, i))) return false;
+        shooters += i >= 0;
+    }
+    if (game->shooterCount != shooters) return false;
+    for (int s = 0; s < game->shooterCount; s++) {
+        int c = game->shooterCols[s];
+        if (c < 0 || c >= w->cols || game->colBottom[c] < 0 || game->shooterSlot[c] != s) {
+            return false;
+        }
+    }
+    return configValid(&game->config) && scriptValid(&w->script);
+}
+
+#if !defined(_WIN32)
+bool replayOpen(ReplayReader* r, const char* path)
+{
+    memset(r, 0, sizeof(*r));
+    r->loaded = -1;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ReplayChunk)) {
+        printf("Cannot open replay %s\n", path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Cannot map replay %s\n", path);
+        return false;
+    }
+    r->base = map;
+    r->size = (size_t)st.st_size;
+
+    // Walk chunk headers; payloads are only touched when used.
+    size_t at = 0;
+    int    cap = 0;
+    int    rejected = 0;
+    bool   haveHeader = false;
+    bool   skipInputs = false;  // they belong to a rejected keyframe
+    while (at + sizeof(ReplayChunk) <= r->size) {
+        ReplayChunk chunk;
+        memcpy(&chunk, r->base + at, sizeof(chunk));
+        const uint8_t* payload = r->base + at + sizeof(chunk);
+        if (chunk.size > r->size - at - sizeof(chunk)) break;   // torn tail
+        at += sizeof(chunk) + chunk.size;
+
+        if (chunk.type == REPLAY_CHUNK_HEAD && chunk.size == sizeof(ReplayHeader)) {
+            memcpy(&r->header, payload, sizeof(r->header));
+            haveHeader = memcmp(r->header.magic, "SIREPLAY", 8) == 0 &&
+                         r->header.version == REPLAY_VERSION &&
+                         r->header.stateSize == sizeof(GameState);
+        } else if (chunk.type == REPLAY_CHUNK_KEYF && chunk.size == sizeof(ReplayKeyframe)) {
+            GameState state;
+            memcpy(&state, payload + offsetof(ReplayKeyframe, state), sizeof(state));
+            skipInputs = !gameStateValid(&state);
+            if (skipInputs) {
+                rejected++;
+                continue;
+            }
+            if (r->indexCount == cap) {
+                cap = cap ? cap * 2 : 64;
+                ReplayIndex* grown = realloc(r->index, (size_t)cap * sizeof(*grown));
+                if (!grown) break;
+                r->index = grown;
+            }
+            ReplayIndex* k = &r->index[r->indexCount++];
+            memcpy(&k->frame, payload, sizeof(k->frame));
+            k->state    = payload;
+            k->runs     = NULL;
+            k->runCount = 0;
+            r->frames   = k->frame;
+        } else if (chunk.type == REPLAY_CHUNK_INPT && r->indexCount > 0 && !skipInputs) {
+            ReplayIndex* k = &r->index[r->indexCount - 1];
+            k->runs     = payload;
+            k->runCount = chunk.size / sizeof(ReplayRun);
+            for (uint32_t i = 0; i < k->runCount; i++) {
+                ReplayRun run;
+                memcpy(&run, payload + i * sizeof(run), sizeof(run));
+                r->frames += run.count;
+            }
+        }
+    }
+    if (!haveHeader || r->indexCount == 0) {
+        printf("Replay %s is not usable (wrong version or build, or empty)\n", path);
+        replayClose(r);
+        return false;
+    }
+    if (rejected > 0) {
+        printf("Replay %s: %d keyframes are corrupt, skipped (playback stops at the "
+               "first gap)\n", path, rejected);
+    }
+    return true;
+}
+
+void replayClose(ReplayReader* r)
+{
+    if (r->base) munmap((void*)r->base, r->size);
+    free(r->index);
+    memset(r, 0, sizeof(*r));
+}
+#else
+bool replayOpen(ReplayReader* r, const char* path)
+{
+    memset(r, 0, sizeof(*r));
+    printf("Replay playback needs mmap; not supported on this platform (%s)\n", path);
+    return false;
+}
+
+void replayClose(ReplayReader* r)
+{
+    memset(r, 0, sizeof(*r));
+}
+#endif
+
+// Keyframe covering `frame` (index entries are in frame order).
+static int replayFindKeyframe(const ReplayReader* r, uint64_t frame)
+{
+    int lo = 0, hi = r->indexCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (r->index[mid].frame <= frame) lo = mid; else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Input of update `frame`; false past the end of the recording.
+bool replayInput(ReplayReader* r, uint64_t frame, GameInput* out)
+{
+    if (frame >= r->frames) return false;
+    int k = replayFindKeyframe(r, frame);
+    if (k != r->loaded) {
+        const ReplayIndex* key = &r->index[k];
+        r->inputCount = 0;
+        for (uint32_t i = 0; i < key->runCount; i++) {
+            ReplayRun run;
+            memcpy(&run, key->runs + i * sizeof(run), sizeof(run));
+            for (int n = 0; n < run.count && r->inputCount < REPLAY_KEYFRAME_TICKS; n++) {
+                r->inputs[r->inputCount++] = run.input;
+            }
+        }
+        r->loaded = k;
+    }
+    uint64_t offset = frame - r->index[k].frame;
+    if (offset >= (uint64_t)r->inputCount) return false;
+    replayDecodeInput(r->inputs[offset], out);
+    return true;
+}
+
+// Keyframe hash check for playback; true if `game` matches (or `frame`
+// has no keyframe).
+bool replayVerify(const ReplayReader* r, uint64_t frame, const GameState* game)
+{
+    int k = replayFindKeyframe(r, frame);
+    if (r->index[k].frame != frame) return true;
+    uint64_t hash;
+    memcpy(&hash, r->index[k].state + offsetof(ReplayKeyframe, hash), sizeof(hash));
+    return hash == stateHashDigest(&game->hash);
+}
+
+// Playback side of a config change: at a keyframe, take the recorded
+// config, which may differ from the last one (see replayRecord).
+void replayConfig(const ReplayReader* r, uint64_t frame, GameState* game)
+{
+    int k = replayFindKeyframe(r, frame);
+    if (r->index[k].frame != frame) return;
+    memcpy(&game->config, r->index[k].state + offsetof(ReplayKeyframe, state) +
+           offsetof(GameState, config), sizeof(game->config));
+}
+
+// Puts `game` at the start of update `frame`: copy the nearest earlier
+// keyframe, rebuild the current wave's reset template, then re-simulate
+// the remaining updates from the recorded inputs.
+void replaySeek(ReplayReader* r, GameState* game, uint64_t frame)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (frame > r->frames) frame = r->frames;
+    int k = replayFindKeyframe(r, frame);
+
+    WaveSource* waves  = game->waves;
+    GameEvents* events = game->events;
+    memcpy(game, r->index[k].state + offsetof(ReplayKeyframe, state), sizeof(*game));
+    game->waves  = waves;
+    game->events = events;
+
+    ResetTemplates* templates = resetTemplates(game);
+    templates->current = &templates->gameStart;
+    WaveDef wave;
+    if (game->waveIndex > 0 && waves &&
+        waveSourceGet(waves, game->waveIndex, &wave)) {
+        buildWaveTemplate(&templates->waveStart, &wave, game->waveIndex);
+        templates->current = &templates->waveStart;
+    }
+
+    GameInput input;
+    for (uint64_t f = r->index[k].frame; f < frame && replayInput(r, f, &input); f++) {
+        updateGame(game, &input);
+    }
+    printf("replay: seek to update %llu of %llu in %.3f ms (%llu re-simulated)\n",
+           (unsigned long long)frame, (unsigned long long)r->frames,
+           1000.0 * (double)(SDL_GetPerformanceCounter() - start) /
+           (double)SDL_GetPerformanceFrequency(),
+           (unsigned long long)(frame - r->index[k].frame));
+}
+
+// What a run records to and/or plays back from.
+typedef struct {
+    ReplayWriter* recorder;     // NULL: not recording
+    ReplayReader* player;       // NULL: live input
+    uint64_t      seek;         // update to start playback at
+} ReplaySession;
+
+// ------------------ Snapshot Codec --------------------
+// Encodes a GameState as a delta against a baseline the decoder already
+// has (the previous update, a keyframe, a save's starting point). The
+// stream is a varint section mask followed by the sections it names, in
+// this order:
+//   GLOBALS        varint field mask: zigzag deltas of the int globals,
+//                  gameOver toggle, rng XOR, tick delta
+//   WAVE           field mask byte and deltas of the WaveDef
+//   SCRIPT         the wave's alien script, whole (only when it changed)
+//   CONFIG         varint field mask: zigzag deltas of the SimConfig ints
+//   PLAYER         field mask byte, then one zigzag varint per changed field
+//   BULLETS/ENEMY  bitmask of changed bullets; per bullet a field mask
+//                  (x, y, w, h, fx, fy, bit 6: active toggled) and the deltas
+//   SHIFT          formation move (dx, dy) in 16.16, predicted for every
+//                  alien alive in the baseline
+//   LIVENESS       bitmask of aliens whose active flag toggled
+//   ALIENS         bitmask of aliens that differ from the prediction,
+//                  then a field mask and deltas per alien
+//   SHIELDS        sparse (index gap, XOR) list of changed rows
+//   SHOOTERS       sparse (index gap, delta) lists for the column index
+// Alien bitmasks cover the larger of the two alien counts. Unchanged
+// entities cost nothing and a march step is 5 bytes, so a classic-wave
+// update comes to a few tens of bytes.
+// The state hash isn't sent: the decoder moves it term by term like
+// updateGame does, and recomputes it when the formation was replaced.
+// Neither side allocates. The encoder needs SNAPSHOT_MAX_BYTES of room.
+enum { SNAP_GLOBALS = 1 << 0, SNAP_WAVE = 1 << 1, SNAP_PLAYER = 1 << 2,
+       SNAP_BULLETS = 1 << 3, SNAP_ENEMY_BULLETS = 1 << 4, SNAP_SHIFT = 1 << 5,
+       SNAP_LIVENESS = 1 << 6, SNAP_ALIENS = 1 << 7, SNAP_SHIELDS = 1 << 8,
+       SNAP_SHOOTERS = 1 << 9, SNAP_SCRIPT = 1 << 10, SNAP_CONFIG = 1 << 11 };
+
+// Plain int globals, in field-mask bit order.
+static const size_t kSnapGlobalInts[] = {
+    offsetof(GameState, entities.world.archetypes[SIM_ALIENS].count),
+    offsetof(GameState, aliveCount),
+    offsetof(GameState, shooterCount),   offsetof(GameState, enemyFireTimer),
+    offsetof(GameState, timeScale),      offsetof(GameState, waveIndex),
+    offsetof(GameState, lives),          offsetof(GameState, score),
+    offsetof(GameState, alienMoveDir),   offsetof(GameState, marchTimer),
+    offsetof(GameState, marchNote),
+};
+#define SNAP_GLOBAL_INTS ((int)(sizeof(kSnapGlobalInts) / sizeof(kSnapGlobalInts[0])))
+#define SNAP_GAMEOVER    (1u << SNAP_GLOBAL_INTS)
+#define SNAP_RNG         (1u << (SNAP_GLOBAL_INTS + 1))
+#define SNAP_TICK        (1u << (SNAP_GLOBAL_INTS + 2))
+#define SNAP_ACTIVE_BIT  0x40       // in a bullet's or alien's field mask
+
+static inline uint8_t* snapPutVarint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline int snapGlobalInt(const GameState* game, int k)
+{
+    int v;
+    memcpy(&v, (const uint8_t*)game + kSnapGlobalInts[k], sizeof(v));
+    return v;
+}
+
+static inline void snapSetGlobalInt(GameState* game, int k, int v)
+{
+    memcpy((uint8_t*)game + kSnapGlobalInts[k], &v, sizeof(v));
+}
+
+// x, y, w, h, fx, fy of row i of an EntityColumns
+#define SNAP_BOX_INTS 6
+#define snapBoxInts(c, i, v) \
+    ((v)[0] = (c)->x[i], (v)[1] = (c)->y[i], (v)[2] = (c)->w[i], (v)[3] = (c)->h[i], \
+     (v)[4] = (c)->fx[i], (v)[5] = (c)->fy[i])
+#define snapSetBox(c, i, v) \
+    ((c)->x[i] = (v)[0], (c)->y[i] = (v)[1], (c)->w[i] = (v)[2], (c)->h[i] = (v)[3], \
+     (c)->fx[i] = (uint16_t)(v)[4], (c)->fy[i] = (uint16_t)(v)[5])
+
+// -------- Encoding --------
+// Field mask plus zigzag deltas for up to 8 ints; writes nothing if no
+// field changed and no extra bit is set.
+static uint8_t* snapPutInts(uint8_t* out, const int* cur, const int* pred, int n,
+                            uint8_t extraBits)
+{
+    uint8_t mask = extraBits;
+    for (int k = 0; k < n; k++) {
+        if (cur[k] != pred[k]) mask |= (uint8_t)(1 << k);
+    }
+    if (!mask) return out;
+    *out++ = mask;
+    for (int k = 0; k < n; k++) {
+        if (mask & (1 << k)) out = snapPutVarint(out, zigzag((int64_t)cur[k] - pred[k]));
+    }
+    return out;
+}
+
+// Changed-bullet bitmask (at most 8 slots) and the changed bullets
+// tagged `tag`; writes nothing if none changed.
+static uint8_t* snapPutBullets(uint8_t* out, const GameState* cur, const GameState* base,
+                               int tag)
+{
+    uint8_t*  maskAt = out++;
+    uint8_t   mask   = 0;
+    EcsQuery  q = ecsQuery(&cur->entities.world, ECS_BIT(tag));
+    EcsChunk* chunk;
+    while ((chunk = ecsNext(&q))) {
+        EntityColumns cs = entityColumns(chunk, q.base);
+        EntityColumns bs = entityColumns(ecsPeer(&base->entities.world, &q), q.base);
+        for (int i = 0; i < cs.count; i++) {
+            int c[SNAP_BOX_INTS], b[SNAP_BOX_INTS];
+            snapBoxInts(&cs, i, c);
+            snapBoxInts(&bs, i, b);
+            uint8_t* before = out;
+            out = snapPutInts(out, c, b, SNAP_BOX_INTS,
+                              cs.active[i] != bs.active[i] ? SNAP_ACTIVE_BIT : 0);
+            if (out != before) mask |= (uint8_t)(1 << (cs.base + i));
+        }
+    }
+    *maskAt = mask;
+    return mask ? out : maskAt;
+}
+
+// Sparse list of changed int16s: count, then (index gap, zigzag delta).
+static uint8_t* snapPutSparse16(uint8_t* out, const int16_t* cur, const int16_t* base,
+                                int count)
+{
+    int changed = 0;
+    for (int i = 0; i < count; i++) changed += cur[i] != base[i];
+    out = snapPutVarint(out, (uint64_t)changed);
+    for (int i = 0, last = 0; i < count && changed; i++) {
+        if (cur[i] == base[i]) continue;
+        out = snapPutVarint(out, (uint64_t)(i - last));
+        out = snapPutVarint(out, zigzag((int64_t)cur[i] - base[i]));
+        last = i;
+        changed--;
+    }
+    return out;
+}
+
+// Writes `cur` relative to `base` into `out` (SNAPSHOT_MAX_BYTES of
+// room) and returns the byte count.
+size_t snapshotEncode(const GameState* base, const GameState* cur, uint8_t* out)
+{
+    uint8_t* p    = out + 2;        // section mask goes in front at the end
+    uint32_t mask = 0;
+    uint8_t* before;
+
+    // Globals
+    uint32_t g = 0;
+    for (int k = 0; k < SNAP_GLOBAL_INTS; k++) {
+        if (snapGlobalInt(cur, k) != snapGlobalInt(base, k)) g |= 1u << k;
+    }
+    if (cur->gameOver != base->gameOver) g |= SNAP_GAMEOVER;
+    if (cur->rng != base->rng)           g |= SNAP_RNG;
+    if (cur->tick != base->tick)         g |= SNAP_TICK;
+    if (g) {
+        mask |= SNAP_GLOBALS;
+        p = snapPutVarint(p, g);
+        for (int k = 0; k < SNAP_GLOBAL_INTS; k++) {
+            if (g & (1u << k)) {
+                p = snapPutVarint(p, zigzag((int64_t)snapGlobalInt(cur, k) - snapGlobalInt(base, k)));
+            }
+        }
+        if (g & SNAP_RNG)  p = snapPutVarint(p, cur->rng ^ base->rng);
+        if (g & SNAP_TICK) p = snapPutVarint(p, zigzag((int64_t)(cur->tick - base->tick)));
+    }
+
+    // Wave definition
+    const WaveDef* cw = &cur->wave;
+    const WaveDef* bw = &base->wave;
+    int cwv[8] = { cw->rows, cw->cols, cw->startX, cw->startY,
+                   cw->spacingX, cw->spacingY, cw->speed, cw->descent };
+    int bwv[8] = { bw->rows, bw->cols, bw->startX, bw->startY,
+                   bw->spacingX, bw->spacingY, bw->speed, bw->descent };
+    before = p;
+    p = snapPutInts(p, cwv, bwv, 8, 0);
+    if (p != before) mask |= SNAP_WAVE;
+    if (memcmp(&cw->script, &bw->script, sizeof(cw->script)) != 0) {
+        mask |= SNAP_SCRIPT;
+        memcpy(p, &cw->script, sizeof(cw->script));
+        p += sizeof(cw->script);
+    }
+
+    // Config (changes only on a reload)
+    if (memcmp(&cur->config, &base->config, sizeof(cur->config)) != 0) {
+        int cc[SIM_CONFIG_INTS], bc[SIM_CONFIG_INTS];
+        memcpy(cc, &cur->config, sizeof(cc));
+        memcpy(bc, &base->config, sizeof(bc));
+        uint32_t c = 0;
+        for (int k = 0; k < SIM_CONFIG_INTS; k++) {
+            if (cc[k] != bc[k]) c |= 1u << k;
+        }
+        mask |= SNAP_CONFIG;
+        p = snapPutVarint(p, c);
+        for (int k = 0; k < SIM_CONFIG_INTS; k++) {
+            if (c & (1u << k)) p = snapPutVarint(p, zigzag((int64_t)cc[k] - bc[k]));
+        }
+    }
+
+    // Player and bullets
+    EntityColumns cp = playerColumns(cur), bp = playerColumns(base);
+    int cpv[7] = { cp.x[0], cp.y[0], cp.w[0], cp.h[0], cp.vx[0], cp.fx[0], cp.fy[0] };
+    int bpv[7] = { bp.x[0], bp.y[0], bp.w[0], bp.h[0], bp.vx[0], bp.fx[0], bp.fy[0] };
+    before = p;
+    p = snapPutInts(p, cpv, bpv, 7, 0);
+    if (p != before) mask |= SNAP_PLAYER;
+
+    before = p;
+    p = snapPutBullets(p, cur, base, EC_SHOT);
+    if (p != before) mask |= SNAP_BULLETS;
+    before = p;
+    p = snapPutBullets(p, cur, base, EC_ENEMY_SHOT);
+    if (p != before) mask |= SNAP_ENEMY_BULLETS;
+
+    // Aliens: formation shift, liveness, then whatever the shift missed.
+    // The shift comes from the first alien alive on both sides.
+    fixed     dx = 0, dy = 0;
+    bool      found = alienCount(cur) != alienCount(base);
+    EcsQuery  q = ecsQuery(&cur->entities.world, ECS_BIT(EC_ALIEN));
+    EcsChunk* chunk;
+    while (!found && (chunk = ecsNext(&q))) {
+        EntityColumns ca = entityColumns(chunk, q.base);
+        EntityColumns ba = entityColumns(ecsPeer(&base->entities.world, &q), q.base);
+        for (int i = 0; i < ca.count && !found; i++) {
+            if (ba.active[i] && ca.active[i]) {
+                dx    = fixJoin(ca.x[i], ca.fx[i]) - fixJoin(ba.x[i], ba.fx[i]);
+                dy    = fixJoin(ca.y[i], ca.fy[i]) - fixJoin(ba.y[i], ba.fy[i]);
+                found = true;
+            }
+        }
+    }
+    if (dx || dy) {
+        mask |= SNAP_SHIFT;
+        p = snapPutVarint(p, zigzag(dx));
+        p = snapPutVarint(p, zigzag(dy));
+    }
+    // The bitmasks cover the larger formation, so walk that one's chunks
+    // and the other state's in step.
+    const GameState* wide = alienCount(cur) >= alienCount(base) ? cur : base;
+    const GameState* narrow = wide == cur ? base : cur;
+    int     n         = alienCount(wide);
+    int     maskBytes = (n + 7) / 8;
+    uint8_t live[MAX_ALIENS / 8]  = { 0 };
+    uint8_t moved[MAX_ALIENS / 8] = { 0 };
+    uint8_t fields[MAX_ALIENS * 31];        // mask + 6 varints of <= 5 bytes
+    uint8_t* f = fields;
+    bool anyLive = false;
+    q = ecsQuery(&wide->entities.world, ECS_BIT(EC_ALIEN));
+    while ((chunk = ecsNext(&q))) {
+        EntityColumns w  = entityColumns(chunk, q.base);
+        EntityColumns o  = entityColumns(ecsPeer(&narrow->entities.world, &q), q.base);
+        EntityColumns ca = wide == cur ? w : o;
+        EntityColumns ba = wide == cur ? o : w;
+        for (int k = 0; k < w.count; k++) {
+            int i = w.base + k;
+            if (ca.active[k] != ba.active[k]) {
+                live[i >> 3] |= (uint8_t)(1 << (i & 7));
+                anyLive = true;
+            }
+            int c[SNAP_BOX_INTS], pr[SNAP_BOX_INTS];
+            snapBoxInts(&ca, k, c);
+            snapBoxInts(&ba, k, pr);
+            if (ba.active[k]) {   // predicted: the base alien moved by the shift
+                uint16_t fx = ba.fx[k], fy = ba.fy[k];
+                fixMove(&pr[0], &fx, dx);
+                fixMove(&pr[1], &fy, dy);
+                pr[4] = fx;
+                pr[5] = fy;
+            }
+            uint8_t* at = f;
+            f = snapPutInts(f, c, pr, SNAP_BOX_INTS, 0);
+            if (f != at) moved[i >> 3] |= (uint8_t)(1 << (i & 7));
+        }
+    }
+    if (anyLive) {
+        mask |= SNAP_LIVENESS;
+        memcpy(p, live, (size_t)maskBytes);
+        p += maskBytes;
+    }
+    if (f != fields) {
+        mask |= SNAP_ALIENS;
+        memcpy(p, moved, (size_t)maskBytes);
+        p += maskBytes;
+        memcpy(p, fields, (size_t)(f - fields));
+        p += f - fields;
+    }
+
+    // Shields: sparse XOR of changed rows (most ticks touch no shield)
+    int rows = 0;
+    bool hit[SHIELD_COUNT];
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        hit[s] = memcmp(cur->shields[s].rows, base->shields[s].rows,
+                        sizeof(cur->shields[s].rows)) != 0;
+        for (int r = 0; hit[s] && r < SHIELD_HEIGHT; r++) {
+            rows += cur->shields[s].rows[r] != base->shields[s].rows[r];
+        }
+    }
+    if (rows) {
+        mask |= SNAP_SHIELDS;
+        p = snapPutVarint(p, (uint64_t)rows);
+        int last = 0;
+        for (int s = 0; s < SHIELD_COUNT; s++) {
+            for (int r = 0; hit[s] && r < SHIELD_HEIGHT; r++) {
+                uint64_t x = cur->shields[s].rows[r] ^ base->shields[s].rows[r];
+                if (!x) continue;
+                p = snapPutVarint(p, (uint64_t)(s * SHIELD_HEIGHT + r - last));
+                p = snapPutVarint(p, x);
+                last = s * SHIELD_HEIGHT + r;
+            }
+        }
+    }
+
+    // Column index (changes only on kills and resets)
+    if (memcmp(cur->colBottom, base->colBottom, sizeof(cur->colBottom)) != 0 ||
+        memcmp(cur->shooterCols, base->shooterCols, sizeof(cur->shooterCols)) != 0 ||
+        memcmp(cur->shooterSlot, base->shooterSlot, sizeof(cur->shooterSlot)) != 0) {
+        mask |= SNAP_SHOOTERS;
+        p = snapPutSparse16(p, cur->colBottom, base->colBottom, MAX_ALIENS);
+        p = snapPutSparse16(p, cur->shooterCols, base->shooterCols, MAX_ALIENS);
+        p = snapPutSparse16(p, cur->shooterSlot, base->shooterSlot, MAX_ALIENS);
+    }
+
+    // Section mask: one varint byte in the common case
+    if (mask < 0x80) {
+        out[1] = (uint8_t)mask;
+        memmove(out, out + 1, (size_t)(p - out - 1));
+        return (size_t)(p - out - 1);
+    }
+    out[0] = (uint8_t)(mask | 0x80);
+    out[1] = (uint8_t)(mask >> 7);
+    return (size_t)(p - out);
+}
+
+// -------- Decoding --------
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool           ok;      // false once anything ran past the end
+} SnapReader;
+
+static inline uint64_t snapGetVarint(SnapReader* r)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        uint8_t b = *r->p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    r->ok = false;
+    return 0;
+}
+
+static inline uint8_t snapGetByte(SnapReader* r)
+{
+    if (r->p >= r->end) {
+        r->ok = false;
+        return 0;
+    }
+    return *r->p++;
+}
+
+// Reads a field mask and applies its deltas to v[0..n); returns the mask.
+static uint8_t snapGetInts(SnapReader* r, int* v, int n)
+{
+    uint8_t mask = snapGetByte(r);
+    for (int k = 0; k < n; k++) {
+        if (mask & (1 << k)) v[k] += (int)unzigzag(snapGetVarint(r));
+    }
+    return mask;
+}
+
+static void snapGetBullets(SnapReader* r, GameState* out, int tag, StateHash* h)
+{
+    uint8_t   mask = snapGetByte(r);
+    EcsQuery  q = ecsQuery(&out->entities.world, ECS_BIT(tag));
+    EcsChunk* chunk;
+    while ((chunk = ecsNext(&q)) && r->ok) {
+        EntityColumns b    = entityColumns(chunk, q.base);
+        uint32_t      kind = kSimHashKind[q.archetype];
+        for (int i = 0; i < b.count && r->ok; i++) {
+            if (!(mask & (1 << (b.base + i)))) continue;
+            h->sum -= entityTerm(kind, &b, i);
+            int v[SNAP_BOX_INTS];
+            snapBoxInts(&b, i, v);
+            uint8_t fieldMask = snapGetInts(r, v, SNAP_BOX_INTS);
+            snapSetBox(&b, i, v);
+            if (fieldMask & SNAP_ACTIVE_BIT) b.active[i] = !b.active[i];
+            h->sum += entityTerm(kind, &b, i);
+        }
+    }
+}
+
+static void snapGetSparse16(SnapReader* r, int16_t* v, int count)
+{
+    uint64_t changed = snapGetVarint(r);
+    uint64_t at = 0;
+    for (uint64_t k = 0; k < changed && r->ok; k++) {
+        at += snapGetVarint(r);
+        int64_t delta = unzigzag(snapGetVarint(r));
+        if (at >= (uint64_t)count) {
+            r->ok = false;
+            return;
+        }
+        v[at] = (int16_t)(v[at] + delta);
+    }
+}
+
+// Rebuilds into `out` the state snapshotEncode(base, ...) described;
+// `out` may be `base` itself. Pointers (waves, events) are left as they
+// were in `out`. False on a malformed stream, or one that decodes to a
+// state failing gameStateValid (a formation of 0 columns, an alien count
+// that isn't rows x cols, a shooter index out of range), which the next
+// update would index with.
+bool snapshotDecode(const GameState* base, const uint8_t* in, size_t size, GameState* out)
+{
+    WaveSource* waves  = out->waves;
+    GameEvents* events = out->events;
+    if (out != base) memcpy(out, base, sizeof(*out));
+    out->waves  = waves;
+    out->events = events;
+
+    SnapReader r = { in, in + size, true };
+    StateHash* h = &out->hash;
+    uint64_t   globalsBefore = globalsTerm(out);
+    int        baseCount     = alienCount(out);
+    uint32_t   mask          = (uint32_t)snapGetVarint(&r);
+
+    if (mask & SNAP_GLOBALS) {
+        uint32_t g = (uint32_t)snapGetVarint(&r);
+        for (int k = 0; k < SNAP_GLOBAL_INTS; k++) {
+            if (g & (1u << k)) {
+                snapSetGlobalInt(out, k, snapGlobalInt(out, k) + (int)unzigzag(snapGetVarint(&r)));
+            }
+        }
+        if (g & SNAP_GAMEOVER) out->gameOver = !out->gameOver;
+        if (g & SNAP_RNG)      out->rng ^= (uint32_t)snapGetVarint(&r);
+        if (g & SNAP_TICK)     out->tick += (uint64_t)unzigzag(snapGetVarint(&r));
+    }
+    int count = alienCount(out);
+    if (!ecsResize(&out->entities.world, SIM_ALIENS, count)) return false;
+    if (mask & SNAP_WAVE) {
+        WaveDef* w = &out->wave;
+        int v[8] = { w->rows, w->cols, w->startX, w->startY,
+                     w->spacingX, w->spacingY, w->speed, w->descent };
+        snapGetInts(&r, v, 8);
+        w->rows = v[0]; w->cols = v[1]; w->startX = v[2]; w->startY = v[3];
+        w->spacingX = v[4]; w->spacingY = v[5]; w->speed = v[6]; w->descent = v[7];
+    }
+    if (mask & SNAP_SCRIPT) {
+        AlienScript* script = &out->wave.script;
+        if ((size_t)(r.end - r.p) < sizeof(*script)) return false;
+        memcpy(script, r.p, sizeof(*script));
+        r.p += sizeof(*script);
+        if (!scriptValid(script)) return false;
+    }
+    if (mask & SNAP_CONFIG) {
+        int      v[SIM_CONFIG_INTS];
+        uint32_t c = (uint32_t)snapGetVarint(&r);
+        memcpy(v, &out->config, sizeof(v));
+        for (int k = 0; k < SIM_CONFIG_INTS; k++) {
+            if (c & (1u << k)) v[k] += (int)unzigzag(snapGetVarint(&r));
+        }
+        memcpy(&out->config, v, sizeof(v));
+        if (!configValid(&out->config)) return false;
+    }
+    if (mask & SNAP_PLAYER) {
+        EntityColumns pl = playerColumns(out);
+        int v[7] = { pl.x[0], pl.y[0], pl.w[0], pl.h[0], pl.vx[0], pl.fx[0], pl.fy[0] };
+        h->sum -= entityTerm(HASH_PLAYER, &pl, 0);
+        snapGetInts(&r, v, 7);
+        pl.x[0] = v[0]; pl.y[0] = v[1]; pl.w[0] = v[2]; pl.h[0] = v[3]; pl.vx[0] = v[4];
+        pl.fx[0] = (uint16_t)v[5]; pl.fy[0] = (uint16_t)v[6];
+        h->sum += entityTerm(HASH_PLAYER, &pl, 0);
+    }
+    if (mask & SNAP_BULLETS) {
+        snapGetBullets(&r, out, EC_SHOT, h);
+    }
+    if (mask & SNAP_ENEMY_BULLETS) {
+        snapGetBullets(&r, out, EC_ENEMY_SHOT, h);
+    }
+
+    // Aliens. The section covers the larger of the two formations, so the
+    // archetype holds that many while it is read, then the decoded count.
+    int n = count > baseCount ? count : baseCount;
+    int maskBytes = (n + 7) / 8;
+    ecsResize(&out->entities.world, SIM_ALIENS, n);
+    fixed dx = 0, dy = 0;
+    if (mask & SNAP_SHIFT) {
+        dx = (fixed)unzigzag(snapGetVarint(&r));
+        dy = (fixed)unzigzag(snapGetVarint(&r));
+        hashAlienShift(h, dx, dy);
+    }
+    const uint8_t* live  = NULL;
+    const uint8_t* moved = NULL;
+    if ((mask & SNAP_LIVENESS) && (size_t)(r.end - r.p) >= (size_t)maskBytes) {
+        live = r.p;
+        r.p += maskBytes;
+    } else if (mask & SNAP_LIVENESS) {
+        r.ok = false;
+    }
+    if ((mask & SNAP_ALIENS) && (size_t)(r.end - r.p) >= (size_t)maskBytes) {
+        moved = r.p;
+        r.p += maskBytes;
+    } else if (mask & SNAP_ALIENS) {
+        r.ok = false;
+    }
+    EcsQuery  q = ecsQuery(&out->entities.world, ECS_BIT(EC_ALIEN));
+    EcsChunk* chunk;
+    while ((chunk = ecsNext(&q)) && r.ok) {
+        EntityColumns a = entityColumns(chunk, q.base);
+        for (int k = 0; k < a.count && (dx || dy); k++) {
+            if (!a.active[k]) continue;
+            fixMove(&a.x[k], &a.fx[k], dx);
+            fixMove(&a.y[k], &a.fy[k], dy);
+        }
+        for (int k = 0; (live || moved) && k < a.count && r.ok; k++) {
+            int  i      = a.base + k;
+            bool toggle = live  && (live[i >> 3]  >> (i & 7) & 1);
+            bool fields = moved && (moved[i >> 3] >> (i & 7) & 1);
+            if (!toggle && !fields) continue;
+            if (a.active[k]) hashAlienKill(h, &a, k);
+            if (toggle) a.active[k] = !a.active[k];
+            if (fields) {
+                int v[SNAP_BOX_INTS];
+                snapBoxInts(&a, k, v);
+                snapGetInts(&r, v, SNAP_BOX_INTS);
+                snapSetBox(&a, k, v);
+            }
+            if (a.active[k]) hashAlienAdd(h, &a, k);
+        }
+    }
+    ecsResize(&out->entities.world, SIM_ALIENS, count);
+
+    if (mask & SNAP_SHIELDS) {
+        uint64_t rows = snapGetVarint(&r);
+        uint64_t at   = 0;
+        for (uint64_t k = 0; k < rows && r.ok; k++) {
+            at += snapGetVarint(&r);
+            uint64_t x = snapGetVarint(&r);
+            if (at >= SHIELD_COUNT * SHIELD_HEIGHT) return false;
+            int s = (int)at / SHIELD_HEIGHT, row = (int)at % SHIELD_HEIGHT;
+            uint64_t* bits = &out->shields[s].rows[row];
+            h->sum += shieldRowTerm(s, row, *bits ^ x) - shieldRowTerm(s, row, *bits);
+            *bits ^= x;
+        }
+    }
+    if (mask & SNAP_SHOOTERS) {
+        snapGetSparse16(&r, out->colBottom, MAX_ALIENS);
+        snapGetSparse16(&r, out->shooterCols, MAX_ALIENS);
+        snapGetSparse16(&r, out->shooterSlot, MAX_ALIENS);
+    }
+
+    h->sum += globalsTerm(out) - globalsBefore;
+    if (count != baseCount || (mask & SNAP_WAVE)) {
+        *h = stateHashCompute(out);     // a new formation: start over
+    }
+    return r.ok && r.p == r.end && gameStateValid(out);
+}
+
+// ------------------ Observation Rendering -------------
+// Pixel observations for learning agents, rasterized straight from the
+// GameState into a caller-owned uint8 buffer (no SDL involved). The
+// buffer holds `stack` grayscale planes of width x height, newest first;
+// each call shifts the older planes back by one.
+typedef struct {
+    int width, height;   // downscaled resolution
+    int stack;           // number of stacked frames
+} ObsConfig;
+
+size_t observationSize(const ObsConfig* cfg)
+{
+    return (size_t)cfg->width * cfg->height * cfg->stack;
+}
+
+static inline void fillSpan(uint8_t* row, int x0, int x1, uint8_t value)
+{
+    int x = x0;
+#if defined(__SSE2__)
+    __m128i v = _mm_set1_epi8((char)value);
+    for (; x + 16 <= x1; x += 16) {
+        _mm_storeu_si128((__m128i*)(row + x), v);
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t v = vdupq_n_u8(value);
+    for (; x + 16 <= x1; x += 16) {
+        vst1q_u8(row + x, v);
+    }
+#endif
+    for (; x < x1; x++) {
+        row[x] = value;
+    }
+}
+
+// Maps a window-space rect to observation pixels; anything visible covers
+// at least one pixel so small bullets don't vanish when downscaled.
+static void obsFillRect(uint8_t* plane, const ObsConfig* cfg,
+                        int x, int y, int w, int h, uint8_t value)
+{
+    int x0 = x * cfg->width / WINDOW_WIDTH;
+    int y0 = y * cfg->height / WINDOW_HEIGHT;
+    int x1 = ((x + w) * cfg->width + WINDOW_WIDTH - 1) / WINDOW_WIDTH;
+    int y1 = ((y + h) * cfg->height + WINDOW_HEIGHT - 1) / WINDOW_HEIGHT;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > cfg->width)  x1 = cfg->width;
+    if (y1 > cfg->height) y1 = cfg->height;
+
+    for (int row = y0; row < y1; row++) {
+        fillSpan(plane + (size_t)row * cfg->width, x0, x1, value);
+    }
+}
+
+// Every live entity tagged `tag`, as `value`.
+static void obsFillEntities(uint8_t* plane, const ObsConfig* cfg, const GameState* game,
+                            int tag, uint8_t value)
+{
+    EcsQuery  q = ecsQuery(&game->entities.world, ECS_BIT(tag));
+    EcsChunk* chunk;
+    while ((chunk = ecsNext(&q))) {
+        EntityColumns e = entityColumns(chunk, q.base);
+        for (int i = 0; i < e.count; i++) {
+            if (e.active[i]) obsFillRect(plane, cfg, e.x[i], e.y[i], e.w[i], e.h[i], value);
+        }
+    }
+}
+
+void renderObservation(const GameState* game, const ObsConfig* cfg, uint8_t* out)
+{
+    size_t planeSize = (size_t)cfg->width * cfg->height;
+    if (cfg->stack > 1) {
+        memmove(out + planeSize, out, planeSize * (cfg->stack - 1));
+    }
+    memset(out, 0, planeSize);
+
+    obsFillEntities(out, cfg, game, EC_ALIEN, OBS_ALIEN_VALUE);
+    obsFillEntities(out, cfg, game, EC_SHOT, OBS_BULLET_VALUE);
+    obsFillEntities(out, cfg, game, EC_ENEMY_SHOT, OBS_BULLET_VALUE);
+    // Shield rows landing on the same observation row are OR-ed together
+    // first, then each run of set bits becomes one span.
+    for (int s = 0; s < SHIELD_COUNT; s++) {
+        const Shield* sh = &game->shields[s];
+        for (int r = 0; r < SHIELD_HEIGHT; ) {
+            int      y0   = (sh->y + r) * cfg->height / WINDOW_HEIGHT;
+            int      top  = r;
+            uint64_t bits = 0;
+            while (r < SHIELD_HEIGHT && (sh->y + r) * cfg->height / WINDOW_HEIGHT == y0) {
+                bits |= sh->rows[r++];
+            }
+            while (bits) {
+                int x0 = __builtin_ctzll(bits);
+                uint64_t run = bits >> x0;
+                int len = (~run == 0) ? 64 - x0 : __builtin_ctzll(~run);
+                obsFillRect(out, cfg, sh->x + x0, sh->y + top, len, r - top,
+                            OBS_SHIELD_VALUE);
+                bits &= ~(len == 64 ? ~0ull : ((1ull << len) - 1) << x0);
+            }
+        }
+    }
+    obsFillEntities(out, cfg, game, EC_PLAYER, OBS_SHIP_VALUE);
+}
+
+// ------------------ Batch Environment -----------------
+// Steps `count` independent games with one discrete action each and
+// writes their stacked observations back to back into `obs`. Reward is
+// the score gained this step; finished games report done and restart
+// with a cleared frame stack.
+enum { ACTION_NOOP, ACTION_LEFT, ACTION_RIGHT, ACTION_FIRE,
+       ACTION_LEFT_FIRE, ACTION_RIGHT_FIRE, ACTION_COUNT };
+
+void actionToInput(int action, GameInput* input)
+{
+    input->move    = (action == ACTION_LEFT  || action == ACTION_LEFT_FIRE)  ? -1 :
+                     (action == ACTION_RIGHT || action == ACTION_RIGHT_FIRE) ?  1 : 0;
+    input->fire    = action == ACTION_FIRE || action == ACTION_LEFT_FIRE ||
+                     action == ACTION_RIGHT_FIRE;
+    input->restart = false;
+}
+
+void envBatchStep(GameState* games, int count, const int* actions,
+                  const ObsConfig* cfg, uint8_t* obs,
+                  int* rewards, bool* dones)
+{
+    size_t obsSize = observationSize(cfg);
+    for (int e = 0; e < count; e++) {
+        GameState* game   = &games[e];
+        uint8_t*   envObs = obs + obsSize * e;
+        GameInput  input;
+        int        before = game->score;
+
+        actionToInput(actions[e], &input);
+        updateGame(game, &input);
+        rewards[e] = game->score - before;
+        dones[e]   = game->gameOver;
+        if (dones[e]) {
+            resetGame(game);
+            memset(envObs, 0, obsSize);
+        }
+        renderObservation(game, cfg, envObs);
+    }
+}
+
+// ------------------ Benchmark --------------------------
+// Headless run of the simulation driven by the autopilot. Reports
+// ticks/sec and the final state hash; comparing the hash between two
+// builds is a quick cross-build determinism check.
+static volatile int gBenchSink;   // keeps measured work from being elided
+
+static double benchSeconds(Uint64 start)
+{
+    return (double)(SDL_GetPerformanceCounter() - start) /
+           (double)SDL_GetPerformanceFrequency();
+}
+
+// Batched env stepping with pixel observations, as a trainer would run it.
+void benchObservation(void)
+{
+    ObsConfig  cfg   = { BENCH_OBS_SIZE, BENCH_OBS_SIZE, BENCH_OBS_STACK };
+    GameState* games = calloc(BENCH_ENVS, sizeof(GameState));
+    uint8_t*   obs   = calloc(BENCH_ENVS, observationSize(&cfg));
+    int        actions[BENCH_ENVS], rewards[BENCH_ENVS];
+    bool       dones[BENCH_ENVS];
+    if (!games || !obs) {
+        free(games);
+        free(obs);
+        return;
+    }
+
+    for (int e = 0; e < BENCH_ENVS; e++) {
+        resetGame(&games[e]);
+    }
+
+    uint32_t rng = 1;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int step = 0; step < BENCH_OBS_STEPS; step++) {
+        for (int e = 0; e < BENCH_ENVS; e++) {
+            rng = rng * 1664525u + 1013904223u;
+            actions[e] = (int)((rng >> 16) % ACTION_COUNT);
+        }
+        envBatchStep(games, BENCH_ENVS, actions, &cfg, obs, rewards, dones);
+    }
+    double secs  = benchSeconds(start);
+    double steps = (double)BENCH_ENVS * BENCH_OBS_STEPS;
+    printf("bench: obs %dx%dx%d, %d envs: %.0f env-steps/sec (%.0f ns/step)\n",
+           cfg.width, cfg.height, cfg.stack, BENCH_ENVS,
+           steps / secs, 1e9 * secs / steps);
+
+    free(games);
+    free(obs);
+}
+
+// Episode resets: template copy versus building the state field by field.
+void benchResets(void)
+{
+    GameState game, scratch;
+    WaveDef   classic = classicWave(&kSimConfigDefaults);
+    memset(&game, 0, sizeof(game));
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCH_RESETS; i++) {
+        resetGame(&game);
+        gBenchSink += alienCount(&game);
+    }
+    double copySecs = benchSeconds(start);
+
+    start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCH_RESETS; i++) {
+        buildWaveTemplate(&scratch, &classic, 0);
+        gBenchSink += alienCount(&scratch);
+    }
+    double buildSecs = benchSeconds(start);
+
+    printf("bench: reset %.0f ns (template copy) vs %.0f ns (field-by-field build)\n",
+           1e9 * copySecs / BENCH_RESETS, 1e9 * buildSecs / BENCH_RESETS);
+}
+
+// Delta snapshots of an autopilot game against the previous tick: size,
+// encode and decode cost, and a byte-exact round trip every tick.
+void benchSnapshots(void)
+{
+    static GameState prev, game, decoded;   // ~3 states; keep off the stack
+    static uint8_t   buf[SNAPSHOT_MAX_BYTES];
+    GameInput input;
+    memset(&game, 0, sizeof(game));
+    resetGame(&game);
+
+    uint64_t bytes = 0, maxBytes = 0, encodeTicks = 0, decodeTicks = 0, bad = 0;
+    for (int t = 0; t < BENCH_SNAPSHOT_TICKS; t++) {
+        prev = game;
+        autopilotInput(&game, &input);
+        updateGame(&game, &input);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        size_t size = snapshotEncode(&prev, &game, buf);
+        Uint64 mid = SDL_GetPerformanceCounter();
+        bool ok = snapshotDecode(&prev, buf, size, &decoded);
+        Uint64 end = SDL_GetPerformanceCounter();
+
+        encodeTicks += mid - start;
+        decodeTicks += end - mid;
+        bytes += size;
+        if (size > maxBytes) maxBytes = size;
+        bad += !ok || memcmp(&decoded, &game, sizeof(game)) != 0;
+    }
+    double freq = (double)SDL_GetPerformanceFrequency();
+    printf("bench: snapshot delta %.1f bytes/tick avg, %llu max (state %zu bytes); "
+           "encode %.0f ns, decode %.0f ns (%s)\n",
+           (double)bytes / BENCH_SNAPSHOT_TICKS, (unsigned long long)maxBytes,
+           sizeof(GameState),
+           1e9 * (double)encodeTicks / freq / BENCH_SNAPSHOT_TICKS,
+           1e9 * (double)decodeTicks / freq / BENCH_SNAPSHOT_TICKS,
+           bad ? "ROUND TRIP MISMATCH" : "round trip verified");
+}
+
+// Keeps BENCH_PARTICLES alive (respawning what dies) and times the SIMD
+// update plus the vertex batch build against a 60 Hz frame budget.
+void benchParticles(void)
+{
+    ParticleSystem ps;
+    if (!particlesInit(&ps, MAX_PARTICLES)) {
+        particlesFree(&ps);
+        return;
+    }
+
+    Uint64 updateTicks = 0, batchTicks = 0;
+    for (int f = 0; f < BENCH_PARTICLE_FRAMES; f++) {
+        while (ps.count < BENCH_PARTICLES) {
+            particlesSpawnExplosion(&ps, (float)(f * 7 % WINDOW_WIDTH),
+                                    (float)(f * 13 % WINDOW_HEIGHT), EXPLOSION_PARTICLES);
+        }
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        particlesUpdate(&ps);
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        gBenchSink += particlesBuildBatch(&ps);
+        Uint64 t2 = SDL_GetPerformanceCounter();
+        updateTicks += t1 - t0;
+        batchTicks  += t2 - t1;
+    }
+
+    double freq = (double)SDL_GetPerformanceFrequency();
+    double updateUs = 1e6 * (double)updateTicks / freq / BENCH_PARTICLE_FRAMES;
+    double batchUs  = 1e6 * (double)batchTicks / freq / BENCH_PARTICLE_FRAMES;
+    printf("bench: %d particles: update %.0f us + batch %.0f us per frame "
+           "(%.0f%% of a 60 Hz frame)\n", BENCH_PARTICLES, updateUs, batchUs,
+           100.0 * (updateUs + batchUs) / (1e6 / 60.0));
+    particlesFree(&ps);
+}
+
+// Bullet/alien pairs scattered around the alien so that about half the
+// boxes overlap; compares AABB alone against AABB plus mask.
+void benchCollision(void)
+{
+    const CollisionMasks* masks = collisionMasks();
+    enum { PAIRS = 4096 };
+    static int bx[PAIRS], by[PAIRS];
+    uint32_t rng = 12345;
+    for (int i = 0; i < PAIRS; i++) {
+        rng = rng * 1664525u + 1013904223u;
+        bx[i] = (int)(rng >> 8) % (ALIEN_WIDTH + 2 * BULLET_WIDTH) - 2 * BULLET_WIDTH;
+        rng = rng * 1664525u + 1013904223u;
+        by[i] = (int)(rng >> 8) % (ALIEN_HEIGHT + 2 * BULLET_HEIGHT) - 2 * BULLET_HEIGHT;
+    }
+
+    int aabbHits = 0, maskHits = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int n = 0; n < BENCH_COLLISIONS; n++) {
+        int i = n & (PAIRS - 1);
+        aabbHits += rect_collide(bx[i], by[i], BULLET_WIDTH, BULLET_HEIGHT,
+                                 0, 0, ALIEN_WIDTH, ALIEN_HEIGHT);
+    }
+    double aabbSecs = benchSeconds(start);
+
+    start = SDL_GetPerformanceCounter();
+    for (int n = 0; n < BENCH_COLLISIONS; n++) {
+        int i = n & (PAIRS - 1);
+        maskHits += spriteCollide(&masks->bullet, bx[i], by[i], &masks->alien, 0, 0);
+    }
+    double maskSecs = benchSeconds(start);
+    gBenchSink += aabbHits + maskHits;
+
+    printf("bench: collision %.1f ns (AABB) vs %.1f ns (AABB + mask), "
+           "masks reject %.0f%% of box hits\n",
+           1e9 * aabbSecs / BENCH_COLLISIONS, 1e9 * maskSecs / BENCH_COLLISIONS,
+           aabbHits > 0 ? 100.0 * (aabbHits - maskHits) / aabbHits : 0.0);
+}
+
+// One mid-game frame drawn into the same 640x480 surface by SDL's
+// software renderer and by the soft blitter. Needs the sprite files. The
+// linked SDL's version is printed with the result: the ratio only means
+// something against a real SDL, whose renderer actually rasterizes.
+void benchRender(void)
+{
+    SDL_Surface*  surface  = SDL_CreateRGBSurfaceWithFormat(
+        0, WINDOW_WIDTH, WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer* renderer = surface ? SDL_CreateSoftwareRenderer(surface) : NULL;
+    RenderAssets  assets;
+    SoftBlitter   soft;
+    bool          ttf = TTF_Init() == 0;
+    if (!renderer || !loadAssets(renderer, &assets, false)) {
+        printf("bench: render skipped (no software renderer or sprites)\n");
+        if (renderer) SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
+        if (ttf) TTF_Quit();
+        return;
+    }
+    if (!softBlitOpen(&soft)) {
+        printf("bench: render skipped (soft blitter sprites)\n");
+    } else {
+        static GameState game;
+        GameInput        input;
+        ParticleSystem   particles;
+        memset(&game, 0, sizeof(game));
+        resetGame(&game);
+        for (int t = 0; t < 600; t++) {    // some shots, craters and movement
+            autopilotInput(&game, &input);
+            updateGame(&game, &input);
+        }
+        bool withParticles = particlesInit(&particles, MAX_PARTICLES);
+        for (int e = 0; withParticles && e < 8; e++) {
+            particlesSpawnExplosion(&particles, 80.0f + 60 * e, 200.0f, EXPLOSION_PARTICLES);
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < BENCH_RENDER_FRAMES; f++) {
+            renderGame(renderer, &game, &assets, withParticles ? &particles : NULL);
+        }
+        double sdlSecs = benchSeconds(start);
+
+        start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < BENCH_RENDER_FRAMES; f++) {
+            softRenderSurface(&soft, surface, &game, withParticles ? &particles : NULL);
+        }
+        double softSecs = benchSeconds(start);
+
+        SDL_version linked;
+        SDL_GetVersion(&linked);
+        printf("bench: render %.0f us (SDL %d.%d.%d software renderer) vs %.0f us (soft blit) "
+               "per frame, %.1fx\n", 1e6 * sdlSecs / BENCH_RENDER_FRAMES,
+               linked.major, linked.minor, linked.patch,
+               1e6 * softSecs / BENCH_RENDER_FRAMES, softSecs > 0 ? sdlSecs / softSecs : 0.0);
+        if (withParticles) particlesFree(&particles);
+        softBlitClose(&soft);
+    }
+    freeAssets(&assets);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(surface);
+    if (ttf) TTF_Quit();
+}
+
+// Autopilot games on one wave, replayed from its template whenever they
+// end; returns the final state hash.
+static uint64_t benchScriptGame(const WaveDef* wave)
+{
+    static GameState tmpl, game;
+    GameInput input;
+    buildWaveTemplate(&tmpl, wave, 0);
+    game = tmpl;
+    for (int t = 0; t < BENCH_SCRIPT_TICKS; t++) {
+        if (game.gameOver) {
+            game = tmpl;
+            continue;
+        }
+        autopilotInput(&game, &input);
+        updateGame(&game, &input);
+    }
+    return stateHashDigest(&game.hash);
+}
+
+// ns per alien for one scripted formation move (interpreter, register
+// loads and applying the result), starting over from the wave's opening
+// every 256 moves so the formation stays on screen.
+static double benchScriptMove(const WaveDef* wave)
+{
+    static GameState tmpl, game;
+    int stepX[MAX_ALIENS], stepY[MAX_ALIENS];
+    buildWaveTemplate(&tmpl, wave, 0);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int t = 0; t < BENCH_SCRIPT_TICKS; t++) {
+        if ((t & 255) == 0) game = tmpl;
+        game.tick = (uint64_t)t;
+        alienScriptMove(&game, wave->speed, (t & 63) == 0 ? FIX(wave->descent) : 0, 1,
+                        stepX, stepY);
+    }
+    int row;
+    gBenchSink += simSlot(&game, SIM_ALIENS, 0, &row).x[row];
+    return 1e9 * benchSeconds(start) / ((double)BENCH_SCRIPT_TICKS * alienCount(&tmpl));
+}
+
+// Interpreter cost per alien per tick on a 4x10 wave, for a script doing
+// what the built-in march does and for the zigzag example. The march
+// script must also play exactly like the built-in march.
+void benchScripts(void)
+{
+    static const char* const kMarch[]  = { "dx = march", "dy = drop" };
+    // A variable divisor must not be turned into its reciprocal
+    static const char* const kDivVar[]   = { "k = 4", "dx = march / k", "dy = drop + k" };
+    static const char* const kDivConst[] = { "dx = march / 4", "dy = drop + 4" };
+    // With the constant pool full, x / 4 must still compile, as a plain divide
+    static const char* const kDivFull[]  = {
+        "dy = drop + 4 + 0 * (5 + 6 + 7 + 8 + 9 + 10 + 11 + 12 + 13 + 14 + 15 + 16 + 17 + 18)",
+        "dx = march / 4",
+    };
+    static const char* const kZigzag[] = {
+        "dx = march * (1 + sin(tick / 120 + col / 8))",
+        "dy = drop + sin(tick / 60 + row / 4) / 2",
+    };
+    WaveDef builtin = classicWave(&kSimConfigDefaults), march, zigzag, divVar, divConst, divFull;
+    builtin.rows     = 4;
+    builtin.cols     = 10;
+    builtin.startX   = 40;
+    builtin.spacingX = 50;
+    march    = builtin;
+    zigzag   = builtin;
+    divVar   = builtin;
+    divConst = builtin;
+    divFull  = builtin;
+
+    ScriptCompiler c;
+    scriptCompileBegin(&c, &march.script);
+    for (int k = 0; k < 2; k++) scriptCompileLine(&c, kMarch[k]);
+    bool ok = scriptCompileEnd(&c);
+    scriptCompileBegin(&c, &zigzag.script);
+    for (int k = 0; k < 2; k++) scriptCompileLine(&c, kZigzag[k]);
+    ok = ok && scriptCompileEnd(&c);
+    scriptCompileBegin(&c, &divVar.script);
+    for (int k = 0; k < 3; k++) scriptCompileLine(&c, kDivVar[k]);
+    ok = ok && scriptCompileEnd(&c);
+    scriptCompileBegin(&c, &divConst.script);
+    for (int k = 0; k < 2; k++) scriptCompileLine(&c, kDivConst[k]);
+    ok = ok && scriptCompileEnd(&c);
+    scriptCompileBegin(&c, &divFull.script);
+    for (int k = 0; k < 2; k++) scriptCompileLine(&c, kDivFull[k]);
+    ok = ok && scriptCompileEnd(&c);
+    if (!ok) {
+        printf("bench: alien scripts skipped (%s)\n", c.error);
+        return;
+    }
+
+    bool same    = benchScriptGame(&builtin) == benchScriptGame(&march);
+    uint64_t divided = benchScriptGame(&divConst);
+    bool divides = benchScriptGame(&divVar) == divided && benchScriptGame(&divFull) == divided &&
+                   divFull.script.constCount == SCRIPT_MAX_CONSTS;
+    printf("bench: alien scripts %.1f ns (march, %d ops) and %.1f ns (zigzag, %d ops) "
+           "per alien per tick (%s, %s)\n",
+           benchScriptMove(&march), march.script.opCount,
+           benchScriptMove(&zigzag), zigzag.script.opCount,
+           same ? "march script matches the built-in march" : "MISMATCH vs built-in march",
+           divides ? "division by a variable and with a full constant pool checked"
+                   : "MISMATCH dividing by a variable or with a full constant pool");
+}
+
+#ifdef ENABLE_TRACE
+// Cost of one TRACE_BEGIN/TRACE_END pair, recording included.
+void benchTrace(void)
+{
+    enum { MARKERS = 1000000 };
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < MARKERS; i++) {
+        TRACE_BEGIN("bench marker");
+        TRACE_END();
+    }
+    printf("bench: trace marker %.1f ns\n", 1e9 * benchSeconds(start) / MARKERS);
+}
+#endif
+
+// Parses a file that sets every key to its default.
+void benchConfig(void)
+{
+    static const char text[] =
+        "# every key at its default\n"
+        "window_width = 640\nwindow_height = 480\n"
+        "player_speed = 5\nplayer_lives = 3\n"
+        "bullet_speed = 7\nmax_bullets = 5\n"
+        "enemy_bullet_speed = 4\nmax_enemy_bullets = 6\n"
+        "enemy_fire_ticks = 30\nenemy_fire_jitter = 30\n"
+        "alien_count = 8\nalien_rows = 1\nalien_start_x = 50\nalien_start_y = 50\n"
+        "alien_spacing = 50\nalien_speed = 1.0\nalien_descent = 20\n"
+        "max_particles = 131072\n";
+    Config cfg, defaults;
+    configDefaults(&defaults);
+    bool ok = true;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCH_CONFIG_PARSES; i++) {
+        ok &= configParse(text, sizeof(text) - 1, "bench", &cfg);
+    }
+    double secs = benchSeconds(start);
+    printf("bench: config parse %.2f us per file (%d keys, %.0f ns per key)%s\n",
+           1e6 * secs / BENCH_CONFIG_PARSES, CONFIG_KEYS,
+           1e9 * secs / BENCH_CONFIG_PARSES / CONFIG_KEYS,
+           ok && memcmp(&cfg, &defaults, sizeof(cfg)) == 0 ? "" : " (MISMATCH vs defaults)");
+}
+
+int runBenchmark(long long ticks, int timeScale, FILE* hashLog, const SimConfig* sim)
+{
+    GameState game;
+    GameInput input;
+    memset(&game, 0, sizeof(game));
+    game.timeScale = timeScale;
+    game.config    = *sim;
+    resetGame(&game);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (long long t = 0; t < ticks; t++) {
+        autopilotInput(&game, &input);
+        updateGame(&game, &input);
+        logStateHash(hashLog, &game);
+    }
+    double secs = benchSeconds(start);
+    StateHash full = stateHashCompute(&game);
+    bool hashOk = full.sum == game.hash.sum &&
+                  full.alienSumX == game.hash.alienSumX &&
+                  full.alienSumY == game.hash.alienSumY;
+
+    if (timeScale > 1) {
+        printf("bench: %lld updates of %d ticks in %.3f s (%.0f ticks/sec)\n",
+               ticks, timeScale, secs,
+               secs > 0 ? (double)ticks * timeScale / secs : 0.0);
+    } else {
+        printf("bench: %lld ticks in %.3f s (%.0f ticks/sec)\n",
+               ticks, secs, secs > 0 ? (double)ticks / secs : 0.0);
+    }
+    printf("bench: final score %d, state hash %016llx (%s)\n",
+           game.score, (unsigned long long)stateHashDigest(&game.hash),
+           hashOk ? "verified" : "MISMATCH vs full recompute");
+
+    benchObservation();
+    benchResets();
+    benchCollision();
+    benchParticles();
+    benchSnapshots();
+    benchRender();
+    benchScripts();
+    benchConfig();
+#ifdef ENABLE_TRACE
+    benchTrace();
+#endif
+    return hashOk ? 0 : 1;
+}
+
+// ------------------ Frame Capture ---------------------
+// Frames are rendered into one of two target textures. Each frame reads
+// back the *previous* target, so the renderer has a full frame to finish
+// it before we ask for its pixels. Readbacks go into a bounded ring of
+// slots drained by a worker thread that converts to YUV 4:2:0 and writes
+// Y4M (to a file or an encoder's stdin). When every slot is busy the
+// frame is dropped rather than making the game wait, unless the capture
+// was opened in blocking mode (offline headless export).
+typedef struct {
+    SDL_Renderer* renderer;
+    SDL_Texture*  targets[2];
+    int           current;
+    bool          pending;    // targets[current ^ 1] holds an unread frame
+    bool          blocking;
+    int           width, height;
+
+    FILE*         out;
+    bool          outIsPipe;
+    Uint32*       slots[CAPTURE_QUEUE_LEN];
+    uint8_t*      yuv;
+    _Atomic uint64_t head;    // next slot the game fills
+    _Atomic uint64_t tail;    // next slot the worker drains
+    _Atomic bool  stopping;
+    SDL_sem*      filled;
+    SDL_sem*      freeSlots;
+    SDL_Thread*   worker;
+
+    // stats
+    uint64_t      captured;
+    uint64_t      dropped;
+    uint64_t      captureTicks;     // game-thread cost, perf counter units
+    uint64_t      captureTicksMax;
+    _Atomic uint64_t encodeTicks;   // worker-thread cost
+} Capture;
+
+static void argbToI420(const Uint32* src, int w, int h, uint8_t* dst)
+{
+    uint8_t* yp = dst;
+    uint8_t* up = dst + w * h;
+    uint8_t* vp = up + (w / 2) * (h / 2);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            Uint32 c = src[y * w + x];
+            int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF;
+            yp[y * w + x] = (uint8_t)((77 * r + 150 * g + 29 * b) >> 8);
+        }
+    }
+    for (int y = 0; y < h / 2; y++) {
+        for (int x = 0; x < w / 2; x++) {
+            int r = 0, g = 0, b = 0;
+            for (int k = 0; k < 4; k++) {
+                Uint32 c = src[(2 * y + (k >> 1)) * w + 2 * x + (k & 1)];
+                r += (c >> 16) & 0xFF; g += (c >> 8) & 0xFF; b += c & 0xFF;
+            }
+            r >>= 2; g >>= 2; b >>= 2;
+            up[y * (w / 2) + x] = (uint8_t)(((-43 * r - 85 * g + 128 * b) >> 8) + 128);
+            vp[y * (w / 2) + x] = (uint8_t)(((128 * r - 107 * g - 21 * b) >> 8) + 128);
+        }
+    }
+}
+
+static int captureWorker(void* data)
+{
+    Capture* cap = data;
+    size_t yuvSize = (size_t)cap->width * cap->height * 3 / 2;
+    TRACE_THREAD_NAME("capture encoder");
+
+    for (;;) {
+        SDL_SemWait(cap->filled);
+        uint64_t tail = atomic_load(&cap->tail);
+        if (tail == atomic_load(&cap->head)) {
+            if (atomic_load(&cap->stopping)) break;
+            continue;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        TRACE_BEGIN("encode frame");
+        argbToI420(cap->slots[tail % CAPTURE_QUEUE_LEN],
+                   cap->width, cap->height, cap->yuv);
+        fputs("FRAME\n", cap->out);
+        fwrite(cap->yuv, 1, yuvSize, cap->out);
+        TRACE_END();
+        atomic_fetch_add(&cap->encodeTicks, SDL_GetPerformanceCounter() - start);
+
+        atomic_store(&cap->tail, tail + 1);
+        SDL_SemPost(cap->freeSlots);
+    }
+    return 0;
+}
+
+bool captureOpen(Capture* cap, SDL_Renderer* renderer, int width, int height,
+                 const char* target, bool isPipe, bool blocking)
+{
+    memset(cap, 0, sizeof(*cap));
+    cap->renderer  = renderer;
+    cap->width     = width;
+    cap->height    = height;
+    cap->blocking  = blocking;
+    cap->outIsPipe = isPipe;
+
+    cap->out = isPipe ? popen(target, "w") : fopen(target, "wb");
+    if (!cap->out) {
+        printf("Cannot open capture output %s\n", target);
+        return false;
+    }
+    fprintf(cap->out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+            width, height, CAPTURE_FPS);
+
+    for (int i = 0; i < 2; i++) {
+        cap->targets[i] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                            SDL_TEXTUREACCESS_TARGET, width, height);
+        if (!cap->targets[i]) {
+            printf("Capture target creation failed: %s\n", SDL_GetError());
+            return false;
+        }
+    }
+    for (int i = 0; i < CAPTURE_QUEUE_LEN; i++) {
+        cap->slots[i] = malloc((size_t)width * height * sizeof(Uint32));
+        if (!cap->slots[i]) return false;
+    }
+    cap->yuv = malloc((size_t)width * height * 3 / 2);
+    if (!cap->yuv) return false;
+
+    cap->filled    = SDL_CreateSemaphore(0);
+    cap->freeSlots = SDL_CreateSemaphore(CAPTURE_QUEUE_LEN);
+    cap->worker    = SDL_CreateThread(captureWorker, "capture", cap);
+    return cap->worker != NULL;
+}
+
+void captureBeginFrame(Capture* cap)
+{
+    SDL_SetRenderTarget(cap->renderer, cap->targets[cap->current]);
+}
+
+static void captureReadback(Capture* cap, SDL_Texture* target)
+{
+    if (cap->blocking) {
+        SDL_SemWait(cap->freeSlots);
+    } else if (SDL_SemTryWait(cap->freeSlots) != 0) {
+        cap->dropped++;
+        return;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    uint64_t head = atomic_load(&cap->head);
+    SDL_SetRenderTarget(cap->renderer, target);
+    SDL_RenderReadPixels(cap->renderer, NULL, SDL_PIXELFORMAT_ARGB8888,
+                         cap->slots[head % CAPTURE_QUEUE_LEN],
+                         cap->width * (int)sizeof(Uint32));
+    atomic_store(&cap->head, head + 1);
+    SDL_SemPost(cap->filled);
+
+    uint64_t cost = SDL_GetPerformanceCounter() - start;
+    cap->captured++;
+    cap->captureTicks += cost;
+    if (cost > cap->captureTicksMax) cap->captureTicksMax = cost;
+}
+
+// Finishes the frame rendered since captureBeginFrame, reads back the
+// previous one and returns the texture to present.
+SDL_Texture* captureEndFrame(Capture* cap)
+{
+    SDL_Texture* frame = cap->targets[cap->current];
+    if (cap->pending) {
+        captureReadback(cap, cap->targets[cap->current ^ 1]);
+    }
+    SDL_SetRenderTarget(cap->renderer, NULL);
+    cap->pending  = true;
+    cap->current ^= 1;
+    return frame;
+}
+
+void captureClose(Capture* cap)
+{
+    if (!cap->out) return;
+
+    if (cap->worker) {
+        if (cap->pending) {
+            captureReadback(cap, cap->targets[cap->current ^ 1]);
+            SDL_SetRenderTarget(cap->renderer, NULL);
+        }
+        atomic_store(&cap->stopping, true);
+        SDL_SemPost(cap->filled);
+        SDL_WaitThread(cap->worker, NULL);
+    }
+
+    double freq = (double)SDL_GetPerformanceFrequency();
+    printf("capture: %llu frames written, %llu dropped\n",
+           (unsigned long long)cap->captured, (unsigned long long)cap->dropped);
+    if (cap->captured) {
+        printf("capture: game thread %.1f us/frame avg, %.1f us max; "
+               "encoder %.1f us/frame avg\n",
+               1e6 * (double)cap->captureTicks / freq / (double)cap->captured,
+               1e6 * (double)cap->captureTicksMax / freq,
+               1e6 * (double)atomic_load(&cap->encodeTicks) / freq / (double)cap->captured);
+    }
+
+    if (cap->outIsPipe) pclose(cap->out); else fclose(cap->out);
+    cap->out = NULL;
+    for (int i = 0; i < 2; i++) SDL_DestroyTexture(cap->targets[i]);
+    for (int i = 0; i < CAPTURE_QUEUE_LEN; i++) free(cap->slots[i]);
+    free(cap->yuv);
+    if (cap->filled)    SDL_DestroySemaphore(cap->filled);
+    if (cap->freeSlots) SDL_DestroySemaphore(cap->freeSlots);
+}
+
+// ------------------ Audio Mixer -----------------------
+// Sounds are synthesized once at startup into mono int16 buffers. The
+// game thread posts play commands into a single-producer/single-consumer
+// ring (two atomic indices, no locks); the SDL audio callback drains it,
+// starts voices and mixes them with saturating 16-bit SIMD adds. If the
+// ring is full the command is dropped, so posting never blocks.
+enum { SOUND_SHOT, SOUND_EXPLOSION, SOUND_LIFE_LOST,
+       SOUND_MARCH0, SOUND_MARCH1, SOUND_MARCH2, SOUND_MARCH3, SOUND_COUNT };
+
+typedef struct {
+    int    sound;
+    int    gain;        // Q15
+    Uint64 postedAt;    // perf counter, for latency stats
+} AudioCommand;
+
+typedef struct {
+    const int16_t* samples;
+    int            length;
+    int            pos;
+    int16_t        gain;
+    bool           active;
+} Voice;
+
+typedef struct {
+    SDL_AudioDeviceID device;
+    SDL_AudioSpec     spec;
+
+    AudioCommand      queue[AUDIO_QUEUE_LEN];
+    _Atomic uint32_t  head;            // written by the game thread
+    _Atomic uint32_t  tail;            // written by the callback
+    uint64_t          droppedCommands; // game thread only
+
+    int16_t*          sounds[SOUND_COUNT];
+    int               soundLength[SOUND_COUNT];
+    Voice             voices[AUDIO_VOICES];
+
+    // Callback-side stats, read after the device is closed
+    uint64_t          callbacks;
+    Uint64            lastCallback;
+    Uint64            intervalTicks;
+    Uint64            mixTicks;
+    Uint64            mixTicksMax;
+    Uint64            latencyTicks;
+    uint64_t          commandsPlayed;
+} AudioMixer;
+
+static int16_t* synthSound(int sound, int freq, int* outLength)
+{
+    static const double marchHz[4] = { 98.0, 87.3, 77.8, 73.4 };
+    double seconds = sound == SOUND_SHOT      ? 0.12 :
+                     sound == SOUND_EXPLOSION ? 0.35 :
+                     sound == SOUND_LIFE_LOST ? 0.70 : 0.07;
+    int length = (int)(seconds * freq);
+    int16_t* pcm = malloc((size_t)length * sizeof(int16_t));
+    if (!pcm) return NULL;
+
+    double   phase = 0.0;
+    uint32_t noise = 0x1234567u;
+    int      held  = 0;
+    for (int i = 0; i < length; i++) {
+        double t   = (double)i / length;          // 0..1 through the sound
+        double hz  = 0.0, amp = 0.0, v;
+        switch (sound) {
+            case SOUND_SHOT:      hz = 1200.0 - 900.0 * t; amp = 6000.0 * (1.0 - t); break;
+            case SOUND_LIFE_LOST: hz = 400.0 - 320.0 * t;  amp = 9000.0 * (1.0 - t); break;
+            case SOUND_EXPLOSION: amp = 10000.0 * (1.0 - t) * (1.0 - t); break;
+            default:              hz = marchHz[sound - SOUND_MARCH0]; amp = 9000.0; break;
+        }
+        if (sound == SOUND_EXPLOSION) {
+            if ((i & 3) == 0) {                    // crude low-passed noise
+                noise = noise * 1664525u + 1013904223u;
+                held  = (int)(noise >> 16) - 32768;
+            }
+            v = amp * held / 32768.0;
+        } else {
+            phase += hz / freq;
+            v = (phase - (int)phase) < 0.5 ? amp : -amp;
+        }
+        pcm[i] = (int16_t)v;
+    }
+    *outLength = length;
+    return pcm;
+}
+
+// out[i] = saturate(out[i] + src[i] * gain), gain in Q15.
+static void mixVoice(int16_t* out, const int16_t* src, int n, int16_t gain)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i g = _mm_set1_epi16(gain);
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i o = _mm_loadu_si128((const __m128i*)(out + i));
+        s = _mm_slli_epi16(_mm_mulhi_epi16(s, g), 1);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_adds_epi16(o, s));
+    }
+#elif defined(__ARM_NEON)
+    int16x8_t g = vdupq_n_s16(gain);
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vqdmulhq_s16(vld1q_s16(src + i), g);
+        vst1q_s16(out + i, vqaddq_s16(vld1q_s16(out + i), s));
+    }
+#endif
+    for (; i < n; i++) {
+        int v = out[i] + ((src[i] * gain) >> 15);
+        out[i] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+    }
+}
+
+static void audioCallback(void* userdata, Uint8* stream, int len)
+{
+    AudioMixer* mix   = userdata;
+    Uint64      start = SDL_GetPerformanceCounter();
+    int16_t*    out   = (int16_t*)stream;
+    int         n     = len / (int)sizeof(int16_t);
+    TRACE_THREAD_NAME("audio");
+    TRACE_SCOPE("audio mix");
+
+    if (mix->lastCallback) mix->intervalTicks += start - mix->lastCallback;
+    mix->lastCallback = start;
+
+    // Drain commands into voices (steal voice 0's slot when all are busy)
+    uint32_t tail = atomic_load_explicit(&mix->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&mix->head, memory_order_acquire);
+    for (; tail != head; tail++) {
+        const AudioCommand* cmd = &mix->queue[tail & (AUDIO_QUEUE_LEN - 1)];
+        int slot = 0;
+        for (int v = 0; v < AUDIO_VOICES; v++) {
+            if (!mix->voices[v].active) { slot = v; break; }
+        }
+        Voice* voice   = &mix->voices[slot];
+        voice->samples = mix->sounds[cmd->sound];
+        voice->length  = mix->soundLength[cmd->sound];
+        voice->pos     = 0;
+        voice->gain    = (int16_t)cmd->gain;
+        voice->active  = voice->samples != NULL;
+        mix->latencyTicks += start - cmd->postedAt;
+        mix->commandsPlayed++;
+    }
+    atomic_store_explicit(&mix->tail, tail, memory_order_release);
+
+    memset(stream, 0, (size_t)len);
+    for (int v = 0; v < AUDIO_VOICES; v++) {
+        Voice* voice = &mix->voices[v];
+        if (!voice->active) continue;
+        int count = voice->length - voice->pos;
+        if (count > n) count = n;
+        mixVoice(out, voice->samples + voice->pos, count, voice->gain);
+        voice->pos += count;
+        if (voice->pos >= voice->length) voice->active = false;
+    }
+
+    Uint64 cost = SDL_GetPerformanceCounter() - start;
+    mix->mixTicks += cost;
+    if (cost > mix->mixTicksMax) mix->mixTicksMax = cost;
+    mix->callbacks++;
+}
+
+// Game thread: queue a sound without blocking.
+void audioPost(AudioMixer* mix, int sound, int gain)
+{
+    if (!mix || !mix->device) return;
+    uint32_t head = atomic_load_explicit(&mix->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&mix->tail, memory_order_acquire);
+    if (head - tail >= AUDIO_QUEUE_LEN) {
+        mix->droppedCommands++;
+        return;
+    }
+    AudioCommand* cmd = &mix->queue[head & (AUDIO_QUEUE_LEN - 1)];
+    cmd->sound    = sound;
+    cmd->gain     = gain;
+    cmd->postedAt = SDL_GetPerformanceCounter();
+    atomic_store_explicit(&mix->head, head + 1, memory_order_release);
+}
+
+void audioPlayEvents(AudioMixer* mix, const GameEvents* events)
+{
+    for (int i = 0; i < events->count; i++) {
+        const GameEvent* e = &events->list[i];
+        switch (e->type) {
+            case EVENT_SHOT:         audioPost(mix, SOUND_SHOT, 20000); break;
+            case EVENT_ENEMY_SHOT:   audioPost(mix, SOUND_SHOT, 9000); break;
+            case EVENT_ALIEN_KILLED: audioPost(mix, SOUND_EXPLOSION, 26000); break;
+            case EVENT_LIFE_LOST:    audioPost(mix, SOUND_LIFE_LOST, 28000); break;
+            case EVENT_MARCH:        audioPost(mix, SOUND_MARCH0 + e->param, 24000); break;
+            default: break;
+        }
+    }
+}
+
+// Audio is optional: on failure the game runs silent. Works with the
+// dummy and disk drivers (SDL_AUDIODRIVER=dummy|disk) for headless tests.
+bool audioOpen(AudioMixer* mix)
+{
+    memset(mix, 0, sizeof(*mix));
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        printf("Audio init failed (running silent): %s\n", SDL_GetError());
+        return false;
+    }
+
+    SDL_AudioSpec want;
+    memset(&want, 0, sizeof(want));
+    want.freq     = AUDIO_FREQ;
+    want.format   = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples  = AUDIO_SAMPLES;
+    want.callback = audioCallback;
+    want.userdata = mix;
+    mix->device = SDL_OpenAudioDevice(NULL, 0, &want, &mix->spec,
+                                      SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+                                      SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if (!mix->device) {
+        printf("Audio device open failed (running silent): %s\n", SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
+
+    for (int i = 0; i < SOUND_COUNT; i++) {
+        mix->sounds[i] = synthSound(i, mix->spec.freq, &mix->soundLength[i]);
+    }
+    printf("audio: driver %s, %d Hz, buffer %d samples (%.1f ms)\n",
+           SDL_GetCurrentAudioDriver(), mix->spec.freq, mix->spec.samples,
+           1000.0 * mix->spec.samples / mix->spec.freq);
+    SDL_PauseAudioDevice(mix->device, 0);
+    return true;
+}
+
+void audioClose(AudioMixer* mix)
+{
+    if (!mix->device) return;
+    SDL_CloseAudioDevice(mix->device);   // joins the callback thread
+    mix->device = 0;
+
+    double freq = (double)SDL_GetPerformanceFrequency();
+    if (mix->callbacks > 1) {
+        double bufferMs = 1000.0 * mix->spec.samples / mix->spec.freq;
+        double queueMs  = mix->commandsPlayed ?
+            1000.0 * (double)mix->latencyTicks / freq / (double)mix->commandsPlayed : 0.0;
+        printf("audio: %llu callbacks, every %.2f ms, mix %.1f us avg / %.1f us max\n",
+               (unsigned long long)mix->callbacks,
+               1000.0 * (double)mix->intervalTicks / freq / (double)(mix->callbacks - 1),
+               1e6 * (double)mix->mixTicks / freq / (double)mix->callbacks,
+               1e6 * (double)mix->mixTicksMax / freq);
+        printf("audio: %llu sounds, latency %.2f ms queued + %.2f ms buffer, "
+               "%llu commands dropped\n",
+               (unsigned long long)mix->commandsPlayed, queueMs, bufferMs,
+               (unsigned long long)mix->droppedCommands);
+    }
+    for (int i = 0; i < SOUND_COUNT; i++) free(mix->sounds[i]);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+// ------------------ High Scores -----------------------
+// Finished games are appended to "<path>.journal" as fixed-size records,
+// each ending in a CRC-32 of its bytes. A writer thread does the appends
+// and one fdatasync per batch, so the game thread never touches the disk.
+// Every HISCORE_COMPACT_RECORDS records the writer folds the journal
+// into the table file <path> (written to a temp file, fsynced, renamed
+// over the old one) and truncates the journal.
+// A failed append leaves the record queued and the writer retries it
+// every HISCORE_RETRY_MS; records still unwritten at exit are counted as
+// lost. A partial append is cut back off, so later records never land
+// behind a torn one.
+// On startup the table is mapped and checked, then the journal is
+// scanned up to its first bad record; a torn tail from a power loss is
+// cut off there. Journal records the table already covers (a crash
+// between rename and truncate) are recognized by sequence number.
+#define HISCORE_RECORD_MAGIC 0x52435348u   // "HSCR"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;       // submission order, never reused
+    int32_t  score;
+    int32_t  wave;      // wave reached, 1-based
+    uint64_t ticks;     // game ticks played
+    int64_t  time;      // wall clock at submission (Unix seconds)
+    uint32_t pad;
+    uint32_t crc;       // CRC-32 of everything above
+} HiscoreRecord;
+
+typedef struct {
+    char          magic[8];    // "SIHISC1"
+    uint32_t      count;
+    uint32_t      seq;         // last journal record folded in
+    HiscoreRecord entries[HISCORE_TABLE_SIZE];
+    uint32_t      pad;
+    uint32_t      crc;         // CRC-32 of everything above
+} HiscoreFile;
+
+typedef struct {
+    HiscoreRecord entries[HISCORE_TABLE_SIZE];  // best first
+    int           count;
+} HiscoreRanks;
+
+typedef struct {
+    char          path[256];
+    char          journalPath[264];
+    int           journal;        // fd, -1: closed
+    HiscoreRanks  ranks;          // game thread's view
+    uint32_t      seq;
+    bool          wasOver;        // for hiscoreWatch
+
+    HiscoreRecord queue[HISCORE_QUEUE_LEN];
+    _Atomic uint64_t head;        // next record the game fills
+    _Atomic uint64_t tail;        // next record the writer drains
+    _Atomic bool  stopping;
+    SDL_sem*      filled;
+    SDL_Thread*   writer;
+
+    // writer thread only
+    HiscoreRanks  diskRanks;
+    uint32_t      diskSeq;
+    int           journalRecords;
+    bool          writeFailed;    // retrying the record at tail
+    uint64_t      lost;           // unwritten at exit
+
+    // stats
+    uint64_t      submitted;
+    uint64_t      dropped;        // queue full
+    _Atomic uint64_t syncs;
+    _Atomic uint64_t compactions;
+} HiscoreTable;
+
+static uint32_t hiscoreCrc(const void* data, size_t size)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0xEDB88320u & (0u - (c & 1)));
+            table[i] = c;
+        }
+    }
+    const uint8_t* p = data;
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static bool hiscoreRecordValid(const HiscoreRecord* r)
+{
+    return r->magic == HISCORE_RECORD_MAGIC &&
+           r->crc == hiscoreCrc(r, offsetof(HiscoreRecord, crc));
+}
+
+// Inserts in rank order (higher score first, earlier game on ties);
+// returns the 1-based rank, or 0 if it didn't make the table.
+static int hiscoreInsert(HiscoreRanks* ranks, const HiscoreRecord* r)
+{
+    int at = ranks->count;
+    while (at > 0 && ranks->entries[at - 1].score < r->score) at--;
+    if (at >= HISCORE_TABLE_SIZE) return 0;
+    int last = ranks->count < HISCORE_TABLE_SIZE ? ranks->count : HISCORE_TABLE_SIZE - 1;
+    memmove(&ranks->entries[at + 1], &ranks->entries[at],
+            (size_t)(last - at) * sizeof(ranks->entries[0]));
+    ranks->entries[at] = *r;
+    if (ranks->count < HISCORE_TABLE_SIZE) ranks->count++;
+    return at + 1;
+}
+
+#if !defined(_WIN32)
+static void hiscoreSyncDir(const char* path)
+{
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash) {
+        if (slash == dir) slash[1] = '\0'; else *slash = '\0';
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Writer thread: replaces the table file with diskRanks, then empties
+// the journal. Each step is durable before the next one starts.
+static void hiscoreCompact(HiscoreTable* hs)
+{
+    TRACE_SCOPE("hiscore compact");
+    HiscoreFile file;
+    memset(&file, 0, sizeof(file));
+    memcpy(file.magic, "SIHISC1", 8);
+    file.count = (uint32_t)hs->diskRanks.count;
+    file.seq   = hs->diskSeq;
+    memcpy(file.entries, hs->diskRanks.entries, sizeof(file.entries));
+    file.crc   = hiscoreCrc(&file, offsetof(HiscoreFile, crc));
+
+    char tmp[272];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", hs->path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    bool ok = write(fd, &file, sizeof(file)) == (ssize_t)sizeof(file) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, hs->path) != 0) {
+        unlink(tmp);
+        return;                 // the journal still has everything
+    }
+    hiscoreSyncDir(hs->path);
+    if (ftruncate(hs->journal, 0) == 0) {
+        fdatasync(hs->journal);
+        hs->journalRecords = 0;
+    }
+    atomic_fetch_add(&hs->compactions, 1);
+}
+
+static int hiscoreWriter(void* data)
+{
+    HiscoreTable* hs = data;
+    TRACE_THREAD_NAME("hiscore writer");
+
+    for (;;) {
+        if (hs->writeFailed) {
+            SDL_SemWaitTimeout(hs->filled, HISCORE_RETRY_MS);
+        } else {
+            SDL_SemWait(hs->filled);
+        }
+        uint64_t tail = atomic_load(&hs->tail);
+        uint64_t head = atomic_load(&hs->head);
+        if (tail == head) {
+            if (atomic_load(&hs->stopping)) break;
+            continue;
+        }
+
+        // Group commit: append everything queued, then sync once. Stop
+        // at a failed append; that record stays queued for the retry.
+        TRACE_BEGIN("hiscore append");
+        uint64_t first  = tail;
+        bool     failed = false;
+        for (; tail != head; tail++) {
+            const HiscoreRecord* r = &hs->queue[tail % HISCORE_QUEUE_LEN];
+            ssize_t n = write(hs->journal, r, sizeof(*r));
+            if (n != (ssize_t)sizeof(*r)) {
+                if (n > 0 && ftruncate(hs->journal, (off_t)hs->journalRecords *
+                                                    (off_t)sizeof(*r)) != 0) {
+                    printf("hiscore: cannot cut a torn record off %s\n", hs->journalPath);
+                }
+                if (!hs->writeFailed) {
+                    printf("hiscore: writing %s failed (%s), retrying\n", hs->journalPath,
+                           n < 0 ? strerror(errno) : "short write");
+                }
+                failed = true;
+                break;
+            }
+            hiscoreInsert(&hs->diskRanks, r);
+            hs->diskSeq = r->seq;
+            hs->journalRecords++;
+        }
+        atomic_store(&hs->tail, tail);
+        if (tail != first) {
+            fdatasync(hs->journal);
+            atomic_fetch_add(&hs->syncs, 1);
+        }
+        TRACE_END();
+        hs->writeFailed = failed;
+
+        if (failed && atomic_load(&hs->stopping)) {
+            hs->lost = head - tail;     // one last try at exit failed too
+            atomic_store(&hs->tail, head);
+            break;
+        }
+
+        if (hs->journalRecords >= HISCORE_COMPACT_RECORDS) {
+            hiscoreCompact(hs);
+        }
+    }
+    if (hs->journalRecords > 0) {
+        hiscoreCompact(hs);
+    }
+    return 0;
+}
+
+// Loads the table at `path`, recovers its journal and starts the writer.
+bool hiscoreOpen(HiscoreTable* hs, const char* path)
+{
+    memset(hs, 0, sizeof(*hs));
+    hs->journal = -1;
+    snprintf(hs->path, sizeof(hs->path), "%s", path);
+    snprintf(hs->journalPath, sizeof(hs->journalPath), "%s.journal", path);
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    // 1. Compacted table (missing or damaged: start empty)
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(HiscoreFile)) {
+        void* map = mmap(NULL, sizeof(HiscoreFile), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            const HiscoreFile* file = map;
+            if (memcmp(file->magic, "SIHISC1", 8) == 0 &&
+                file->count <= HISCORE_TABLE_SIZE &&
+                file->crc == hiscoreCrc(file, offsetof(HiscoreFile, crc))) {
+                memcpy(hs->ranks.entries, file->entries, sizeof(file->entries));
+                hs->ranks.count = (int)file->count;
+                hs->seq         = file->seq;
+            } else {
+                printf("hiscore: %s is damaged, ignoring it\n", path);
+            }
+            munmap(map, sizeof(HiscoreFile));
+        }
+    }
+    if (fd >= 0) close(fd);
+    uint32_t tableSeq = hs->seq;
+
+    // 2. Journal: replay valid records, cut a torn tail
+    hs->journal = open(hs->journalPath, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (hs->journal < 0) {
+        printf("Cannot open high-score journal %s\n", hs->journalPath);
+        return false;
+    }
+    off_t size = lseek(hs->journal, 0, SEEK_END);
+    off_t valid = 0;
+    int   replayed = 0;
+    if (size > 0) {
+        void* map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, hs->journal, 0);
+        if (map != MAP_FAILED) {
+            const uint8_t* bytes = map;
+            while (valid + (off_t)sizeof(HiscoreRecord) <= size) {
+                HiscoreRecord r;
+                memcpy(&r, bytes + valid, sizeof(r));
+                if (!hiscoreRecordValid(&r)) break;
+                valid += sizeof(r);
+                if (r.seq <= tableSeq) continue;    // already compacted
+                hiscoreInsert(&hs->ranks, &r);
+                hs->seq = r.seq;
+                replayed++;
+            }
+            munmap(map, (size_t)size);
+        }
+        if (valid < size) {
+            if (ftruncate(hs->journal, valid) == 0) fdatasync(hs->journal);
+        }
+    }
+    printf("hiscore: %d entries, %d journal records replayed, %lld torn bytes "
+           "dropped in %.3f ms\n", hs->ranks.count, replayed,
+           (long long)(size - valid),
+           1000.0 * (double)(SDL_GetPerformanceCounter() - start) /
+           (double)SDL_GetPerformanceFrequency());
+
+    hs->diskRanks      = hs->ranks;
+    hs->diskSeq        = hs->seq;
+    hs->journalRecords = (int)(valid / (off_t)sizeof(HiscoreRecord));
+    hs->filled = SDL_CreateSemaphore(0);
+    hs->writer = SDL_CreateThread(hiscoreWriter, "hiscore", hs);
+    return hs->writer != NULL;
+}
+#else
+bool hiscoreOpen(HiscoreTable* hs, const char* path)
+{
+    memset(hs, 0, sizeof(*hs));
+    hs->journal = -1;
+    printf("High scores need POSIX file APIs; not saved on this platform (%s)\n", path);
+    return false;
+}
+#endif
+
+// Game thread: ranks the game immediately and queues it for the writer.
+// Never blocks; a full queue drops the record (and counts it).
+void hiscoreSubmit(HiscoreTable* hs, const GameState* game)
+{
+    if (!hs || !hs->writer || game->score <= 0) return;
+
+    HiscoreRecord r;
+    memset(&r, 0, sizeof(r));
+    r.magic = HISCORE_RECORD_MAGIC;
+    r.seq   = ++hs->seq;
+    r.score = game->score;
+    r.wave  = game->waveIndex + 1;
+    r.ticks = game->tick;
+    r.time  = (int64_t)time(NULL);
+    r.crc   = hiscoreCrc(&r, offsetof(HiscoreRecord, crc));
+    hs->submitted++;
+
+    int rank = hiscoreInsert(&hs->ranks, &r);
+    if (rank > 0) {
+        printf("hiscore: %d is #%d\n", r.score, rank);
+    }
+
+    uint64_t head = atomic_load(&hs->head);
+    if (head - atomic_load(&hs->tail) >= HISCORE_QUEUE_LEN) {
+        hs->dropped++;
+        return;
+    }
+    hs->queue[head % HISCORE_QUEUE_LEN] = r;
+    atomic_store(&hs->head, head + 1);
+    SDL_SemPost(hs->filled);
+}
+
+// Call once per update; submits each game as it ends.
+void hiscoreWatch(HiscoreTable* hs, const GameState* game)
+{
+    if (!hs) return;
+    if (game->gameOver && !hs->wasOver) {
+        hiscoreSubmit(hs, game);
+    }
+    hs->wasOver = game->gameOver;
+}
+
+// Submits a game cut short by quitting (finished ones already are).
+void hiscoreQuit(HiscoreTable* hs, const GameState* game)
+{
+    if (!game->gameOver) {
+        hiscoreSubmit(hs, game);
+    }
+}
+
+// Drains the queue into the journal and prints the table.
+void hiscoreClose(HiscoreTable* hs)
+{
+    if (!hs || !hs->writer) return;
+    atomic_store(&hs->stopping, true);
+    SDL_SemPost(hs->filled);
+    SDL_WaitThread(hs->writer, NULL);
+    hs->writer = NULL;
+
+    printf("hiscore: %llu games submitted, %llu dropped, %llu lost to write errors, "
+           "%llu syncs, %llu compactions\n",
+           (unsigned long long)hs->submitted, (unsigned long long)hs->dropped,
+           (unsigned long long)hs->lost,
+           (unsigned long long)atomic_load(&hs->syncs),
+           (unsigned long long)atomic_load(&hs->compactions));
+    for (int i = 0; i < hs->ranks.count; i++) {
+        printf("  %2d. %6d  (wave %d)\n", i + 1, hs->ranks.entries[i].score,
+               hs->ranks.entries[i].wave);
+    }
+#if !defined(_WIN32)
+    close(hs->journal);
+#endif
+    hs->journal = -1;
+    SDL_DestroySemaphore(hs->filled);
+}
+
+// ------------------ Leaderboard -----------------------
+// `--leaderboard-daemon` turns this binary into a ranking service on a
+// Unix domain socket; games started with `--leaderboard` report each
+// finished game to it. Every message is a LeaderboardMsg header followed
+// by `count` records:
+//   client -> daemon  LB_SUBMIT  LeaderboardEntry[count]
+//   daemon -> client  LB_RANKS   LeaderboardRank[count]
+// The daemon keeps all results in an indexable skip list: every link
+// stores how many entries it jumps over, so insertion returns the new
+// entry's rank in O(log n).
+// On the game side results go through a lock-free queue to a sender
+// thread, which batches them (LEADERBOARD_BATCH per message, or whatever
+// has waited LEADERBOARD_FLUSH_MS), reconnects with backoff and keeps
+// unsent results while the daemon is down. A frame never waits on the
+// socket.
+#define LB_MAGIC   0x42444C53u   // "SLDB"
+#define LB_SUBMIT  1
+#define LB_RANKS   2
+
+typedef struct {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t count;
+} LeaderboardMsg;
+
+typedef struct {
+    int32_t  score;
+    int32_t  wave;
+    uint64_t ticks;
+    int64_t  time;
+    uint32_t instance;   // submitting process id
+    uint32_t pad;
+} LeaderboardEntry;
+
+typedef struct {
+    uint32_t rank;       // 1-based, among all results so far
+    uint32_t total;
+} LeaderboardRank;
+
+// -------- Ranked index (daemon) --------
+typedef struct SkipNode SkipNode;
+typedef struct {
+    SkipNode* next;
+    uint32_t  span;      // entries passed by following this link
+} SkipLink;
+
+struct SkipNode {
+    LeaderboardEntry entry;
+    uint64_t         seq;        // arrival order; earlier ranks first on ties
+    int              levels;
+    SkipLink         links[];
+};
+
+typedef struct {
+    SkipNode* head;
+    int       levels;
+    uint32_t  count;
+    uint64_t  seq;
+    uint32_t  rng;
+} SkipList;
+
+static SkipNode* skipNodeNew(int levels)
+{
+    SkipNode* node = calloc(1, sizeof(SkipNode) + (size_t)levels * sizeof(SkipLink));
+    if (node) node->levels = levels;
+    return node;
+}
+
+static bool skipListInit(SkipList* list)
+{
+    memset(list, 0, sizeof(*list));
+    list->head   = skipNodeNew(SKIPLIST_MAX_LEVEL);
+    list->levels = 1;
+    list->rng    = 0x9E3779B9u;
+    return list->head != NULL;
+}
+
+static void skipListFree(SkipList* list)
+{
+    SkipNode* node = list->head;
+    while (node) {
+        SkipNode* next = node->links[0].next;
+        free(node);
+        node = next;
+    }
+    list->head = NULL;
+}
+
+// Does `a` rank ahead of `b`?
+static inline bool skipBefore(const SkipNode* a, int32_t score, uint64_t seq)
+{
+    return a->entry.score > score || (a->entry.score == score && a->seq < seq);
+}
+
+// Inserts `entry` and returns its 1-based rank (0: out of memory).
+static uint32_t skipListInsert(SkipList* list, const LeaderboardEntry* entry)
+{
+    SkipNode* update[SKIPLIST_MAX_LEVEL];
+    uint32_t  rank[SKIPLIST_MAX_LEVEL];
+    uint64_t  seq = list->seq++;
+
+    SkipNode* node = list->head;
+    for (int l = list->levels - 1; l >= 0; l--) {
+        rank[l] = l == list->levels - 1 ? 0 : rank[l + 1];
+        while (node->links[l].next &&
+               skipBefore(node->links[l].next, entry->score, seq)) {
+            rank[l] += node->links[l].span;
+            node = node->links[l].next;
+        }
+        update[l] = node;
+    }
+
+    int levels = 1;     // p = 1/4 per extra level
+    for (;;) {
+        list->rng ^= list->rng << 13;
+        list->rng ^= list->rng >> 17;
+        list->rng ^= list->rng << 5;
+        if ((list->rng & 3) != 0 || levels == SKIPLIST_MAX_LEVEL) break;
+        levels++;
+    }
+    if (levels > list->levels) {
+        for (int l = list->levels; l < levels; l++) {
+            rank[l]   = 0;
+            update[l] = list->head;
+            update[l]->links[l].span = list->count;
+        }
+        list->levels = levels;
+    }
+
+    SkipNode* added = skipNodeNew(levels);
+    if (!added) return 0;
+    added->entry = *entry;
+    added->seq   = seq;
+    for (int l = 0; l < levels; l++) {
+        added->links[l].next = update[l]->links[l].next;
+        update[l]->links[l].next = added;
+        added->links[l].span = update[l]->links[l].span - (rank[0] - rank[l]);
+        update[l]->links[l].span = rank[0] - rank[l] + 1;
+    }
+    for (int l = levels; l < list->levels; l++) {
+        update[l]->links[l].span++;
+    }
+    list->count++;
+    return rank[0] + 1;
+}
+
+#if !defined(_WIN32)
+static bool leaderboardAddress(struct sockaddr_un* addr, const char* path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        printf("Leaderboard socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+// Reads or writes all of `size` bytes (blocking fds); false on EOF/error.
+static bool lbRecvAll(int fd, void* data, size_t size)
+{
+    uint8_t* p = data;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool lbSendAll(int fd, const void* data, size_t size)
+{
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// -------- Daemon --------
+typedef struct {
+    int     fd;
+    size_t  have;        // bytes of the current message received
+    uint8_t buf[sizeof(LeaderboardMsg) + LEADERBOARD_BATCH * sizeof(LeaderboardEntry)];
+} LeaderboardPeer;
+
+static volatile sig_atomic_t gDaemonStop = 0;
+
+static void leaderboardDaemonSignal(int sig)
+{
+    (void)sig;
+    gDaemonStop = 1;
+}
+
+// Handles the bytes available on `peer`; false when it should be dropped.
+// Peers are non-blocking, so a reply that doesn't fit in the socket
+// buffer (a client that stopped reading) fails here instead of stalling
+// the daemon, and that client is dropped.
+static bool leaderboardPeerRead(LeaderboardPeer* peer, SkipList* list)
+{
+    size_t want = sizeof(LeaderboardMsg);
+    if (peer->have >= sizeof(LeaderboardMsg)) {
+        LeaderboardMsg msg;
+        memcpy(&msg, peer->buf, sizeof(msg));
+        want += (size_t)msg.count * sizeof(LeaderboardEntry);
+    }
+    ssize_t n = recv(peer->fd, peer->buf + peer->have, want - peer->have, 0);
+    if (n <= 0) return n < 0 && (errno == EINTR || errno == EAGAIN);
+    peer->have += (size_t)n;
+    if (peer->have < want) return true;
+
+    LeaderboardMsg msg;
+    memcpy(&msg, peer->buf, sizeof(msg));
+    if (msg.magic != LB_MAGIC || msg.type != LB_SUBMIT || msg.count > LEADERBOARD_BATCH) {
+        return false;
+    }
+    if (want == sizeof(LeaderboardMsg) && msg.count > 0) {
+        return true;        // header only so far; the entries follow
+    }
+
+    struct {
+        LeaderboardMsg  msg;
+        LeaderboardRank ranks[LEADERBOARD_BATCH];
+    } reply;
+    reply.msg.magic = LB_MAGIC;
+    reply.msg.type  = LB_RANKS;
+    reply.msg.count = msg.count;
+    for (int i = 0; i < msg.count; i++) {
+        LeaderboardEntry entry;
+        memcpy(&entry, peer->buf + sizeof(msg) + (size_t)i * sizeof(entry), sizeof(entry));
+        reply.ranks[i].rank = skipListInsert(list, &entry);
+    }
+    for (int i = 0; i < msg.count; i++) {
+        reply.ranks[i].total = list->count;
+    }
+    peer->have = 0;
+    return lbSendAll(peer->fd, &reply,
+                     sizeof(reply.msg) + (size_t)msg.count * sizeof(LeaderboardRank));
+}
+
+int runLeaderboardDaemon(const char* path)
+{
+    struct sockaddr_un addr;
+    if (!leaderboardAddress(&addr, path)) return 1;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, 16) != 0) {
+        printf("Cannot listen on %s: %s\n", path, strerror(errno));
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+
+    SkipList list;
+    if (!skipListInit(&list)) {
+        close(listener);
+        return 1;
+    }
+    signal(SIGINT, leaderboardDaemonSignal);
+    signal(SIGTERM, leaderboardDaemonSignal);
+    printf("leaderboard: listening on %s\n", path);
+
+    static LeaderboardPeer peers[LEADERBOARD_MAX_CLIENTS];
+    int      peerCount = 0;
+    uint64_t batches   = 0;
+    uint32_t reported  = 0;
+
+    while (!gDaemonStop) {
+        struct pollfd fds[LEADERBOARD_MAX_CLIENTS + 1];
+        fds[0].fd     = listener;
+        fds[0].events = peerCount < LEADERBOARD_MAX_CLIENTS ? POLLIN : 0;
+        for (int i = 0; i < peerCount; i++) {
+            fds[i + 1].fd     = peers[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, (nfds_t)peerCount + 1, 1000) <= 0) continue;
+
+        for (int i = peerCount - 1; i >= 0; i--) {
+            if (!fds[i + 1].revents) continue;
+            uint32_t before = list.count;
+            if (!leaderboardPeerRead(&peers[i], &list)) {
+                close(peers[i].fd);
+                peers[i] = peers[--peerCount];
+            } else if (list.count != before) {
+                batches++;
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+                close(fd);
+                fd = -1;
+            }
+            if (fd >= 0) {
+                peers[peerCount].fd   = fd;
+                peers[peerCount].have = 0;
+                peerCount++;
+            }
+        }
+        if (list.count / 1000 != reported / 1000) {
+            reported = list.count;
+            printf("leaderboard: %u results, %llu batches, %d clients\n",
+                   list.count, (unsigned long long)batches, peerCount);
+        }
+    }
+
+    printf("leaderboard: %u results in %llu batches; top scores:\n",
+           list.count, (unsigned long long)batches);
+    const SkipNode* node = list.head->links[0].next;
+    for (int i = 0; node && i < 10; i++, node = node->links[0].next) {
+        printf("  %2d. %6d  (wave %d, pid %u)\n", i + 1, node->entry.score,
+               node->entry.wave, node->entry.instance);
+    }
+    for (int i = 0; i < peerCount; i++) close(peers[i].fd);
+    close(listener);
+    unlink(path);
+    skipListFree(&list);
+    return 0;
+}
+#else
+int runLeaderboardDaemon(const char* path)
+{
+    printf("The leaderboard daemon needs Unix sockets (%s)\n", path);
+    return 1;
+}
+#endif
+
+// -------- Client --------
+typedef struct {
+    char             path[108];
+    LeaderboardEntry queue[LEADERBOARD_QUEUE_LEN];
+    _Atomic uint64_t head;        // next result the game fills
+    _Atomic uint64_t tail;        // next result the sender takes
+    _Atomic bool     stopping;
+    SDL_sem*         filled;
+    SDL_Thread*      sender;
+    bool             wasOver;     // for leaderboardWatch
+
+    // sender thread only
+    int              fd;          // -1: not connected
+    LeaderboardEntry pending[LEADERBOARD_QUEUE_LEN];
+    int              pendingCount;
+    Uint64           oldestTicks; // when pending[0] was taken
+    Uint64           retryTicks;  // no reconnect before this
+
+    // stats
+    uint64_t         submitted;
+    uint64_t         dropped;     // queue full
+    uint64_t         sent;
+    uint64_t         batches;
+    uint64_t         failures;
+} LeaderboardClient;
+
+#if !defined(_WIN32)
+static bool leaderboardConnect(LeaderboardClient* lb)
+{
+    struct sockaddr_un addr;
+    if (!leaderboardAddress(&addr, lb->path)) return false;
+    lb->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lb->fd < 0) return false;
+    struct timeval timeout = { 0, 500000 };     // a dead daemon only stalls this thread
+    setsockopt(lb->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(lb->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(lb->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(lb->fd);
+        lb->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// Sends one batch from the front of pending; false if the daemon is
+// unreachable (the batch stays pending).
+static bool leaderboardSendBatch(LeaderboardClient* lb)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (lb->fd < 0 && (now < lb->retryTicks || !leaderboardConnect(lb))) {
+        if (now >= lb->retryTicks) {
+            lb->retryTicks = now + SDL_GetPerformanceFrequency();   // 1 s backoff
+        }
+        return false;
+    }
+
+    int count = lb->pendingCount < LEADERBOARD_BATCH ? lb->pendingCount : LEADERBOARD_BATCH;
+    LeaderboardMsg msg = { LB_MAGIC, LB_SUBMIT, (uint16_t)count };
+    struct {
+        LeaderboardMsg  msg;
+        LeaderboardRank ranks[LEADERBOARD_BATCH];
+    } reply;
+    TRACE_SCOPE("leaderboard send");
+    if (!lbSendAll(lb->fd, &msg, sizeof(msg)) ||
+        !lbSendAll(lb->fd, lb->pending, (size_t)count * sizeof(LeaderboardEntry)) ||
+        !lbRecvAll(lb->fd, &reply.msg, sizeof(reply.msg)) ||
+        reply.msg.magic != LB_MAGIC || reply.msg.type != LB_RANKS ||
+        reply.msg.count != count ||
+        !lbRecvAll(lb->fd, reply.ranks, (size_t)count * sizeof(LeaderboardRank))) {
+        // The daemon may or may not have ranked this batch; resending
+        // could count it twice, but losing results is worse.
+        close(lb->fd);
+        lb->fd = -1;
+        lb->failures++;
+        lb->retryTicks = now + SDL_GetPerformanceFrequency();
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        printf("leaderboard: %d ranks #%u of %u\n", lb->pending[i].score,
+               reply.ranks[i].rank, reply.ranks[i].total);
+    }
+    lb->pendingCount -= count;
+    memmove(lb->pending, lb->pending + count,
+            (size_t)lb->pendingCount * sizeof(LeaderboardEntry));
+    lb->oldestTicks = now;
+    lb->sent += (uint64_t)count;
+    lb->batches++;
+    return true;
+}
+
+static int leaderboardSender(void* data)
+{
+    LeaderboardClient* lb = data;
+    Uint64 flushTicks = SDL_GetPerformanceFrequency() * LEADERBOARD_FLUSH_MS / 1000;
+    TRACE_THREAD_NAME("leaderboard sender");
+
+    for (;;) {
+        SDL_SemWaitTimeout(lb->filled, LEADERBOARD_FLUSH_MS / 4);
+        bool stopping = atomic_load(&lb->stopping);
+
+        uint64_t tail = atomic_load(&lb->tail);
+        uint64_t head = atomic_load(&lb->head);
+        for (; tail != head && lb->pendingCount < LEADERBOARD_QUEUE_LEN; tail++) {
+            if (lb->pendingCount == 0) lb->oldestTicks = SDL_GetPerformanceCounter();
+            lb->pending[lb->pendingCount++] = lb->queue[tail % LEADERBOARD_QUEUE_LEN];
+        }
+        atomic_store(&lb->tail, tail);
+
+        if (stopping) lb->retryTicks = 0;     // one last try, no backoff
+        while (lb->pendingCount >= LEADERBOARD_BATCH ||
+               (lb->pendingCount > 0 &&
+                (stopping || SDL_GetPerformanceCounter() - lb->oldestTicks >= flushTicks))) {
+            if (!leaderboardSendBatch(lb)) break;
+        }
+        if (stopping && (lb->pendingCount == 0 || lb->fd < 0)) break;
+    }
+    if (lb->fd >= 0) close(lb->fd);
+    return 0;
+}
+
+bool leaderboardOpen(LeaderboardClient* lb, const char* path)
+{
+    memset(lb, 0, sizeof(*lb));
+    lb->fd = -1;
+    snprintf(lb->path, sizeof(lb->path), "%s", path);
+    lb->filled = SDL_CreateSemaphore(0);
+    lb->sender = SDL_CreateThread(leaderboardSender, "leaderboard", lb);
+    return lb->sender != NULL;
+}
+#else
+bool leaderboardOpen(LeaderboardClient* lb, const char* path)
+{
+    memset(lb, 0, sizeof(*lb));
+    printf("The leaderboard needs Unix sockets (%s)\n", path);
+    return false;
+}
+#endif
+
+// Game thread: queues a finished game; never blocks.
+void leaderboardSubmit(LeaderboardClient* lb, const GameState* game)
+{
+    if (!lb || !lb->sender || game->score <= 0) return;
+    LeaderboardEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.score    = game->score;
+    entry.wave     = game->waveIndex + 1;
+    entry.ticks    = game->tick;
+    entry.time     = (int64_t)time(NULL);
+#if !defined(_WIN32)
+    entry.instance = (uint32_t)getpid();
+#endif
+    lb->submitted++;
+
+    uint64_t head = atomic_load(&lb->head);
+    if (head - atomic_load(&lb->tail) >= LEADERBOARD_QUEUE_LEN) {
+        lb->dropped++;
+        return;
+    }
+    lb->queue[head % LEADERBOARD_QUEUE_LEN] = entry;
+    atomic_store(&lb->head, head + 1);
+    SDL_SemPost(lb->filled);
+}
+
+// Call once per update; submits each game as it ends.
+void leaderboardWatch(LeaderboardClient* lb, const GameState* game)
+{
+    if (!lb) return;
+    if (game->gameOver && !lb->wasOver) {
+        leaderboardSubmit(lb, game);
+    }
+    lb->wasOver = game->gameOver;
+}
+
+// Submits a game in progress, then gives the sender one last chance to
+// deliver everything.
+void leaderboardClose(LeaderboardClient* lb, const GameState* game)
+{
+    if (!lb || !lb->sender) return;
+    if (!game->gameOver) {
+        leaderboardSubmit(lb, game);
+    }
+    atomic_store(&lb->stopping, true);
+    SDL_SemPost(lb->filled);
+    SDL_WaitThread(lb->sender, NULL);
+    lb->sender = NULL;
+    SDL_DestroySemaphore(lb->filled);
+
+    printf("leaderboard: %llu results submitted, %llu sent in %llu batches, "
+           "%d unsent, %llu dropped, %llu connection failures\n",
+           (unsigned long long)lb->submitted, (unsigned long long)lb->sent,
+           (unsigned long long)lb->batches, lb->pendingCount,
+           (unsigned long long)lb->dropped, (unsigned long long)lb->failures);
+}
+
+// ------------------ Spectator Broadcast ---------------
+// `--broadcast` publishes every update into a POSIX shared-memory ring
+// that any number of `--spectate` processes map read-only. The game never
+// learns about its viewers and never waits for one.
+// Slot n of the ring (n mod SPECTATE_SLOTS) holds update n. Each slot is
+// a seqlock: its sequence is 2n+1 while being written and 2n+2 once
+// complete. A viewer copies the payload, then checks that the sequence
+// didn't move. A sequence ahead of the one it wants means the writer has
+// lapped it. The viewer then skips ahead to the newest keyframe instead
+// of holding the writer back.
+// A slot starts with the update's events (a count byte, then GameEvents,
+// so viewers get explosions and sounds too). Every
+// SPECTATE_KEYFRAME_TICKS-th slot then holds the full GameState; the
+// others hold a snapshot delta against the previous update.
+#define SPECTATE_MAGIC      0x43455053u   // "SPEC"
+#define SPECTATE_VERSION    5
+#define SPECTATE_KEYFRAME   1u            // SpectateSlot.flags
+#define SPECTATE_SLOT_BYTES ((1 + sizeof(GameEvent) * MAX_EVENTS + \
+                              sizeof(GameState) + 63) & ~(size_t)63)
+
+typedef struct {
+    _Atomic uint64_t seq;
+    uint32_t         size;
+    uint32_t         flags;
+    uint8_t          data[SPECTATE_SLOT_BYTES];
+} SpectateSlot;
+
+typedef struct {
+    uint32_t         magic;
+    uint32_t         version;
+    uint32_t         stateSize;     // sizeof(GameState) of the writer
+    uint32_t         slotCount;
+    _Atomic uint64_t published;     // updates published so far
+    SpectateSlot     slots[SPECTATE_SLOTS];
+} SpectateShared;
+
+// -------- Writer (the game) --------
+typedef struct {
+    SpectateShared* shm;
+    char            name[64];
+    GameState       last;           // state as of the previous publish
+    uint8_t         delta[SNAPSHOT_MAX_BYTES];
+    uint64_t        keyframes;
+    uint64_t        deltaBytes;
+    uint64_t        publishTicks;   // perf counter units
+} SpectateWriter;
+
+#if !defined(_WIN32)
+bool spectateWriterOpen(SpectateWriter* w, const char* name)
+{
+    memset(w, 0, sizeof(*w));
+    snprintf(w->name, sizeof(w->name), "%s", name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(SpectateShared)) != 0) {
+        printf("Cannot create shared memory %s: %s\n", name, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, sizeof(SpectateShared), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Cannot map shared memory %s\n", name);
+        shm_unlink(name);
+        return false;
+    }
+    w->shm = map;
+    w->shm->version   = SPECTATE_VERSION;
+    w->shm->stateSize = sizeof(GameState);
+    w->shm->slotCount = SPECTATE_SLOTS;
+    atomic_store_explicit(&w->shm->published, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    w->shm->magic = SPECTATE_MAGIC;     // last: viewers may look now
+    printf("broadcast: %s, %d slots of %zu bytes\n", name, SPECTATE_SLOTS,
+           (size_t)SPECTATE_SLOT_BYTES);
+    return true;
+}
+
+// Call after every update; never blocks.
+void spectatePublish(SpectateWriter* w, const GameState* game)
+{
+    if (!w || !w->shm) return;
+    TRACE_SCOPE("broadcast");
+    Uint64 start = SDL_GetPerformanceCounter();
+    uint64_t n = atomic_load_explicit(&w->shm->published, memory_order_relaxed);
+    SpectateSlot* slot = &w->shm->slots[n % SPECTATE_SLOTS];
+    int events = game->events ? game->events->count : 0;
+    size_t head = 1 + (size_t)events * sizeof(GameEvent);
+
+    // Encode first so the slot is open for writing as briefly as possible
+    size_t delta = 0;
+    bool   key   = n % SPECTATE_KEYFRAME_TICKS == 0;
+    if (!key) {
+        delta = snapshotEncode(&w->last, game, w->delta);
+        key   = head + delta > sizeof(slot->data);
+    }
+
+    atomic_store_explicit(&slot->seq, 2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->data[0] = (uint8_t)events;
+    if (events) memcpy(slot->data + 1, game->events->list, (size_t)events * sizeof(GameEvent));
+    if (key) {
+        GameState* state = (GameState*)(void*)(slot->data + head);
+        memcpy(state, game, sizeof(*game));
+        state->waves  = NULL;
+        state->events = NULL;
+        slot->flags = SPECTATE_KEYFRAME;
+        slot->size  = (uint32_t)(head + sizeof(GameState));
+        w->keyframes++;
+    } else {
+        memcpy(slot->data + head, w->delta, delta);
+        slot->flags = 0;
+        slot->size  = (uint32_t)(head + delta);
+        w->deltaBytes += delta;
+    }
+    memcpy(&w->last, game, sizeof(*game));
+
+    atomic_store_explicit(&slot->seq, 2 * n + 2, memory_order_release);
+    atomic_store_explicit(&w->shm->published, n + 1, memory_order_release);
+    w->publishTicks += SDL_GetPerformanceCounter() - start;
+}
+
+void spectateWriterClose(SpectateWriter* w)
+{
+    if (!w->shm) return;
+    uint64_t n = atomic_load(&w->shm->published);
+    uint64_t deltas = n > w->keyframes ? n - w->keyframes : 0;
+    printf("broadcast: %llu updates (%llu keyframes), %.1f bytes/delta, "
+           "%.2f us/update\n", (unsigned long long)n,
+           (unsigned long long)w->keyframes,
+           deltas ? (double)w->deltaBytes / (double)deltas : 0.0,
+           n ? 1e6 * (double)w->publishTicks / (double)SDL_GetPerformanceFrequency() /
+               (double)n : 0.0);
+    munmap(w->shm, sizeof(SpectateShared));
+    shm_unlink(w->name);        // mapped viewers keep their view
+    w->shm = NULL;
+}
+#else
+bool spectateWriterOpen(SpectateWriter* w, const char* name)
+{
+    memset(w, 0, sizeof(*w));
+    printf("Broadcasting needs POSIX shared memory (%s)\n", name);
+    return false;
+}
+
+void spectatePublish(SpectateWriter* w, const GameState* game)
+{
+    (void)w; (void)game;
+}
+
+void spectateWriterClose(SpectateWriter* w)
+{
+    (void)w;
+}
+#endif
+
+// -------- Reader (a viewer) --------
+typedef struct {
+    const SpectateShared* shm;
+    GameState    state;         // rebuilt view of the game
+    GameEvents   events;        // collected since the last spectatePoll
+    bool         synced;        // state is valid through update next-1
+    uint64_t     next;
+    uint8_t      buf[SPECTATE_SLOT_BYTES];
+
+    // stats
+    uint64_t     applied;
+    uint64_t     resyncs;
+    uint64_t     skipped;       // updates never seen
+    uint64_t     torn;          // slots overwritten while copying
+    uint64_t     hashMismatches;
+    bool         verify;        // recompute the hash of every update
+} SpectateReader;
+
+enum { SPEC_READ_OK, SPEC_READ_NOT_YET, SPEC_READ_LAPPED };
+
+static int spectateReadSlot(SpectateReader* r, uint64_t n, uint32_t* size,
+                            uint32_t* flags)
+{
+    const SpectateSlot* slot = &r->shm->slots[n % SPECTATE_SLOTS];
+    uint64_t want = 2 * n + 2;
+    uint64_t seq  = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq < want) return SPEC_READ_NOT_YET;
+    if (seq > want) return SPEC_READ_LAPPED;
+    *size  = slot->size;
+    *flags = slot->flags;
+    if (*size > sizeof(r->buf)) *size = sizeof(r->buf);
+    memcpy(r->buf, slot->data, *size);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+        r->torn++;
+        return SPEC_READ_LAPPED;
+    }
+    return SPEC_READ_OK;
+}
+
+// False if the slot couldn't be applied; a bad keyframe or delta also
+// drops sync, so the next poll waits for another keyframe.
+static bool spectateApply(SpectateReader* r, uint32_t size, uint32_t flags)
+{
+    GameState* game   = &r->state;
+    uint32_t   events = size > 0 ? r->buf[0] : 0;
+    uint32_t   head   = 1 + events * (uint32_t)sizeof(GameEvent);
+    if (head > size || events > MAX_EVENTS) return false;
+    for (uint32_t i = 0; i < events && r->events.count < MAX_EVENTS; i++) {
+        memcpy(&r->events.list[r->events.count++], r->buf + 1 + i * sizeof(GameEvent),
+               sizeof(GameEvent));
+    }
+
+    if (flags & SPECTATE_KEYFRAME) {
+        GameState key;
+        if (size - head < sizeof(key)) return false;
+        memcpy(&key, r->buf + head, sizeof(key));
+        if (!gameStateValid(&key)) {
+            r->synced = false;
+            return false;
+        }
+        *game        = key;
+        game->waves  = NULL;
+        game->events = NULL;
+    } else if (!snapshotDecode(game, r->buf + head, size - head, game)) {
+        r->synced = false;      // garbled delta: wait for a keyframe
+        return false;
+    }
+    if (r->verify && stateHashCompute(game).sum != game->hash.sum) {
+        r->hashMismatches++;
+    }
+    r->applied++;
+    return true;
+}
+
+#if !defined(_WIN32)
+bool spectateOpen(SpectateReader* r, const char* name)
+{
+    memset(r, 0, sizeof(*r));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        printf("No broadcast at %s (start a game with --broadcast)\n", name);
+        return false;
+    }
+    void* map = mmap(NULL, sizeof(SpectateShared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Cannot map broadcast %s\n", name);
+        return false;
+    }
+    r->shm = map;
+    if (r->shm->magic != SPECTATE_MAGIC || r->shm->version != SPECTATE_VERSION ||
+        r->shm->stateSize != sizeof(GameState) || r->shm->slotCount != SPECTATE_SLOTS) {
+        printf("Broadcast %s is from an incompatible build\n", name);
+        munmap(map, sizeof(SpectateShared));
+        r->shm = NULL;
+        return false;
+    }
+    return true;
+}
+
+void spectateClose(SpectateReader* r)
+{
+    if (!r->shm) return;
+    printf("spectate: %llu updates applied, %llu skipped over %llu resyncs, "
+           "%llu torn reads", (unsigned long long)r->applied,
+           (unsigned long long)r->skipped, (unsigned long long)r->resyncs,
+           (unsigned long long)r->torn);
+    if (r->verify) {
+        printf(", %llu hash mismatches", (unsigned long long)r->hashMismatches);
+    }
+    printf("\n");
+    munmap((void*)r->shm, sizeof(SpectateShared));
+    r->shm = NULL;
+}
+#else
+bool spectateOpen(SpectateReader* r, const char* name)
+{
+    memset(r, 0, sizeof(*r));
+    printf("Spectating needs POSIX shared memory (%s)\n", name);
+    return false;
+}
+
+void spectateClose(SpectateReader* r)
+{
+    (void)r;
+}
+#endif
+
+// Catches the view up with the broadcast. Returns false until the first
+// keyframe has been seen.
+bool spectatePoll(SpectateReader* r)
+{
+    r->events.count = 0;
+    uint64_t published = atomic_load_explicit(&r->shm->published, memory_order_acquire);
+    uint32_t size, flags;
+
+    // Not synced yet, or about to be lapped: jump to the newest keyframe
+    if (published > 0 &&
+        (!r->synced || published - r->next > SPECTATE_SLOTS - SPECTATE_KEYFRAME_TICKS)) {
+        uint64_t key = (published - 1) / SPECTATE_KEYFRAME_TICKS * SPECTATE_KEYFRAME_TICKS;
+        if (key >= r->next || !r->synced) {
+            if (spectateReadSlot(r, key, &size, &flags) == SPEC_READ_OK &&
+                (flags & SPECTATE_KEYFRAME)) {
+                if (r->synced || key > r->next) {
+                    r->skipped += key > r->next ? key - r->next : 0;
+                    r->resyncs += r->synced;
+                }
+                r->synced = spectateApply(r, size, flags);
+                r->next   = key + 1;
+            }
+        }
+    }
+    while (r->synced && r->next < published) {
+        int got = spectateReadSlot(r, r->next, &size, &flags);
+        if (got == SPEC_READ_NOT_YET) break;
+        if (got == SPEC_READ_LAPPED) {
+            r->synced = false;      // resync at the next poll
+            r->resyncs++;
+            break;
+        }
+        spectateApply(r, size, flags);
+        r->next++;
+    }
+    return r->synced;
+}
 
-// ------------------ Bullet Settings ------------------
-#define BULLET_SPEED       7
-#define BULLET_WIDTH       4
-#define BULLET_HEIGHT     10
-#define MAX_BULLETS        5
+// Headless viewer: follows the broadcast for `frames` 60 Hz frames and
+// checks every rebuilt update against the publisher's hash.
+int runSpectatorHeadless(const char* name, long long frames)
+{
+    static SpectateReader reader;   // GameState + slot buffer; keep off the stack
+    if (!spectateOpen(&reader, name)) return 1;
+    reader.verify = true;
+    for (long long f = 0; f < frames; f++) {
+        spectatePoll(&reader);
+        SDL_Delay(1000 / SIM_HZ);
+    }
+    printf("spectate: last update %llu, score %d, lives %d\n",
+           (unsigned long long)reader.state.tick, reader.state.score,
+           reader.state.lives);
+    bool ok = reader.hashMismatches == 0 && reader.applied > 0;
+    spectateClose(&reader);
+    return ok ? 0 : 1;
+}
 
-// ------------------ Alien Settings -------------------
-#define ALIEN_COUNT        8
-#define ALIEN_WIDTH       32    // alien.jpg width
-#define ALIEN_HEIGHT      32    // alien.jpg height
-#define ALIEN_START_X     50
-#define ALIEN_START_Y     50
-#define ALIEN_SPACING     50
-#define ALIEN_SPEED        1
-#define ALIEN_DESCENT     20
+// ------------------ Simulation Thread -----------------
+// With --threaded the game runs on its own thread at a fixed SIM_HZ and
+// the main thread only handles input and renders, so a slow
+// SDL_RenderPresent (vsync) never delays a tick. After every tick the sim
+// publishes an immutable snapshot of the state through a lock-free triple
+// buffer: the writer fills its private back slot and swaps it with the
+// shared middle slot; the reader swaps the middle with its front slot
+// only if the middle is newer. Neither side ever waits for the other.
+// Effect events of snapshots the renderer never saw are carried into the
+// next one so no explosion is lost.
+#define SNAP_FRESH 4u   // middle slot holds a snapshot the reader hasn't taken
 
-// ------------------ Game Logic Globals ----------------
-static bool gRunning    = true;
-static bool gGameOver   = false;
-static int  gLives      = PLAYER_LIVES;
-static int  gScore      = 0;
-static int  gAlienMoveDir = 1; // +1: right, -1: left
+typedef struct {
+    GameState  game;     // events/waves pointers are for display only
+    GameEvents events;   // effect events since the last consumed snapshot
+} RenderSnapshot;
 
-// ------------------ Data Structures -------------------
 typedef struct {
-    int x, y;
-    int w, h;
-    int vx;  // velocity in x-axis
-} Player;
+    RenderSnapshot slots[3];
+    atomic_uint    middle;   // slot index | SNAP_FRESH
+    unsigned       back;     // owned by the writer
+    unsigned       front;    // owned by the reader
+    bool           carry;    // back slot's events were never consumed
+} SnapshotBuffer;
+
+typedef struct {
+    GameState*     game;
+    GameEvents     events;
+    SnapshotBuffer snapshots;
+    AudioMixer*    mixer;
+    FILE*          hashLog;
+    ReplayWriter*  recorder;
+    SpectateWriter* broadcast;
+
+    atomic_int     move;       // held direction, written by the main thread
+    atomic_bool    fire;       // key-press latches, cleared by the sim
+    atomic_bool    restart;
+    atomic_bool    quit;
+    SDL_Thread*    thread;
+    unsigned       configSeen; // config version the game has (see configAdopt)
+
+    // Sim-side timing (read after the thread has joined)
+    uint64_t       ticks;
+    uint64_t       lateTicks;  // started more than a tick late
+    uint64_t       dropped;    // snapshots overwritten before being read
+    Uint64         tickTotal;  // update + publish, performance counter units
+    Uint64         tickMax;
+
+    // Render-side timing
+    uint64_t       frames;
+    uint64_t       repeats;    // frames that found no new snapshot
+    Uint64         frameTotal;
+    Uint64         presentTotal;
+    Uint64         presentMax;
+} SimThread;
+
+static void snapshotPublish(SnapshotBuffer* buf, const GameState* game,
+                            const GameEvents* events)
+{
+    RenderSnapshot* snap = &buf->slots[buf->back];
+    if (!buf->carry) snap->events.count = 0;
+    memcpy(&snap->game, game, sizeof(*game));
+    for (int i = 0; i < events->count && snap->events.count < MAX_EVENTS; i++) {
+        snap->events.list[snap->events.count++] = events->list[i];
+    }
+
+    unsigned prev = atomic_exchange_explicit(&buf->middle, buf->back | SNAP_FRESH,
+                                             memory_order_acq_rel);
+    buf->back  = prev & 3u;
+    buf->carry = (prev & SNAP_FRESH) != 0;
+}
+
+// Returns the newest snapshot; *fresh is false if it was already seen.
+static const RenderSnapshot* snapshotAcquire(SnapshotBuffer* buf, bool* fresh)
+{
+    *fresh = (atomic_load_explicit(&buf->middle, memory_order_relaxed) & SNAP_FRESH) != 0;
+    if (*fresh) {
+        unsigned prev = atomic_exchange_explicit(&buf->middle, buf->front,
+                                                 memory_order_acq_rel);
+        buf->front = prev & 3u;
+    }
+    return &buf->slots[buf->front];
+}
+
+static int simThreadMain(void* data)
+{
+    SimThread* sim  = data;
+    Uint64     freq = SDL_GetPerformanceFrequency();
+    Uint64     step = freq / SIM_HZ;
+    Uint64     next = SDL_GetPerformanceCounter();
+    TRACE_THREAD_NAME("sim");
+
+    while (!atomic_load_explicit(&sim->quit, memory_order_acquire)) {
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now < next) {
+            SDL_Delay((Uint32)((next - now) * 1000 / freq));
+            continue;
+        }
+        if (now > next + step) {
+            sim->lateTicks++;
+            next = now;       // don't try to catch up in a burst
+        }
+        next += step;
+
+        GameInput input;
+        input.move    = atomic_load_explicit(&sim->move, memory_order_relaxed);
+        input.fire    = atomic_exchange_explicit(&sim->fire, false, memory_order_relaxed);
+        input.restart = atomic_exchange_explicit(&sim->restart, false, memory_order_relaxed);
+
+        TRACE_BEGIN("sim tick");
+        configAdopt(sim->game, &sim->configSeen);
+        replayRecord(sim->recorder, sim->game, &input);
+        updateGame(sim->game, &input);
+        logStateHash(sim->hashLog, sim->game);
+        spectatePublish(sim->broadcast, sim->game);
+        if (sim->mixer) audioPlayEvents(sim->mixer, &sim->events);
+        TRACE_BEGIN("publish snapshot");
+        snapshotPublish(&sim->snapshots, sim->game, &sim->events);
+        TRACE_END();
+        TRACE_END();
+        sim->dropped += sim->snapshots.carry;
+
+        Uint64 cost = SDL_GetPerformanceCounter() - now;
+        sim->tickTotal += cost;
+        if (cost > sim->tickMax) sim->tickMax = cost;
+        sim->ticks++;
+    }
+    return 0;
+}
+
+// Takes ownership of `game` until simThreadStop; the caller only looks
+// at snapshots in between.
+bool simThreadStart(SimThread* sim, GameState* game, AudioMixer* mixer,
+                    FILE* hashLog, ReplayWriter* recorder,
+                    SpectateWriter* broadcast)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->game     = game;
+    sim->mixer    = mixer;
+    sim->hashLog  = hashLog;
+    sim->recorder  = recorder;
+    sim->broadcast = broadcast;
+    game->events = &sim->events;
+    sim->events.count = 0;
+
+    for (int i = 0; i < 3; i++) {
+        memcpy(&sim->snapshots.slots[i].game, game, sizeof(*game));
+    }
+    sim->snapshots.back  = 1;
+    sim->snapshots.front = 0;
+    atomic_init(&sim->snapshots.middle, 2u);
+    atomic_init(&sim->move, 0);
+    atomic_init(&sim->fire, false);
+    atomic_init(&sim->restart, false);
+    atomic_init(&sim->quit, false);
+
+    sim->thread = SDL_CreateThread(simThreadMain, "sim", sim);
+    if (!sim->thread) {
+        printf("Sim thread creation failed: %s\n", SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+// Called by the main thread once per frame with the polled input.
+void simThreadInput(SimThread* sim, const GameInput* input)
+{
+    atomic_store_explicit(&sim->move, input->move, memory_order_relaxed);
+    if (input->fire)    atomic_store_explicit(&sim->fire, true, memory_order_relaxed);
+    if (input->restart) atomic_store_explicit(&sim->restart, true, memory_order_relaxed);
+}
+
+void simThreadStop(SimThread* sim)
+{
+    if (!sim->thread) return;
+    atomic_store_explicit(&sim->quit, true, memory_order_release);
+    SDL_WaitThread(sim->thread, NULL);
+    sim->thread = NULL;
+
+    double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    printf("sim thread: %llu ticks, update %.3f ms avg / %.3f ms max, "
+           "%llu late, %llu snapshots unseen\n",
+           (unsigned long long)sim->ticks,
+           sim->ticks ? (double)sim->tickTotal * ms / (double)sim->ticks : 0.0,
+           (double)sim->tickMax * ms,
+           (unsigned long long)sim->lateTicks, (unsigned long long)sim->dropped);
+    printf("render thread: %llu frames, frame %.3f ms avg, present %.3f ms avg / "
+           "%.3f ms max, %llu frames without a new snapshot\n",
+           (unsigned long long)sim->frames,
+           sim->frames ? (double)sim->frameTotal * ms / (double)sim->frames : 0.0,
+           sim->frames ? (double)sim->presentTotal * ms / (double)sim->frames : 0.0,
+           (double)sim->presentMax * ms, (unsigned long long)sim->repeats);
+}
+
+// ------------------ Performance Counters --------------
+// --perf-log FILE (Linux only) opens hardware counters for the main
+// thread with perf_event_open as one group, so a single read() returns
+// all of them at the same instant. The loop reads the group at the start
+// of a frame, after the update and after rendering, and appends the
+// per-phase deltas to a binary log:
+//   header: char magic[8] = "SIPERF1", uint32 counters, uint32 recordSize
+//   record: uint64 frame, uint64 update[counters], uint64 render[counters]
+// in native byte order, counters in PERF_* order. Kernel time is
+// excluded, so perf_event_paranoid <= 2 is enough. With --threaded the
+// update phase is the snapshot pickup, not the simulation.
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES,
+       PERF_COUNTERS };
+enum { PERF_PHASE_UPDATE, PERF_PHASE_RENDER, PERF_PHASES };
 
 typedef struct {
-    int x, y;
-    int w, h;
-    bool active;
-} Bullet;
+    uint64_t frame;
+    uint64_t phase[PERF_PHASES][PERF_COUNTERS];
+} PerfRecord;
 
 typedef struct {
-    int x, y;
-    int w, h;
-    bool active;
-} Alien;
+    int        fd[PERF_COUNTERS];   // fd[0] leads the group
+    FILE*      log;
+    uint64_t   last[PERF_COUNTERS];
+    PerfRecord record;
+    uint64_t   total[PERF_PHASES][PERF_COUNTERS];
+} PerfCounters;
 
-// ------------------ Collision Check -------------------
-bool rect_collide(int x1, int y1, int w1, int h1,
-                  int x2, int y2, int w2, int h2)
+#if defined(__linux__)
+static bool perfRead(PerfCounters* pc, uint64_t out[PERF_COUNTERS])
 {
-    return (x1 < x2 + w2) && (x1 + w1 > x2) &&
-           (y1 < y2 + h2) && (y1 + h1 > y2);
+    uint64_t buf[1 + PERF_COUNTERS];   // PERF_FORMAT_GROUP: nr, values...
+    if (read(pc->fd[0], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) return false;
+    memcpy(out, buf + 1, sizeof(uint64_t) * PERF_COUNTERS);
+    return true;
 }
 
-// ------------------ Texture Loading -------------------
-SDL_Texture* loadTexture(SDL_Renderer* renderer, const char* path)
+bool perfOpen(PerfCounters* pc, const char* path)
 {
-    SDL_Surface* surface = IMG_Load(path);
-    if (!surface) {
-        printf("IMG_Load failed for %s: %s\n", path, IMG_GetError());
-        return NULL;
+    static const uint64_t configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    static const char* names[PERF_COUNTERS] = {
+        "cycles", "instructions", "cache-misses", "branch-misses"
+    };
+    memset(pc, 0, sizeof(*pc));
+    for (int i = 0; i < PERF_COUNTERS; i++) pc->fd[i] = -1;
+
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.config         = configs[i];
+        attr.read_format    = PERF_FORMAT_GROUP;
+        attr.disabled       = i == 0;   // the leader starts the group
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        pc->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+                                 i == 0 ? -1 : pc->fd[0], 0);
+        if (pc->fd[i] < 0) {
+            printf("perf_event_open(%s) failed; running without counters\n", names[i]);
+            for (int k = 0; k < i; k++) close(pc->fd[k]);
+            return false;
+        }
     }
-    SDL_Texture* tex = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_FreeSurface(surface);
-    return tex;
+
+    pc->log = fopen(path, "wb");
+    if (!pc->log) {
+        printf("Cannot open perf log %s\n", path);
+        for (int i = 0; i < PERF_COUNTERS; i++) close(pc->fd[i]);
+        return false;
+    }
+    char     magic[8]   = "SIPERF1";
+    uint32_t counters   = PERF_COUNTERS;
+    uint32_t recordSize = sizeof(PerfRecord);
+    fwrite(magic, 1, sizeof(magic), pc->log);
+    fwrite(&counters, sizeof(counters), 1, pc->log);
+    fwrite(&recordSize, sizeof(recordSize), 1, pc->log);
+
+    ioctl(pc->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+#else
+static bool perfRead(PerfCounters* pc, uint64_t out[PERF_COUNTERS])
+{
+    (void)pc; (void)out;
+    return false;
 }
 
-// ------------------ Text Rendering --------------------
-SDL_Texture* renderText(SDL_Renderer* renderer, TTF_Font* font,
-                        const char* message, SDL_Color color,
-                        int* outWidth, int* outHeight)
+bool perfOpen(PerfCounters* pc, const char* path)
 {
-    SDL_Surface* surf = TTF_RenderText_Solid(font, message, color);
-    if (!surf) {
-        printf("TTF_RenderText_Solid failed: %s\n", TTF_GetError());
-        return NULL;
+    (void)path;
+    memset(pc, 0, sizeof(*pc));
+    printf("--perf-log needs Linux perf_event_open; running without counters\n");
+    return false;
+}
+#endif
+
+// All of these are no-ops unless perfOpen succeeded.
+void perfFrameBegin(PerfCounters* pc)
+{
+    if (pc->log) perfRead(pc, pc->last);
+}
+
+void perfPhaseEnd(PerfCounters* pc, int phase)
+{
+    uint64_t now[PERF_COUNTERS];
+    if (!pc->log || !perfRead(pc, now)) return;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        pc->record.phase[phase][i] = now[i] - pc->last[i];
+        pc->total[phase][i]       += now[i] - pc->last[i];
+        pc->last[i] = now[i];
     }
-    SDL_Texture* textTex = SDL_CreateTextureFromSurface(renderer, surf);
-    *outWidth  = surf->w;
-    *outHeight = surf->h;
-    SDL_FreeSurface(surf);
-    return textTex;
 }
 
-// ------------------ Game Reset Function ----------------
-void resetGame(Player* player, Bullet* bullets, Alien* aliens, int alienCount)
+void perfFrameEnd(PerfCounters* pc)
+{
+    if (!pc->log) return;
+    fwrite(&pc->record, sizeof(pc->record), 1, pc->log);
+    pc->record.frame++;
+}
+
+void perfClose(PerfCounters* pc)
 {
-    // Reset global states
-    gLives      = PLAYER_LIVES;
-    gScore      = 0;
-    gGameOver   = false;
-    gAlienMoveDir = 1;
+    if (!pc->log) return;
+    uint64_t frames = pc->record.frame ? pc->record.frame : 1;
+    static const char* phaseNames[PERF_PHASES] = { "update", "render" };
+    for (int p = 0; p < PERF_PHASES; p++) {
+        const uint64_t* t = pc->total[p];
+        printf("perf: %-6s %.0f cycles/frame, IPC %.2f, %.1f cache misses, "
+               "%.1f branch misses per frame\n", phaseNames[p],
+               (double)t[PERF_CYCLES] / (double)frames,
+               t[PERF_CYCLES] ? (double)t[PERF_INSTRUCTIONS] / (double)t[PERF_CYCLES] : 0.0,
+               (double)t[PERF_CACHE_MISSES] / (double)frames,
+               (double)t[PERF_BRANCH_MISSES] / (double)frames);
+    }
+    fclose(pc->log);
+    pc->log = NULL;
+#if defined(__linux__)
+    for (int i = 0; i < PERF_COUNTERS; i++) close(pc->fd[i]);
+#endif
+}
+
+// ------------------ Headless Run ----------------------
+// Renders the autopilot's game with SDL's software renderer into an
+// offscreen surface; no window or display is needed.
+int runHeadless(long long frames, const char* exportPath, bool exportIsPipe,
+                WaveSource* waves, bool withAudio, int timeScale, FILE* hashLog,
+                const char* perfLogPath, const ReplaySession* replay,
+                HiscoreTable* scores, LeaderboardClient* board,
+                SpectateWriter* broadcast, int internalW, int internalH,
+                bool softBlit, Config* config, ConfigWatch* configWatch)
+{
+    if (SDL_Init(0) < 0) {
+        printf("SDL failed: %s\n", SDL_GetError());
+        return 1;
+    }
+    if (!(IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG) || TTF_Init() == -1) {
+        printf("SDL_image/SDL_ttf init failed\n");
+        SDL_Quit();
+        return 1;
+    }
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(
+        0, WINDOW_WIDTH, WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer* renderer = surface ? SDL_CreateSoftwareRenderer(surface) : NULL;
+    RenderAssets assets;
+    if (!renderer || !loadAssets(renderer, &assets, false)) {
+        printf("Headless renderer setup failed: %s\n", SDL_GetError());
+        if (renderer) SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
+        TTF_Quit();
+        IMG_Quit();
+        SDL_Quit();
+        return 1;
+    }
 
-    // Reset player
-    player->w  = PLAYER_WIDTH;
-    player->h  = PLAYER_HEIGHT;
-    player->x  = (WINDOW_WIDTH - player->w) / 2;
-    player->y  = WINDOW_HEIGHT - (player->h + 40);
-    player->vx = 0;
+    Capture capture;
+    memset(&capture, 0, sizeof(capture));
+    int rc = 0;
+    if (exportPath && !captureOpen(&capture, renderer, WINDOW_WIDTH, WINDOW_HEIGHT,
+                                   exportPath, exportIsPipe, true)) {
+        rc = 1;
+    }
+
+    LowResTarget lowRes;
+    memset(&lowRes, 0, sizeof(lowRes));
+    if (internalW > 0 && !lowResOpen(&lowRes, renderer, internalW, internalH)) {
+        rc = 1;
+    }
+
+    SoftBlitter soft;
+    memset(&soft, 0, sizeof(soft));
+    if (softBlit && !softBlitOpen(&soft)) {
+        rc = 1;
+    }
+
+    AudioMixer mixer;
+    memset(&mixer, 0, sizeof(mixer));
+    if (withAudio) audioOpen(&mixer);
+
+    ParticleSystem particles;
+    if (!particlesInit(&particles, config->particles)) {
+        printf("Particle pool allocation failed\n");
+        rc = 1;
+    }
 
-    // Reset bullets
-    for (int i = 0; i < MAX_BULLETS; i++) {
-        bullets[i].active = false;
-        bullets[i].x = 0;
-        bullets[i].y = 0;
-        bullets[i].w = BULLET_WIDTH;
-        bullets[i].h = BULLET_HEIGHT;
+    PerfCounters perf;
+    memset(&perf, 0, sizeof(perf));
+    if (perfLogPath) perfOpen(&perf, perfLogPath);
+
+    GameState  game;
+    GameInput  input;
+    GameEvents events;
+    memset(&game, 0, sizeof(game));
+    game.waves     = waves;
+    game.events    = &events;
+    game.timeScale = timeScale;
+    game.config    = config->sim;
+    if (replay->player) replayConfig(replay->player, 0, &game);
+    resetGame(&game);
+
+    uint64_t replayFrame = replay->seek;
+    uint64_t desyncs     = 0;
+    unsigned configSeen  = 0;
+    if (replay->player && replayFrame > 0) {
+        replaySeek(replay->player, &game, replayFrame);
     }
 
-    // Reset aliens
-    for (int i = 0; i < alienCount; i++) {
-        aliens[i].active = true;
-        aliens[i].w = ALIEN_WIDTH;
-        aliens[i].h = ALIEN_HEIGHT;
-        aliens[i].x = ALIEN_START_X + i * ALIEN_SPACING;
-        aliens[i].y = ALIEN_START_Y;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (long long f = 0; f < frames && rc == 0; f++) {
+        TRACE_SCOPE("frame");
+        perfFrameBegin(&perf);
+        if (configReload(configWatch, config)) {
+            particlesResize(&particles, config->particles);
+        }
+        if (replay->player) {
+            desyncs += !replayVerify(replay->player, replayFrame, &game);
+            replayConfig(replay->player, replayFrame, &game);
+            if (!replayInput(replay->player, replayFrame++, &input)) break;
+        } else {
+            configAdopt(&game, &configSeen);
+            autopilotInput(&game, &input);
+        }
+        replayRecord(replay->recorder, &game, &input);
+        updateGame(&game, &input);
+        spectatePublish(broadcast, &game);
+        hiscoreWatch(scores, &game);
+        leaderboardWatch(board, &game);
+        logStateHash(hashLog, &game);
+        audioPlayEvents(&mixer, &events);
+        particlesSpawnFromEvents(&particles, &events);
+        particlesUpdate(&particles);
+        perfPhaseEnd(&perf, PERF_PHASE_UPDATE);
+
+        if (capture.out) {
+            captureBeginFrame(&capture);
+            lowResRender(&lowRes, renderer, &game, &assets, &particles);
+            TRACE_BEGIN("capture readback");
+            captureEndFrame(&capture);
+            TRACE_END();
+        } else if (softBlit) {
+            softRenderSurface(&soft, surface, &game, &particles);
+        } else {
+            lowResRender(&lowRes, renderer, &game, &assets, &particles);
+        }
+        perfPhaseEnd(&perf, PERF_PHASE_RENDER);
+        perfFrameEnd(&perf);
     }
+    double secs = (double)(SDL_GetPerformanceCounter() - start) /
+                  (double)SDL_GetPerformanceFrequency();
+    captureClose(&capture);
+    lowResClose(&lowRes);
+    softBlitClose(&soft);
+    audioClose(&mixer);
+    particlesFree(&particles);
+    perfClose(&perf);
+    printf("headless: %lld frames in %.3f s, final score %d\n",
+           frames, secs, game.score);
+    hiscoreQuit(scores, &game);
+    leaderboardClose(board, &game);
+    if (replay->player) {
+        printf("replay: played to update %llu, %llu keyframe mismatches\n",
+               (unsigned long long)replayFrame, (unsigned long long)desyncs);
+    }
+
+    freeAssets(&assets);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(surface);
+    TTF_Quit();
+    IMG_Quit();
+    SDL_Quit();
+    return rc;
 }
 
 // ------------------ Main -----------------------------
 int main(int argc, char* argv[])
 {
+    // 0. Command line
+    const char* hashLogPath  = NULL;
+    const char* exportPath   = NULL;
+    bool        exportIsPipe = false;
+    bool        headless     = false;
+    long long   frames       = 0;
+    long long   benchTicks   = 0;
+    bool        withAudio    = true;
+    const char* wavePath     = NULL;
+    bool        endless      = false;
+    uint32_t    waveSeed     = 1;
+    int         timeScale    = 1;
+    bool        threaded     = false;
+    const char* perfLogPath  = NULL;
+    const char* recordPath   = NULL;
+    const char* replayPath   = NULL;
+    long long   seekTo       = 0;
+    const char* scoresPath   = NULL;
+    bool        withScores   = true;
+    const char* boardPath    = NULL;
+    const char* broadcastName = NULL;
+    const char* spectateName = NULL;
+    int         internalW    = 0;
+    int         internalH    = 0;
+    bool        softBlit     = false;
+    const char* configPath   = NULL;
+#ifdef ENABLE_TRACE
+    const char* tracePath    = NULL;
+#endif
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hash-log") == 0 && i + 1 < argc) {
+            hashLogPath = argv[++i];
+        } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            exportPath   = argv[++i];
+            exportIsPipe = false;
+        } else if (strcmp(argv[i], "--export-pipe") == 0 && i + 1 < argc) {
+            exportPath   = argv[++i];
+            exportIsPipe = true;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--no-audio") == 0) {
+            withAudio = false;
+        } else if (strcmp(argv[i], "--waves") == 0 && i + 1 < argc) {
+            wavePath = argv[++i];
+        } else if (strcmp(argv[i], "--endless") == 0) {
+            endless = true;
+        } else if (strcmp(argv[i], "--wave-seed") == 0 && i + 1 < argc) {
+            waveSeed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+#ifdef ENABLE_TRACE
+            tracePath = argv[++i];
+#else
+            printf("--trace needs a build with -DENABLE_TRACE\n");
+            return 1;
+#endif
+        } else if (strcmp(argv[i], "--perf-log") == 0 && i + 1 < argc) {
+            perfLogPath = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+            seekTo = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--scores") == 0 && i + 1 < argc) {
+            scoresPath = argv[++i];
+        } else if (strcmp(argv[i], "--no-scores") == 0) {
+            withScores = false;
+        } else if (strcmp(argv[i], "--leaderboard-daemon") == 0) {
+            const char* socketPath = LEADERBOARD_SOCKET;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                socketPath = argv[++i];
+            }
+            return runLeaderboardDaemon(socketPath);
+        } else if (strcmp(argv[i], "--leaderboard") == 0) {
+            boardPath = LEADERBOARD_SOCKET;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                boardPath = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--broadcast") == 0) {
+            broadcastName = SPECTATE_NAME;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                broadcastName = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--spectate") == 0) {
+            spectateName = SPECTATE_NAME;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                spectateName = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--internal-res") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &internalW, &internalH) != 2 ||
+                internalW < 16 || internalH < 16 || internalW > 4096 || internalH > 4096) {
+                printf("--internal-res wants WIDTHxHEIGHT, 16..4096 each\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--soft-blit") == 0) {
+            softBlit = true;
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            configPath = argv[++i];
+        } else if (strcmp(argv[i], "--threaded") == 0) {
+            threaded = true;
+        } else if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            timeScale = atoi(argv[++i]);
+            if (timeScale < 1 || timeScale > MAX_TIME_SCALE) {
+                printf("--time-scale must be 1..%d\n", MAX_TIME_SCALE);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchTicks = BENCH_DEFAULT_TICKS;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                benchTicks = atoll(argv[++i]);
+            }
+        } else {
+            printf("Unknown argument: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (softBlit && (exportPath || internalW > 0)) {
+        printf("--soft-blit draws without a renderer; it can't be combined "
+               "with --export or --internal-res\n");
+        return 1;
+    }
+
+    // Run-time tunables: the defaults, or the --config file over them
+    Config      config;
+    ConfigWatch configWatch = { NULL, -1, "" };
+    configDefaults(&config);
+    if (configPath && !configLoad(configPath, &config)) {
+        return 1;
+    }
+
+    TRACE_INIT();
+
+    FILE* hashLog = NULL;
+    if (hashLogPath) {
+        hashLog = fopen(hashLogPath, "w");
+        if (!hashLog) {
+            printf("Cannot open hash log %s\n", hashLogPath);
+            return 1;
+        }
+    }
+
+    // Collision masks come from the sprite images in every mode, so the
+    // simulation (and its hash) is the same with or without a window.
+    collisionMasksLoad("ship.png", "alien.jpg");
+
+    if (benchTicks > 0) {
+        int rc = runBenchmark(benchTicks, timeScale, hashLog, &config.sim);
+        TRACE_DUMP(tracePath);
+        if (hashLog) fclose(hashLog);
+        return rc;
+    }
+
+    if (spectateName && headless) {
+        if (hashLog) fclose(hashLog);
+        return runSpectatorHeadless(spectateName, frames > 0 ? frames : 600);
+    }
+
+    // Replays: playback takes its session settings from the file
+    ReplayReader  reader;
+    ReplayWriter  writer;
+    ReplaySession replay = { NULL, NULL, 0 };
+    memset(&writer, 0, sizeof(writer));
+    if (replayPath) {
+        if ((recordPath || threaded) ||
+            !replayOpen(&reader, replayPath)) {
+            if (recordPath || threaded) {
+                printf("--replay can't be combined with --record or --threaded\n");
+            }
+            if (hashLog) fclose(hashLog);
+            return 1;
+        }
+        static char replayWaves[sizeof(reader.header.wavePath)];
+        memcpy(replayWaves, reader.header.wavePath, sizeof(replayWaves));
+        replayWaves[sizeof(replayWaves) - 1] = '\0';
+        wavePath  = replayWaves[0] ? replayWaves : NULL;
+        endless   = reader.header.endless != 0;
+        waveSeed  = reader.header.waveSeed;
+        timeScale = reader.header.timeScale;
+        replay.player = &reader;
+        replay.seek   = seekTo > 0 ? (uint64_t)seekTo : 0;
+    } else if (recordPath) {
+        ReplayHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "SIREPLAY", 8);
+        header.version          = REPLAY_VERSION;
+        header.keyframeInterval = REPLAY_KEYFRAME_TICKS;
+        header.stateSize        = sizeof(GameState);
+        header.timeScale        = timeScale;
+        header.waveSeed         = waveSeed;
+        header.endless          = endless;
+        if (wavePath) {
+            snprintf(header.wavePath, sizeof(header.wavePath), "%s", wavePath);
+        }
+        if (!replayWriterOpen(&writer, recordPath, &header)) {
+            if (hashLog) fclose(hashLog);
+            return 1;
+        }
+        replay.recorder = &writer;
+    }
+
+    // Wave stream (classic single wave when neither flag is given)
+    WaveSource  waveStorage;
+    WaveSource* waveSource = NULL;
+    if (wavePath || endless) {
+        if (!waveSourceOpen(&waveStorage, wavePath, endless, waveSeed)) {
+            waveSourceClose(&waveStorage);
+            if (hashLog) fclose(hashLog);
+            return 1;
+        }
+        waveSource = &waveStorage;
+    }
+
+    // High scores: kept for windowed games, headless runs opt in with
+    // --scores; replays never submit
+    HiscoreTable  scoreStorage;
+    HiscoreTable* scores = NULL;
+    bool playing = !replay.player && !spectateName;
+    if (withScores && playing && (scoresPath || !headless) &&
+        hiscoreOpen(&scoreStorage, scoresPath ? scoresPath : HISCORE_PATH)) {
+        scores = &scoreStorage;
+    }
+    LeaderboardClient  boardStorage;
+    LeaderboardClient* board = NULL;
+    if (boardPath && playing && leaderboardOpen(&boardStorage, boardPath)) {
+        board = &boardStorage;
+    }
+    SpectateWriter  broadcastStorage;
+    SpectateWriter* broadcast = NULL;
+    if (broadcastName && !spectateName &&
+        spectateWriterOpen(&broadcastStorage, broadcastName)) {
+        broadcast = &broadcastStorage;
+    }
+
+    // Hot reload: the loops below poll the watch once per frame
+    if (configPath) configWatchOpen(&configWatch, configPath);
+
+    if (headless) {
+        long long run = frames > 0 ? frames : 600;
+        if (frames <= 0 && replay.player) {
+            run = replay.seek < reader.frames ? (long long)(reader.frames - replay.seek) : 0;
+        }
+        int rc = runHeadless(run, exportPath, exportIsPipe, waveSource, withAudio,
+                             timeScale, hashLog, perfLogPath, &replay, scores, board, broadcast,
+                             internalW, internalH, softBlit, &config, &configWatch);
+        configWatchClose(&configWatch);
+        if (broadcast) spectateWriterClose(broadcast);
+        hiscoreClose(scores);
+        replayWriterClose(&writer);
+        if (replay.player) replayClose(&reader);
+        TRACE_DUMP(tracePath);
+        if (waveSource) waveSourceClose(waveSource);
+        if (hashLog) fclose(hashLog);
+        return rc;
+    }
+
     // 1. Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         printf("SDL failed: %s\n", SDL_GetError());
@@ -178,7 +8208,8 @@ int main(int argc, char* argv[])
     SDL_Window* window = SDL_CreateWindow(
         "Space Invaders (Restart & Score)",
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN
+        config.windowWidth, config.windowHeight,
+        SDL_WINDOW_SHOWN | (internalW > 0 ? SDL_WINDOW_RESIZABLE : 0)
     );
     if (!window) {
         printf("Window creation failed: %s\n", SDL_GetError());
@@ -188,26 +8219,31 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // Create Renderer
-    SDL_Renderer* renderer = SDL_CreateRenderer(
-        window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
-    );
-    if (!renderer) {
-        printf("Renderer creation failed: %s\n", SDL_GetError());
-        SDL_DestroyWindow(window);
-        TTF_Quit();
-        IMG_Quit();
-        SDL_Quit();
-        return 1;
+    // Create Renderer (none with --soft-blit, which draws into the window surface)
+    SDL_Renderer* renderer = NULL;
+    if (!softBlit) {
+        Uint32 rendererFlags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC;
+        if (exportPath || internalW > 0) rendererFlags |= SDL_RENDERER_TARGETTEXTURE;
+        renderer = SDL_CreateRenderer(window, -1, rendererFlags);
+        if (!renderer) {
+            printf("Renderer creation failed: %s\n", SDL_GetError());
+            SDL_DestroyWindow(window);
+            TTF_Quit();
+            IMG_Quit();
+            SDL_Quit();
+            return 1;
+        }
     }
 
-    // Load textures
-    SDL_Texture* shipTex  = loadTexture(renderer, "ship.png");
-    SDL_Texture* alienTex = loadTexture(renderer, "alien.jpg");
-    if (!shipTex || !alienTex) {
-        SDL_DestroyTexture(shipTex);
-        SDL_DestroyTexture(alienTex);
-        SDL_DestroyRenderer(renderer);
+    if (configPath) configApplyWindow(window, renderer, &config, internalW == 0);
+
+    // Load textures and font
+    RenderAssets assets;
+    SoftBlitter  soft;
+    memset(&assets, 0, sizeof(assets));
+    memset(&soft, 0, sizeof(soft));
+    if (softBlit ? !softBlitOpen(&soft) : !loadAssets(renderer, &assets, true)) {
+        if (renderer) SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         TTF_Quit();
         IMG_Quit();
@@ -215,54 +8251,82 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // Load font
-    TTF_Font* font = TTF_OpenFont("/System/Library/Fonts/Supplemental/Arial.ttf", 32);
-    if (!font) {
-        printf("TTF_OpenFont failed: %s\n", TTF_GetError());
-        SDL_DestroyTexture(shipTex);
-        SDL_DestroyTexture(alienTex);
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        TTF_Quit();
-        IMG_Quit();
-        SDL_Quit();
-        return 1;
+    // Optional video export of the live session
+    Capture capture;
+    memset(&capture, 0, sizeof(capture));
+    if (exportPath && !captureOpen(&capture, renderer, WINDOW_WIDTH, WINDOW_HEIGHT,
+                                   exportPath, exportIsPipe, false)) {
+        captureClose(&capture);
+    }
+
+    // Optional low-res internal target, upscaled to whatever the window is
+    LowResTarget lowRes;
+    memset(&lowRes, 0, sizeof(lowRes));
+    if (internalW > 0) lowResOpen(&lowRes, renderer, internalW, internalH);
+
+    // Sound (optional)
+    AudioMixer mixer;
+    memset(&mixer, 0, sizeof(mixer));
+    if (withAudio) audioOpen(&mixer);
+
+    // Explosion particles
+    ParticleSystem particles;
+    if (!particlesInit(&particles, config.particles)) {
+        printf("Particle pool allocation failed\n");
+        gRunning = false;
     }
 
-    // Setup Player
-    Player player;
-    player.w = PLAYER_WIDTH;
-    player.h = PLAYER_HEIGHT;
-    player.x = (WINDOW_WIDTH - player.w) / 2;
-    player.y = WINDOW_HEIGHT - (player.h + 40);
-    player.vx= 0;
+    // Setup game state
+    GameState  game;
+    GameEvents events;
+    memset(&game, 0, sizeof(game));
+    game.waves     = waveSource;
+    game.events    = &events;
+    game.timeScale = timeScale;
+    game.config    = config.sim;
+    if (replay.player) replayConfig(replay.player, 0, &game);
+    resetGame(&game);
+    logStateHash(hashLog, &game);
+    unsigned configSeen = 0;
+
+    // Replay playback position; arrows scrub instead of steering
+    uint64_t replayFrame    = replay.seek;
+    bool     desyncReported = false;
+    if (replay.player && replayFrame > 0) {
+        replaySeek(replay.player, &game, replayFrame);
+        if (replayFrame > replay.player->frames) replayFrame = replay.player->frames;
+    }
 
-    // Setup Bullets
-    Bullet bullets[MAX_BULLETS];
-    for (int i = 0; i < MAX_BULLETS; i++) {
-        bullets[i].x      = 0;
-        bullets[i].y      = 0;
-        bullets[i].w      = BULLET_WIDTH;
-        bullets[i].h      = BULLET_HEIGHT;
-        bullets[i].active = false;
+    // Spectators render someone else's game from the broadcast
+    static SpectateReader spectator;    // GameState + slot buffer; keep off the stack
+    if (spectateName && !spectateOpen(&spectator, spectateName)) {
+        gRunning = false;
     }
 
-    // Setup Aliens (single row)
-    Alien aliens[ALIEN_COUNT];
-    for (int i = 0; i < ALIEN_COUNT; i++) {
-        aliens[i].x      = ALIEN_START_X + i * ALIEN_SPACING;
-        aliens[i].y      = ALIEN_START_Y;
-        aliens[i].w      = ALIEN_WIDTH;
-        aliens[i].h      = ALIEN_HEIGHT;
-        aliens[i].active = true;
+    // Optional simulation thread; from here on it owns `game`
+    SimThread sim;
+    memset(&sim, 0, sizeof(sim));
+    if (threaded && !spectateName && gRunning && !simThreadStart(&sim, &game, &mixer, hashLog,
+                                                   replay.recorder, broadcast)) {
+        gRunning = false;
     }
 
-    bool allAliensDead = false;
+    // Optional hardware counters around the update and render phases
+    PerfCounters perf;
+    memset(&perf, 0, sizeof(perf));
+    if (perfLogPath) perfOpen(&perf, perfLogPath);
+
+    int moveDir = 0; // held arrow key direction
 
     // Main loop
     while (gRunning)
     {
         // 1) Events
+        TRACE_SCOPE("frame");
+        perfFrameBegin(&perf);
+        TRACE_BEGIN("poll events");
+        GameInput input = { 0, false, false };
+        long long seekBy = 0;
         SDL_Event e;
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT) {
@@ -275,31 +8339,24 @@ int main(int argc, char* argv[])
                         break;
 
                     case SDLK_LEFT:
-                        player.vx = -PLAYER_SPEED;
+                        moveDir = -1;
+                        seekBy -= REPLAY_SEEK_STEP;
                         break;
                     case SDLK_RIGHT:
-                        player.vx = PLAYER_SPEED;
+                        moveDir = 1;
+                        seekBy += REPLAY_SEEK_STEP;
                         break;
 
                     case SDLK_SPACE:
-                        // Fire bullet if any free slot
-                        if (!gGameOver) {
-                            for (int i = 0; i < MAX_BULLETS; i++) {
-                                if (!bullets[i].active) {
-                                    bullets[i].active = true;
-                                    bullets[i].x = player.x + (player.w/2) - (bullets[i].w/2);
-                                    bullets[i].y = player.y - bullets[i].h;
-                                    break;
-                                }
-                            }
-                        }
+                        input.fire = true;
                         break;
 
                     case SDLK_r:
-                        // Press R to restart if game over
-                        if (gGameOver) {
-                            resetGame(&player, bullets, aliens, ALIEN_COUNT);
-                        }
+                        input.restart = true;
+                        break;
+
+                    case SDLK_F9:   // dump the trace so far
+                        TRACE_DUMP(tracePath);
                         break;
 
                     default:
@@ -309,215 +8366,148 @@ int main(int argc, char* argv[])
             else if (e.type == SDL_KEYUP) {
                 switch (e.key.keysym.sym) {
                     case SDLK_LEFT:
-                        if (player.vx < 0) player.vx = 0;
+                        if (moveDir < 0) moveDir = 0;
                         break;
                     case SDLK_RIGHT:
-                        if (player.vx > 0) player.vx = 0;
+                        if (moveDir > 0) moveDir = 0;
                         break;
                     default:
                         break;
                 }
             }
         }
+        input.move = moveDir;
+        if (replay.player && seekBy != 0) {
+            long long target = (long long)replayFrame + seekBy;
+            if (target < 0) target = 0;
+            if ((uint64_t)target > replay.player->frames) target = (long long)replay.player->frames;
+            replayFrame = (uint64_t)target;
+            replaySeek(replay.player, &game, replayFrame);
+        }
+        TRACE_END();
 
-        // 2) Update Logic if not game over
-        if (!gGameOver) {
-            // Move player
-            player.x += player.vx;
-            if (player.x < 0) player.x = 0;
-            if (player.x + player.w > WINDOW_WIDTH) {
-                player.x = WINDOW_WIDTH - player.w;
-            }
-
-            // Update bullets
-            for (int i = 0; i < MAX_BULLETS; i++) {
-                if (bullets[i].active) {
-                    bullets[i].y -= BULLET_SPEED;
-                    if (bullets[i].y + bullets[i].h < 0) {
-                        bullets[i].active = false;
-                    }
-                }
-            }
-
-            // Check if aliens need to descend
-            bool needDescend = false;
-            for (int i = 0; i < ALIEN_COUNT; i++) {
-                if (!aliens[i].active) continue;
-                int newX = aliens[i].x + ALIEN_SPEED * gAlienMoveDir;
-                if (newX < 0 || (newX + aliens[i].w > WINDOW_WIDTH)) {
-                    needDescend = true;
-                    break;
-                }
-            }
+        // A saved --config applies between ticks
+        if (configReload(&configWatch, &config)) {
+            particlesResize(&particles, config.particles);
+            configApplyWindow(window, renderer, &config, internalW == 0);
+        }
 
-            if (needDescend) {
-                gAlienMoveDir = -gAlienMoveDir;
-                for (int i = 0; i < ALIEN_COUNT; i++) {
-                    if (aliens[i].active) {
-                        aliens[i].y += ALIEN_DESCENT;
-                    }
-                }
+        // 2) Update (or pick up the sim thread's latest snapshot)
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        const GameState* view = &game;
+        if (spectateName) {
+            if (spectatePoll(&spectator)) view = &spectator.state;
+            audioPlayEvents(&mixer, &spectator.events);
+            particlesSpawnFromEvents(&particles, &spectator.events);
+        } else if (sim.thread) {
+            bool fresh;
+            simThreadInput(&sim, &input);
+            const RenderSnapshot* snap = snapshotAcquire(&sim.snapshots, &fresh);
+            if (fresh) {
+                particlesSpawnFromEvents(&particles, &snap->events);
             } else {
-                // Move aliens horizontally
-                for (int i = 0; i < ALIEN_COUNT; i++) {
-                    if (aliens[i].active) {
-                        aliens[i].x += ALIEN_SPEED * gAlienMoveDir;
-                    }
-                }
-            }
-
-            // Collision: bullet vs. aliens
-            for (int b = 0; b < MAX_BULLETS; b++) {
-                if (!bullets[b].active) continue;
-                for (int i = 0; i < ALIEN_COUNT; i++) {
-                    if (!aliens[i].active) continue;
-                    if (rect_collide(bullets[b].x, bullets[b].y,
-                                     bullets[b].w, bullets[b].h,
-                                     aliens[i].x, aliens[i].y,
-                                     aliens[i].w, aliens[i].h))
-                    {
-                        aliens[i].active   = false;
-                        bullets[b].active = false;
-                        gScore += 10;
-                        break;
-                    }
-                }
+                sim.repeats++;
             }
-
-            // Check if aliens reached bottom => lose life or game over
-            for (int i = 0; i < ALIEN_COUNT; i++) {
-                if (aliens[i].active) {
-                    if (aliens[i].y + aliens[i].h >= player.y) {
-                        // Aliens reached player row
-                        gLives--;
-                        if (gLives <= 0) {
-                            gGameOver = true;
-                        } else {
-                            // Reset aliens & bullets
-                            for (int a = 0; a < ALIEN_COUNT; a++) {
-                                aliens[a].active = true;
-                                aliens[a].x = ALIEN_START_X + a * ALIEN_SPACING;
-                                aliens[a].y = ALIEN_START_Y;
-                            }
-                            for (int b = 0; b < MAX_BULLETS; b++) {
-                                bullets[b].active = false;
-                            }
-                        }
-                        break;
-                    }
+            view = &snap->game;
+        } else {
+            bool step = true;
+            if (replay.player) {     // recorded input; holds on the last update
+                step = replayInput(replay.player, replayFrame, &input);
+                if (step && !replayVerify(replay.player, replayFrame, &game) &&
+                    !desyncReported) {
+                    printf("replay: state differs from keyframe at update %llu\n",
+                           (unsigned long long)replayFrame);
+                    desyncReported = true;
                 }
+                replayConfig(replay.player, replayFrame, &game);
+                replayFrame += step;
+            } else {
+                configAdopt(&game, &configSeen);
             }
-        }
-
-        // Check if all aliens are dead => victory
-        allAliensDead = true;
-        for (int i = 0; i < ALIEN_COUNT; i++) {
-            if (aliens[i].active) {
-                allAliensDead = false;
-                break;
+            if (step) {
+                replayRecord(replay.recorder, &game, &input);
+                updateGame(&game, &input);
+                logStateHash(hashLog, &game);
+                spectatePublish(broadcast, &game);
+                audioPlayEvents(&mixer, &events);
+                particlesSpawnFromEvents(&particles, &events);
             }
         }
-        if (allAliensDead && !gGameOver) {
-            gGameOver = true;
-        }
+        particlesUpdate(&particles);
+        hiscoreWatch(scores, view);
+        leaderboardWatch(board, view);
+        perfPhaseEnd(&perf, PERF_PHASE_UPDATE);
 
         // 3) Render
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-
-        // Draw player
-        if (shipTex) {
-            SDL_Rect shipRect = { player.x, player.y, player.w, player.h };
-            SDL_RenderCopy(renderer, shipTex, NULL, &shipRect);
-        }
-
-        // Draw bullets (white rects)
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        for (int i = 0; i < MAX_BULLETS; i++) {
-            if (bullets[i].active) {
-                SDL_Rect bulletRect = {
-                    bullets[i].x, bullets[i].y,
-                    bullets[i].w, bullets[i].h
-                };
-                SDL_RenderFillRect(renderer, &bulletRect);
-            }
+        if (capture.out) {
+            captureBeginFrame(&capture);
+            lowResRender(&lowRes, renderer, view, &assets, &particles);
+            TRACE_BEGIN("capture readback");
+            SDL_Texture* frame = captureEndFrame(&capture);
+            TRACE_END();
+            SDL_RenderCopy(renderer, frame, NULL, NULL);
+        } else if (softBlit) {
+            SDL_Surface* surface = SDL_GetWindowSurface(window);
+            if (surface) softRenderSurface(&soft, surface, view, &particles);
+        } else {
+            lowResRender(&lowRes, renderer, view, &assets, &particles);
         }
 
-        // Draw aliens
-        for (int i = 0; i < ALIEN_COUNT; i++) {
-            if (aliens[i].active && alienTex) {
-                SDL_Rect alienRect = { aliens[i].x, aliens[i].y,
-                                       aliens[i].w, aliens[i].h };
-                SDL_RenderCopy(renderer, alienTex, NULL, &alienRect);
-            }
+        Uint64 presentStart = SDL_GetPerformanceCounter();
+        perfPhaseEnd(&perf, PERF_PHASE_RENDER);
+        perfFrameEnd(&perf);
+        TRACE_BEGIN("present");
+        if (softBlit) {
+            SDL_UpdateWindowSurface(window);
+        } else {
+            SDL_RenderPresent(renderer);
+        }
+        TRACE_END();
+        Uint64 frameEnd = SDL_GetPerformanceCounter();
+        sim.frames++;
+        sim.frameTotal   += frameEnd - frameStart;
+        sim.presentTotal += frameEnd - presentStart;
+        if (frameEnd - presentStart > sim.presentMax) {
+            sim.presentMax = frameEnd - presentStart;
         }
 
-        // Draw scoreboard (top-left corner)
-        {
-            char scoreBuf[64];
-            sprintf(scoreBuf, "Score: %d   Lives: %d", gScore, gLives);
-            SDL_Color white = {255, 255, 255, 255};
-            int textW = 0, textH = 0;
-            SDL_Texture* scoreTex = renderText(renderer, font, scoreBuf, white, &textW, &textH);
-            if (scoreTex) {
-                SDL_Rect scoreRect = { 10, 10, textW, textH };
-                SDL_RenderCopy(renderer, scoreTex, NULL, &scoreRect);
-                SDL_DestroyTexture(scoreTex);
-            }
-        }
-
-        // If game over, display "Victory!" or "Game Over!" + "Press R"
-        if (gGameOver) {
-            SDL_Color color = {255, 0, 0, 255}; // Red text
-            const char* msg = (allAliensDead && gLives > 0) ? "Victory!" : "Game Over!";
-            int textW = 0, textH = 0;
-            SDL_Texture* textTexture = renderText(renderer, font, msg, color, &textW, &textH);
-            if (textTexture) {
-                // Center the text
-                SDL_Rect dstRect = {
-                    (WINDOW_WIDTH - textW)/2,
-                    (WINDOW_HEIGHT - textH)/2,
-                    textW,
-                    textH
-                };
-                SDL_RenderCopy(renderer, textTexture, NULL, &dstRect);
-                SDL_DestroyTexture(textTexture);
-            }
-
-            // Additional prompt: Press R to restart
-            {
-                SDL_Color white = {255, 255, 255, 255};
-                int rw=0, rh=0;
-                SDL_Texture* restartTex = renderText(renderer, font,
-                                                     "Press R to restart",
-                                                     white, &rw, &rh);
-                if (restartTex) {
-                    SDL_Rect rdst = {
-                        (WINDOW_WIDTH - rw)/2,
-                        (WINDOW_HEIGHT - rh)/2 + 50, // some offset below
-                        rw,
-                        rh
-                    };
-                    SDL_RenderCopy(renderer, restartTex, NULL, &rdst);
-                    SDL_DestroyTexture(restartTex);
-                }
+        // The window surface has no vsync; hold the loop to SIM_HZ instead
+        if (softBlit) {
+            Uint64 freq  = SDL_GetPerformanceFrequency();
+            Uint64 spent = frameEnd - frameStart;
+            if (spent < freq / SIM_HZ) {
+                SDL_Delay((Uint32)((freq / SIM_HZ - spent) * 1000 / freq));
             }
         }
-
-        SDL_RenderPresent(renderer);
     }
 
     // Cleanup
-    TTF_CloseFont(font);
-    SDL_DestroyTexture(alienTex);
-    SDL_DestroyTexture(shipTex);
-    SDL_DestroyRenderer(renderer);
+    simThreadStop(&sim);
+    configWatchClose(&configWatch);
+    hiscoreQuit(scores, &game);
+    hiscoreClose(scores);
+    leaderboardClose(board, &game);
+    if (broadcast) spectateWriterClose(broadcast);
+    if (spectateName) spectateClose(&spectator);
+    perfClose(&perf);
+    TRACE_DUMP(tracePath);
+    particlesFree(&particles);
+    audioClose(&mixer);
+    captureClose(&capture);
+    lowResClose(&lowRes);
+    softBlitClose(&soft);
+    freeAssets(&assets);
+    if (renderer) SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 
     TTF_Quit();
     IMG_Quit();
     SDL_Quit();
 
-    printf("\nFinal Score: %d\n", gScore);
+    replayWriterClose(&writer);
+    if (replay.player) replayClose(&reader);
+    if (waveSource) waveSourceClose(waveSource);
+    if (hashLog) fclose(hashLog);
+    if (!spectateName) printf("\nFinal Score: %d\n", game.score);
     return 0;
-}
\ No newline at end of file
+}